@@ -37,6 +37,10 @@ class Order {
     /// @brief After generating as many trades as possible against
     /// orders already on the market, cancel any remaining quantity.
     virtual bool immediate_or_cancel() const;
+
+    /// @brief get the owner (account) of this order for self-trade prevention.
+    /// Orders of owner 0 are never treated as self trades.
+    virtual OwnerId owner() const;
 };
 
 inline bool Order::is_limit() const {
@@ -58,5 +62,10 @@ inline bool Order::immediate_or_cancel() const {
     return false;
 }
 
+inline OwnerId Order::owner() const {
+    // default to anonymous
+    return 0;
+}
+
 } // namespace book
 } // namespace liquibook
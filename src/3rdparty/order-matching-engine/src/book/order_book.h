@@ -19,6 +19,7 @@
 #include <map>
 #include <sstream>
 #include <stdexcept>
+#include <unordered_map>
 #include <vector>
 
 #ifdef LIQUIBOOK_IGNORES_DEPRECATED_CALLS
@@ -60,6 +61,8 @@ template <typename OrderPtr> class OrderBook {
     typedef TrackerMap Asks;
 
     typedef std::list<typename TrackerMap::iterator> DeferredMatches;
+    /// @brief handle of every order resting on the market, keyed by order address
+    typedef std::unordered_map<const void*, typename TrackerMap::iterator> OrderLocator;
 
     /// @brief construct
     OrderBook(const std::string& symbol = "unknown");
@@ -93,6 +96,8 @@ template <typename OrderPtr> class OrderBook {
     virtual void cancel(const OrderPtr& order);
 
     /// @brief replace an order in the book
+    /// A size reduction at an unchanged price is applied in place and keeps
+    /// the order's time priority; any other change requeues the order.
     /// @param order the order to replace
     /// @param size_delta the change in size for the order (positive or negative)
     /// @param new_price the new order price, or PRICE_UNCHANGED
@@ -102,6 +107,19 @@ template <typename OrderPtr> class OrderBook {
         int64_t size_delta = SIZE_UNCHANGED,
         Price new_price = PRICE_UNCHANGED);
 
+    /// @brief put a resting order back on the book, e.g. when loading a snapshot
+    /// The order goes to the back of its price level without matching and without
+    /// callbacks, so listeners (and depth) are not told. Restoring each side in
+    /// priority order (best price first, oldest first within a level) makes every
+    /// insert amortized constant time. The order must not cross the book.
+    /// @param order the order
+    /// @param open_qty quantity still open; order_qty() less this counts as filled
+    /// @param conditions special conditions on the order
+    void restore(const OrderPtr& order, Quantity open_qty, OrderConditions conditions = 0);
+
+    /// @brief make room for this many resting orders ahead of a run of restore()s
+    void reserve(size_t orders) { locator_.reserve(orders); }
+
     /// @brief Set the current market price
     /// Intended to be used during initialization to establish the market
     /// price before this order book has generated any exceptions.
@@ -114,6 +132,13 @@ template <typename OrderPtr> class OrderBook {
     /// The market price is normally the price at which the last trade happened.
     Price market_price() const;
 
+    /// @brief Set the self-trade prevention mode for this book.
+    /// With stp_none (the default) the match loop skips the owner check.
+    void set_self_trade_prevention(SelfTradePrevention mode);
+
+    /// @brief Get the self-trade prevention mode.
+    SelfTradePrevention self_trade_prevention() const;
+
     /// @brief access the bids container
     const TrackerMap& bids() const {
         return bids_;
@@ -204,6 +229,22 @@ template <typename OrderPtr> class OrderBook {
     Quantity create_trade(
         Tracker& inbound_tracker, Tracker& current_tracker, Quantity max_quantity = QUANTITY_MAX);
 
+    /// @brief apply the self-trade prevention mode to an inbound order that
+    /// would trade against a resting order of the same owner.
+    /// @param inbound the inbound order
+    /// @param entry the resting order; erased if it is cancelled
+    /// @param current_orders the container of the resting order
+    /// @return true if the inbound order was cancelled and must stop matching
+    bool prevent_self_trade(
+        Tracker& inbound, typename TrackerMap::iterator entry, TrackerMap& current_orders);
+
+    /// @brief insert a tracker on the market and remember its handle
+    typename TrackerMap::iterator
+    insert_on_market(TrackerMap& market, const ComparablePrice& key, const Tracker& tracker);
+
+    /// @brief remove an order from the market and forget its handle
+    void erase_from_market(TrackerMap& market, typename TrackerMap::iterator pos);
+
     /// @brief find an order in a container
     /// @param order is the the order we are looking for
     /// @param[OUT] result will point to the entry in the container if we find a match
@@ -298,6 +339,7 @@ template <typename OrderPtr> class OrderBook {
     std::string symbol_;
     TrackerMap bids_;
     TrackerMap asks_;
+    OrderLocator locator_;
 
     TrackerMap stopBids_;
     TrackerMap stopAsks_;
@@ -311,13 +353,14 @@ template <typename OrderPtr> class OrderBook {
     TypedOrderBookListener* order_book_listener_;
     Logger* logger_;
     Price marketPrice_;
+    SelfTradePrevention stp_;
 };
 
 template <class OrderPtr>
 OrderBook<OrderPtr>::OrderBook(const std::string& symbol)
     : symbol_(symbol), handling_callbacks_(false), order_listener_(nullptr),
       trade_listener_(nullptr), order_book_listener_(nullptr), logger_(nullptr),
-      marketPrice_(MARKET_ORDER_PRICE) {
+      marketPrice_(MARKET_ORDER_PRICE), stp_(stp_none) {
     callbacks_.reserve(16); // Why 16?  Why not?
     workingCallbacks_.reserve(callbacks_.capacity());
 }
@@ -354,6 +397,15 @@ template <class OrderPtr> Price OrderBook<OrderPtr>::market_price() const {
     return marketPrice_;
 }
 
+template <class OrderPtr>
+void OrderBook<OrderPtr>::set_self_trade_prevention(SelfTradePrevention mode) {
+    stp_ = mode;
+}
+
+template <class OrderPtr> SelfTradePrevention OrderBook<OrderPtr>::self_trade_prevention() const {
+    return stp_;
+}
+
 template <class OrderPtr>
 void OrderBook<OrderPtr>::set_order_listener(TypedOrderListener* listener) {
     order_listener_ = listener;
@@ -405,6 +457,18 @@ bool OrderBook<OrderPtr>::add(const OrderPtr& order, OrderConditions conditions)
     return matched;
 }
 
+template <class OrderPtr>
+void OrderBook<OrderPtr>::restore(
+    const OrderPtr& order, Quantity open_qty, OrderConditions conditions) {
+    Tracker tracker(order, conditions);
+    tracker.fill(order->order_qty() - open_qty);
+    TrackerMap& market = order->is_buy() ? bids_ : asks_;
+    // the hint puts the order after every equal key, keeping time priority
+    auto pos = market.emplace_hint(
+        market.end(), ComparablePrice(order->is_buy(), order->price()), tracker);
+    locator_[&*order] = pos;
+}
+
 template <class OrderPtr> void OrderBook<OrderPtr>::cancel(const OrderPtr& order) {
     bool found = false;
     bool foundStop = false;
@@ -416,7 +480,7 @@ template <class OrderPtr> void OrderBook<OrderPtr>::cancel(const OrderPtr& order
         if (bid != bids_.end()) {
             open_qty = bid->second.open_qty();
             // Remove from container for cancel
-            bids_.erase(bid);
+            erase_from_market(bids_, bid);
             found = true;
         } else if (order->stop_price()) {
             find_in_stop_orders(order, bid);
@@ -432,7 +496,7 @@ template <class OrderPtr> void OrderBook<OrderPtr>::cancel(const OrderPtr& order
         if (ask != asks_.end()) {
             open_qty = ask->second.open_qty();
             // Remove from container for cancel
-            asks_.erase(ask);
+            erase_from_market(asks_, ask);
             found = true;
         } else if (order->stop_price()) {
             find_in_stop_orders(order, ask);
@@ -490,12 +554,15 @@ bool OrderBook<OrderPtr>::replace(const OrderPtr& order, int64_t size_delta, Pri
         if (!new_open_qty) {
             // Cancel with NO open qty (should be zero after replace)
             callbacks_.push_back(TypedCallback::cancel(order, 0));
-            market.erase(pos); // Remove order
+            erase_from_market(market, pos); // Remove order
+        } else if (!price_change && size_delta <= 0 && !pos->second.all_or_none()) {
+            // A smaller order at the same price cannot cross anything new:
+            // leave it where it is so it keeps its place in the queue
         } else {
             // Else rematch the new order - there could be a price change
             // or size change - that could cause all or none match
             auto order = pos->second;
-            market.erase(pos);                 // Remove old order order
+            erase_from_market(market, pos);    // Remove old order order
             matched = add_order(order, price); // Add order
         }
         // If replace any order this order triggered any trades
@@ -557,23 +624,32 @@ template <class OrderPtr> bool OrderBook<OrderPtr>::submit_order(Tracker& inboun
     return add_order(inbound, order_price);
 }
 
+template <class OrderPtr>
+typename OrderBook<OrderPtr>::TrackerMap::iterator OrderBook<OrderPtr>::insert_on_market(
+    TrackerMap& market, const ComparablePrice& key, const Tracker& tracker) {
+    auto pos = market.insert(std::make_pair(key, tracker));
+    locator_[&*tracker.ptr()] = pos;
+    return pos;
+}
+
+template <class OrderPtr>
+void OrderBook<OrderPtr>::erase_from_market(
+    TrackerMap& market, typename TrackerMap::iterator pos) {
+    locator_.erase(&*pos->second.ptr());
+    market.erase(pos);
+}
+
 template <class OrderPtr>
 bool OrderBook<OrderPtr>::find_on_market(
     const OrderPtr& order, typename TrackerMap::iterator& result) {
-    const ComparablePrice key(order->is_buy(), order->price());
     TrackerMap& sideMap = order->is_buy() ? bids_ : asks_;
-
-    for (result = sideMap.find(key); result != sideMap.end(); ++result) {
-        // If this is the correct bid
-        if (result->second.ptr() == order) {
-            return true;
-        } else if (key < result->first) {
-            // exit early if result is beyond the matching prices
-            result = sideMap.end();
-            return false;
-        }
+    auto found = locator_.find(&*order);
+    if (found == locator_.end()) {
+        result = sideMap.end();
+        return false;
     }
-    return false;
+    result = found->second;
+    return true;
 }
 
 template <class OrderPtr>
@@ -614,7 +690,7 @@ template <class OrderPtr> bool OrderBook<OrderPtr>::add_order(Tracker& inbound,
         // If this is a buy order
         if (order->is_buy()) {
             // Insert into bids
-            bids_.insert(std::make_pair(ComparablePrice(true, order_price), inbound));
+            insert_on_market(bids_, ComparablePrice(true, order_price), inbound);
             // and see if that satisfies any ask orders
             if (check_deferred_aons(deferred_aons, asks_, bids_)) {
                 matched = true;
@@ -622,7 +698,7 @@ template <class OrderPtr> bool OrderBook<OrderPtr>::add_order(Tracker& inbound,
         } else {
             // Else this is a sell order
             // Insert into asks
-            asks_.insert(std::make_pair(ComparablePrice(false, order_price), inbound));
+            insert_on_market(asks_, ComparablePrice(false, order_price), inbound);
             if (check_deferred_aons(deferred_aons, bids_, asks_)) {
                 matched = true;
             }
@@ -644,7 +720,7 @@ bool OrderBook<OrderPtr>::check_deferred_aons(
         bool matched = match_order(tracker, current_price.price(), marketTrackers, ignoredAons);
         result |= matched;
         if (tracker.filled()) {
-            deferredTrackers.erase(entry);
+            erase_from_market(deferredTrackers, entry);
         }
     }
     return result;
@@ -692,6 +768,13 @@ bool OrderBook<OrderPtr>::match_regular_order(
         //////////////////////////////////////
         // Current price matches inbound price
         Tracker& current_order = entry->second;
+        if (stp_ != stp_none && current_order.owner() == inbound.owner() && inbound.owner()) {
+            if (prevent_self_trade(inbound, entry, current_orders)) {
+                break;
+            }
+            inbound_qty = inbound.open_qty();
+            continue;
+        }
         Quantity current_quantity = current_order.open_qty();
 
         if (current_order.all_or_none()) {
@@ -703,7 +786,7 @@ bool OrderBook<OrderPtr>::match_regular_order(
                 if (traded > 0) {
                     matched = true;
                     // assert traded == current_quantity
-                    current_orders.erase(entry);
+                    erase_from_market(current_orders, entry);
                     inbound_qty -= traded;
                 }
             } else {
@@ -717,7 +800,7 @@ bool OrderBook<OrderPtr>::match_regular_order(
             if (traded > 0) {
                 matched = true;
                 if (current_order.filled()) {
-                    current_orders.erase(entry);
+                    erase_from_market(current_orders, entry);
                 }
                 inbound_qty -= traded;
             }
@@ -750,6 +833,13 @@ bool OrderBook<OrderPtr>::match_aon_order(
         //////////////////////////////////////
         // Current price matches inbound price
         Tracker& current_order = entry->second;
+        if (stp_ != stp_none && current_order.owner() == inbound.owner() && inbound.owner()) {
+            if (prevent_self_trade(inbound, entry, current_orders)) {
+                break;
+            }
+            inbound_qty = inbound.open_qty();
+            continue;
+        }
         Quantity current_quantity = current_order.open_qty();
 
         if (current_order.all_or_none()) {
@@ -772,7 +862,7 @@ bool OrderBook<OrderPtr>::match_aon_order(
                             // assert traded == current_quantity
                             inbound_qty -= traded;
                             matched = true;
-                            current_orders.erase(entry);
+                            erase_from_market(current_orders, entry);
                         }
                     }
                 } else {
@@ -804,7 +894,7 @@ bool OrderBook<OrderPtr>::match_aon_order(
                         matched = true;
                     }
                     if (current_order.filled()) {
-                        current_orders.erase(entry);
+                        erase_from_market(current_orders, entry);
                     }
                 }
             } else {
@@ -859,13 +949,61 @@ Quantity OrderBook<OrderPtr>::try_create_deferred_trades(
             Tracker& tracker = entry->second;
             traded += create_trade(inbound, tracker, fills[index]);
             if (tracker.filled()) {
-                current_orders.erase(entry);
+                erase_from_market(current_orders, entry);
             }
         }
     }
     return traded;
 }
 
+template <class OrderPtr>
+bool OrderBook<OrderPtr>::prevent_self_trade(
+    Tracker& inbound, typename TrackerMap::iterator entry, TrackerMap& current_orders) {
+    Tracker& resting = entry->second;
+    bool cancel_inbound = false;
+    bool cancel_resting = false;
+    switch (stp_) {
+        case stp_cancel_newest:
+            cancel_inbound = true;
+            break;
+        case stp_cancel_oldest:
+            cancel_resting = true;
+            break;
+        case stp_cancel_both:
+            cancel_inbound = cancel_resting = true;
+            break;
+        case stp_decrement_and_cancel: {
+            const int64_t qty = (std::min) (inbound.open_qty(), resting.open_qty());
+            cancel_inbound = (inbound.open_qty() == Quantity(qty));
+            cancel_resting = (resting.open_qty() == Quantity(qty));
+            // The larger order survives with its size reduced, reported as a replace
+            if (!cancel_inbound) {
+                callbacks_.push_back(TypedCallback::replace(
+                    inbound.ptr(), inbound.open_qty(), -qty, inbound.ptr()->price()));
+                inbound.change_qty(-qty);
+            }
+            if (!cancel_resting) {
+                callbacks_.push_back(TypedCallback::replace(
+                    resting.ptr(), resting.open_qty(), -qty, resting.ptr()->price()));
+                resting.change_qty(-qty);
+            }
+            break;
+        }
+        default:
+            return false;
+    }
+    if (cancel_resting) {
+        callbacks_.push_back(TypedCallback::cancel(resting.ptr(), resting.open_qty()));
+        erase_from_market(current_orders, entry);
+    }
+    if (cancel_inbound) {
+        // Zero the open quantity so the order is neither matched further nor rested
+        callbacks_.push_back(TypedCallback::cancel(inbound.ptr(), inbound.open_qty()));
+        inbound.change_qty(-int64_t(inbound.open_qty()));
+    }
+    return cancel_inbound;
+}
+
 template <class OrderPtr>
 Quantity OrderBook<OrderPtr>::create_trade(
     Tracker& inbound_tracker, Tracker& current_tracker, Quantity maxQuantity) {
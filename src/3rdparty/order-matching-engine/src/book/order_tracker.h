@@ -16,6 +16,7 @@ template <typename OrderPtr> class OrderTracker {
     OrderTracker(const OrderPtr& order, OrderConditions conditions = 0);
 
     /// @brief modify the order quantity
+    /// Not counted as a fill; used for replaces and self-trade prevention.
     void change_qty(int64_t delta);
 
     /// @brief fill an order
@@ -43,18 +44,25 @@ template <typename OrderPtr> class OrderTracker {
     /// @ brief is this order marked immediate or cancel?
     bool immediate_or_cancel() const;
 
+    /// @brief owner of the order, captured on entry so the match loop
+    /// compares integers instead of calling through the order pointer
+    OwnerId owner() const;
+
     Quantity reserve(int64_t reserved);
 
   private:
     OrderPtr order_;
     Quantity open_qty_;
+    Quantity filled_qty_;
     int64_t reserved_;
     OrderConditions conditions_;
+    OwnerId owner_;
 };
 
 template <class OrderPtr>
 OrderTracker<OrderPtr>::OrderTracker(const OrderPtr& order, OrderConditions conditions)
-    : order_(order), open_qty_(order->order_qty()), reserved_(0), conditions_(conditions) {
+    : order_(order), open_qty_(order->order_qty()), filled_qty_(0), reserved_(0),
+      conditions_(conditions), owner_(order->owner()) {
 #if defined(LIQUIBOOK_ORDER_KNOWS_CONDITIONS)
     if (order->all_or_none()) {
         conditions |= oc_all_or_none;
@@ -82,6 +90,7 @@ template <class OrderPtr> void OrderTracker<OrderPtr>::fill(Quantity qty) {
         throw std::runtime_error("Fill size larger than open quantity");
     }
     open_qty_ -= qty;
+    filled_qty_ += qty;
 }
 
 template <class OrderPtr> bool OrderTracker<OrderPtr>::filled() const {
@@ -89,7 +98,7 @@ template <class OrderPtr> bool OrderTracker<OrderPtr>::filled() const {
 }
 
 template <class OrderPtr> Quantity OrderTracker<OrderPtr>::filled_qty() const {
-    return order_->order_qty() - open_qty();
+    return filled_qty_;
 }
 
 // TODO: Rename this to be available and change the rest of the
@@ -115,5 +124,9 @@ template <class OrderPtr> bool OrderTracker<OrderPtr>::immediate_or_cancel() con
     return bool((conditions_ & oc_immediate_or_cancel) != 0);
 }
 
+template <class OrderPtr> OwnerId OrderTracker<OrderPtr>::owner() const {
+    return owner_;
+}
+
 } // namespace book
 } // namespace liquibook
@@ -16,6 +16,8 @@ typedef uint64_t Cost;
 typedef uint32_t FillId;
 typedef uint32_t ChangeId;
 typedef uint32_t OrderConditions;
+typedef uint32_t OwnerId;
+typedef uint64_t OrderId;
 
 enum OrderCondition {
     oc_no_conditions = 0,
@@ -25,6 +27,16 @@ enum OrderCondition {
     oc_stop = oc_immediate_or_cancel << 1
 };
 
+/// @brief what the book does when an inbound order would trade against a
+/// resting order of the same (non-zero) owner.
+enum SelfTradePrevention {
+    stp_none,                // allow the trade
+    stp_cancel_newest,       // cancel the rest of the inbound order
+    stp_cancel_oldest,       // cancel the resting order and keep matching
+    stp_cancel_both,         // cancel both orders
+    stp_decrement_and_cancel // reduce both by the smaller size, cancel whichever reaches zero
+};
+
 namespace {
 // Constants used in liquibook API
 const Price MARKET_ORDER_PRICE(0);
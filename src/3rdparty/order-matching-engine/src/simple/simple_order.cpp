@@ -8,16 +8,19 @@
 namespace liquibook {
 namespace simple {
 
-uint32_t SimpleOrder::last_order_id_(0);
+std::atomic<book::OrderId> SimpleOrder::last_order_id_(0);
 
 SimpleOrder::SimpleOrder(
     bool is_buy,
     book::Price price,
     book::Quantity qty,
     book::Price stop_price,
-    book::OrderConditions conditions)
+    book::OrderConditions conditions,
+    book::OwnerId owner,
+    book::OrderId order_id)
     : state_(os_new), is_buy_(is_buy), order_qty_(qty), price_(price), stop_price_(stop_price),
-      conditions_(conditions), filled_qty_(0), filled_cost_(0), order_id_(++last_order_id_) {}
+      conditions_(conditions), owner_(owner), filled_qty_(0), filled_cost_(0),
+      order_id_(order_id ? order_id : ++last_order_id_) {}
 
 const OrderState& SimpleOrder::state() const {
     return state_;
@@ -46,6 +49,11 @@ bool SimpleOrder::all_or_none() const {
 bool SimpleOrder::immediate_or_cancel() const {
     return (conditions_ & book::OrderCondition::oc_immediate_or_cancel) != 0;
 }
+
+book::OwnerId SimpleOrder::owner() const {
+    return owner_;
+}
+
 book::Quantity SimpleOrder::order_qty() const {
     return order_qty_;
 }
@@ -7,6 +7,8 @@
 #include <book/order.h>
 #include <book/types.h>
 
+#include <atomic>
+
 namespace liquibook {
 namespace simple {
 
@@ -20,7 +22,9 @@ class SimpleOrder : public book::Order {
         book::Price price,
         book::Quantity qty,
         book::Price stop_price = 0,
-        book::OrderConditions conditions = book::OrderCondition::oc_no_conditions);
+        book::OrderConditions conditions = book::OrderCondition::oc_no_conditions,
+        book::OwnerId owner = 0,
+        book::OrderId order_id = 0);
 
     /// @brief get the order's state
     const OrderState& state() const;
@@ -63,6 +67,9 @@ class SimpleOrder : public book::Order {
     /// orders already on the market, cancel any remaining quantity.
     virtual bool immediate_or_cancel() const;
 
+    /// @brief get the owner (account) of this order
+    virtual book::OwnerId owner() const;
+
     /// @brief exchange accepted this order
     void accept();
     /// @brief exchange cancelled this order
@@ -73,7 +80,9 @@ class SimpleOrder : public book::Order {
     /// @param new_price the new price
     void replace(book::Quantity size_delta, book::Price new_price);
 
-    uint32_t order_id() const {
+    /// @brief get the order id: the one given at construction, or the next
+    /// value of a process-wide counter if none was given
+    book::OrderId order_id() const {
         return order_id_;
     }
 
@@ -84,12 +93,13 @@ class SimpleOrder : public book::Order {
     book::Price price_;
     book::Price stop_price_;
     book::OrderConditions conditions_;
+    book::OwnerId owner_;
     book::Quantity filled_qty_;
     book::Cost filled_cost_;
-    static uint32_t last_order_id_;
+    static std::atomic<book::OrderId> last_order_id_;
 
   public:
-    const uint32_t order_id_;
+    const book::OrderId order_id_;
 };
 
 } // namespace simple
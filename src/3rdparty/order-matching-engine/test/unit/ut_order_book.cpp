@@ -1804,6 +1804,48 @@ BOOST_AUTO_TEST_CASE(TestReplaceSizeDecrease) {
     cc.reset();
 }
 
+BOOST_AUTO_TEST_CASE(TestReplaceSizeDecreaseKeepsPriority) {
+    SimpleOrderBook order_book;
+    SimpleOrder ask0(false, 1252, 300);
+    SimpleOrder ask1(false, 1252, 200);
+    SimpleOrder bid0(true, 1252, 150);
+
+    // No match
+    BOOST_CHECK(add_and_verify(order_book, &ask0, false));
+    BOOST_CHECK(add_and_verify(order_book, &ask1, false));
+
+    // Size decrease at the same price stays at the front of the level
+    BOOST_CHECK(replace_and_verify(order_book, &ask0, -150));
+    SimpleOrderBook::Asks::const_iterator ask = order_book.asks().begin();
+    BOOST_CHECK_EQUAL(&ask0, ask->second.ptr());
+    BOOST_CHECK_EQUAL(&ask1, (++ask)->second.ptr());
+
+    // Match - complete against the reduced order first
+    {
+        SimpleFillCheck fc0(&bid0, 150, 150 * 1252);
+        SimpleFillCheck fc1(&ask0, 150, 150 * 1252);
+        BOOST_CHECK(add_and_verify(order_book, &bid0, true, true));
+    }
+    BOOST_CHECK_EQUAL(1, order_book.asks().size());
+    BOOST_CHECK_EQUAL(&ask1, order_book.asks().begin()->second.ptr());
+}
+
+BOOST_AUTO_TEST_CASE(TestReplaceSizeIncreaseLosesPriority) {
+    SimpleOrderBook order_book;
+    SimpleOrder ask0(false, 1252, 300);
+    SimpleOrder ask1(false, 1252, 200);
+
+    // No match
+    BOOST_CHECK(add_and_verify(order_book, &ask0, false));
+    BOOST_CHECK(add_and_verify(order_book, &ask1, false));
+
+    // Size increase goes to the back of the level
+    BOOST_CHECK(replace_and_verify(order_book, &ask0, 100));
+    SimpleOrderBook::Asks::const_iterator ask = order_book.asks().begin();
+    BOOST_CHECK_EQUAL(&ask1, ask->second.ptr());
+    BOOST_CHECK_EQUAL(&ask0, (++ask)->second.ptr());
+}
+
 BOOST_AUTO_TEST_CASE(TestReplaceSizeDecreaseCancel) {
     SimpleOrderBook order_book;
     ChangedChecker cc(order_book.depth());
@@ -2613,4 +2655,38 @@ BOOST_AUTO_TEST_CASE(TestReplaceAskMatch) {
     BOOST_CHECK(cc.verify_ask_changed(true, true, true, false, false));
 }
 
+BOOST_AUTO_TEST_CASE(TestRestoreKeepsPriority) {
+    OrderBook<SimpleOrder*> order_book;
+    SimpleOrder bid0(true, 1251, 100);
+    SimpleOrder bid1(true, 1250, 100);
+    SimpleOrder bid2(true, 1250, 300);
+    SimpleOrder ask0(false, 1252, 100);
+    SimpleOrder ask1(false, 1250, 250);
+
+    // Restore in priority order; nothing matches and no callbacks fire
+    order_book.restore(&bid0, 100);
+    order_book.restore(&bid1, 100);
+    order_book.restore(&bid2, 200); // partially filled before the snapshot
+    order_book.restore(&ask0, 100);
+    BOOST_CHECK_EQUAL(3, order_book.bids().size());
+    BOOST_CHECK_EQUAL(1, order_book.asks().size());
+    BOOST_CHECK_EQUAL(simple::os_new, bid0.state());
+
+    auto bid = order_book.bids().begin();
+    BOOST_CHECK_EQUAL(&bid0, bid->second.ptr());
+    BOOST_CHECK_EQUAL(&bid1, (++bid)->second.ptr());
+    BOOST_CHECK_EQUAL(&bid2, (++bid)->second.ptr());
+
+    // An incoming order matches the restored ones by price, then time
+    BOOST_CHECK(order_book.add(&ask1));
+    BOOST_CHECK_EQUAL(1, order_book.bids().size());
+    BOOST_CHECK_EQUAL(&bid2, order_book.bids().begin()->second.ptr());
+    BOOST_CHECK_EQUAL(150, order_book.bids().begin()->second.open_qty());
+    BOOST_CHECK_EQUAL(150, order_book.bids().begin()->second.filled_qty());
+
+    // Restored orders can be cancelled like any other
+    order_book.cancel(&ask0);
+    BOOST_CHECK_EQUAL(0, order_book.asks().size());
+}
+
 } // namespace liquibook
@@ -0,0 +1,146 @@
+// Copyright (c) 2012 - 2017 Object Computing, Inc.
+// All rights reserved.
+// See the file license.txt for licensing information.
+
+#define BOOST_TEST_NO_MAIN LiquibookTest
+#include <boost/test/unit_test.hpp>
+
+#include "ut_utils.h"
+
+namespace liquibook {
+
+using simple::SimpleOrder;
+typedef FillCheck<SimpleOrder*> SimpleFillCheck;
+
+namespace {
+const OwnerId ALICE(1);
+const OwnerId BOB(2);
+} // namespace
+
+BOOST_AUTO_TEST_CASE(TestStpNoneAllowsSelfTrade) {
+    SimpleOrderBook order_book;
+    SimpleOrder ask0(false, 1250, 100, 0, 0, ALICE);
+    SimpleOrder bid0(true, 1250, 100, 0, 0, ALICE);
+
+    BOOST_CHECK(add_and_verify(order_book, &ask0, false));
+    {
+        SimpleFillCheck fc0(&bid0, 100, 1250 * 100);
+        SimpleFillCheck fc1(&ask0, 100, 1250 * 100);
+        BOOST_CHECK(add_and_verify(order_book, &bid0, true, true));
+    }
+    BOOST_CHECK_EQUAL(0, order_book.bids().size());
+    BOOST_CHECK_EQUAL(0, order_book.asks().size());
+}
+
+BOOST_AUTO_TEST_CASE(TestStpCancelNewest) {
+    SimpleOrderBook order_book;
+    order_book.set_self_trade_prevention(stp_cancel_newest);
+    SimpleOrder ask0(false, 1250, 100, 0, 0, ALICE);
+    SimpleOrder bid0(true, 1250, 100, 0, 0, ALICE);
+
+    BOOST_CHECK(add_and_verify(order_book, &ask0, false));
+    {
+        SimpleFillCheck fc1(&ask0, 0, 0);
+        BOOST_CHECK(!order_book.add(&bid0));
+    }
+    BOOST_CHECK_EQUAL(0, bid0.filled_qty());
+    BOOST_CHECK_EQUAL(simple::os_cancelled, bid0.state());
+    BOOST_CHECK_EQUAL(simple::os_accepted, ask0.state());
+    BOOST_CHECK_EQUAL(0, order_book.bids().size());
+    BOOST_CHECK_EQUAL(1, order_book.asks().size());
+
+    DepthCheck<SimpleOrderBook> dc(order_book.depth());
+    BOOST_CHECK(dc.verify_ask(1250, 1, 100));
+    BOOST_CHECK(dc.verify_bid(0, 0, 0));
+}
+
+BOOST_AUTO_TEST_CASE(TestStpCancelOldestKeepsMatching) {
+    SimpleOrderBook order_book;
+    order_book.set_self_trade_prevention(stp_cancel_oldest);
+    SimpleOrder ask0(false, 1250, 100, 0, 0, ALICE);
+    SimpleOrder ask1(false, 1250, 100, 0, 0, BOB);
+    SimpleOrder bid0(true, 1250, 150, 0, 0, ALICE);
+
+    BOOST_CHECK(add_and_verify(order_book, &ask0, false));
+    BOOST_CHECK(add_and_verify(order_book, &ask1, false));
+    {
+        SimpleFillCheck fc0(&bid0, 100, 1250 * 100);
+        SimpleFillCheck fc2(&ask1, 100, 1250 * 100);
+        BOOST_CHECK(add_and_verify(order_book, &bid0, true));
+    }
+    BOOST_CHECK_EQUAL(0, ask0.filled_qty());
+    BOOST_CHECK_EQUAL(simple::os_cancelled, ask0.state());
+    BOOST_CHECK_EQUAL(simple::os_complete, ask1.state());
+    BOOST_CHECK_EQUAL(1, order_book.bids().size());
+    BOOST_CHECK_EQUAL(0, order_book.asks().size());
+
+    DepthCheck<SimpleOrderBook> dc(order_book.depth());
+    BOOST_CHECK(dc.verify_bid(1250, 1, 50));
+    BOOST_CHECK(dc.verify_ask(0, 0, 0));
+}
+
+BOOST_AUTO_TEST_CASE(TestStpCancelBoth) {
+    SimpleOrderBook order_book;
+    order_book.set_self_trade_prevention(stp_cancel_both);
+    SimpleOrder ask0(false, 1250, 100, 0, 0, ALICE);
+    SimpleOrder ask1(false, 1250, 100, 0, 0, BOB);
+    SimpleOrder bid0(true, 1250, 150, 0, 0, ALICE);
+
+    BOOST_CHECK(add_and_verify(order_book, &ask0, false));
+    BOOST_CHECK(add_and_verify(order_book, &ask1, false));
+    {
+        SimpleFillCheck fc2(&ask1, 0, 0);
+        BOOST_CHECK(!order_book.add(&bid0));
+    }
+    BOOST_CHECK_EQUAL(0, bid0.filled_qty());
+    BOOST_CHECK_EQUAL(0, ask0.filled_qty());
+    BOOST_CHECK_EQUAL(simple::os_cancelled, ask0.state());
+    BOOST_CHECK_EQUAL(simple::os_cancelled, bid0.state());
+    BOOST_CHECK_EQUAL(simple::os_accepted, ask1.state());
+    BOOST_CHECK_EQUAL(0, order_book.bids().size());
+    BOOST_CHECK_EQUAL(1, order_book.asks().size());
+}
+
+BOOST_AUTO_TEST_CASE(TestStpDecrementAndCancel) {
+    SimpleOrderBook order_book;
+    order_book.set_self_trade_prevention(stp_decrement_and_cancel);
+    SimpleOrder ask0(false, 1250, 100, 0, 0, ALICE);
+    SimpleOrder bid0(true, 1250, 60, 0, 0, ALICE);
+    SimpleOrder bid1(true, 1250, 150, 0, 0, ALICE);
+
+    BOOST_CHECK(add_and_verify(order_book, &ask0, false));
+
+    // Smaller inbound is cancelled, resting order shrinks by its size
+    order_book.add(&bid0);
+    BOOST_CHECK_EQUAL(simple::os_cancelled, bid0.state());
+    BOOST_CHECK_EQUAL(simple::os_accepted, ask0.state());
+    BOOST_CHECK_EQUAL(40, ask0.order_qty());
+    BOOST_CHECK_EQUAL(1, order_book.asks().size());
+    BOOST_CHECK_EQUAL(40, order_book.asks().begin()->second.open_qty());
+
+    // Smaller resting order is cancelled, inbound rests with the remainder
+    order_book.add(&bid1);
+    BOOST_CHECK_EQUAL(simple::os_cancelled, ask0.state());
+    BOOST_CHECK_EQUAL(simple::os_accepted, bid1.state());
+    BOOST_CHECK_EQUAL(110, bid1.order_qty());
+    BOOST_CHECK_EQUAL(0, bid1.filled_qty());
+    BOOST_CHECK_EQUAL(0, order_book.asks().size());
+    BOOST_CHECK_EQUAL(1, order_book.bids().size());
+    BOOST_CHECK_EQUAL(110, order_book.bids().begin()->second.open_qty());
+}
+
+BOOST_AUTO_TEST_CASE(TestStpIgnoresAnonymousOrders) {
+    SimpleOrderBook order_book;
+    order_book.set_self_trade_prevention(stp_cancel_newest);
+    SimpleOrder ask0(false, 1250, 100);
+    SimpleOrder bid0(true, 1250, 100);
+
+    BOOST_CHECK(add_and_verify(order_book, &ask0, false));
+    {
+        SimpleFillCheck fc0(&bid0, 100, 1250 * 100);
+        SimpleFillCheck fc1(&ask0, 100, 1250 * 100);
+        BOOST_CHECK(add_and_verify(order_book, &bid0, true, true));
+    }
+}
+
+} // namespace liquibook
@@ -1,9 +1,11 @@
 #include "book/order_book.h"
 #include "simple/simple_order.h"
+#include "engine/risk.h"
 #include <chrono>
 #include <iostream>
 #include <memory>
 #include <random>
+#include <vector>
 
 using namespace liquibook;
 
@@ -52,7 +54,22 @@ class DummyTradeListener : public book::TradeListener<book::OrderBook<simple::Si
     }
 };
 
-int main() {
+struct BenchCase {
+    const char* name;
+    book::SelfTradePrevention stp;
+    book::OwnerId owners; // orders get owner 1..owners, or 0 when owners == 0
+    bool split;           // buyers and sellers are disjoint owners: no order can cross its own
+};
+
+constexpr size_t NUM_ORDERS = 100000;
+
+struct CaseResult {
+    double seconds;
+    size_t trades;
+    book::Quantity filled_qty;
+};
+
+static CaseResult run_once(const BenchCase& bench) {
     using OrderPtr = simple::SimpleOrderPtr;
     BenchListener listener;
     DummyTradeListener trade_listener;
@@ -60,14 +77,15 @@ int main() {
     book::OrderBook<OrderPtr> order_book("BENCH");
     order_book.set_order_listener(&listener);
     order_book.set_trade_listener(&trade_listener);
+    order_book.set_self_trade_prevention(bench.stp);
 
     // RNG setup
     std::mt19937_64 rng(42);                                // fixed seed for reproducibility
     std::uniform_int_distribution<int> side_dist(0, 1);     // buy/sell
     std::uniform_int_distribution<int> price_dist(95, 105); // price range
     std::uniform_int_distribution<int> qty_dist(1, 10);     // qty range
-
-    const size_t NUM_ORDERS = 100000;
+    std::mt19937_64 owner_rng(7); // separate stream: the order flow is identical in every case
+    std::uniform_int_distribution<book::OwnerId> owner_dist(1, bench.owners ? bench.owners : 1);
 
     auto start = std::chrono::high_resolution_clock::now();
 
@@ -75,20 +93,97 @@ int main() {
         bool is_buy = side_dist(rng);
         auto price = price_dist(rng);
         auto qty = qty_dist(rng);
+        book::OwnerId owner = bench.owners ? owner_dist(owner_rng) : 0;
+        if (bench.split) owner = owner * 2 - (is_buy ? 1 : 0);   // odd owners buy, even ones sell
 
-        auto order = std::make_shared<simple::SimpleOrder>(is_buy, price, qty);
+        auto order = std::make_shared<simple::SimpleOrder>(
+            is_buy, price, qty, 0, book::oc_no_conditions, owner);
         order_book.add(order);
     }
 
     auto end = std::chrono::high_resolution_clock::now();
-    double seconds = std::chrono::duration<double>(end - start).count();
+    return {std::chrono::duration<double>(end - start).count(), listener.trades(), listener.filled_qty()};
+}
+
+// Runs the case `repeats` times and reports the fastest run; returns its elapsed time.
+static double run_case(const BenchCase& bench, int repeats = 1) {
+    CaseResult best = run_once(bench);
+    for (int r = 1; r < repeats; ++r) {
+        const CaseResult result = run_once(bench);
+        if (result.seconds < best.seconds) best = result;
+    }
 
-    std::cout << "=== Benchmark Results ===\n";
+    std::cout << "=== Benchmark Results: " << bench.name << " ===\n";
     std::cout << "Orders processed: " << NUM_ORDERS << "\n";
-    std::cout << "Trades executed: " << listener.trades() << "\n";
-    std::cout << "Total filled qty: " << listener.filled_qty() << "\n";
-    std::cout << "Elapsed time: " << seconds << " sec\n";
-    std::cout << "Throughput: " << NUM_ORDERS / seconds << " orders/sec\n";
+    std::cout << "Trades executed: " << best.trades << "\n";
+    std::cout << "Total filled qty: " << best.filled_qty << "\n";
+    std::cout << "Elapsed time: " << best.seconds << " sec (best of " << repeats << ")\n";
+    std::cout << "Throughput: " << NUM_ORDERS / best.seconds << " orders/sec\n";
+    return best.seconds;
+}
+
+// Pre-trade check with every limit on, against a table of accounts with open orders and
+// positions, as the Sequencer runs it in front of the book.
+static void run_risk_check() {
+    engine::RiskLimits limits;
+    limits.maxOrderQty = 1000;
+    limits.maxNotional = 1000000;
+    limits.priceCollarBps = 500;
+    limits.maxOpenOrders = 1000;
+    limits.maxPosition = 100000;
+    constexpr uint32_t NUM_ACCOUNTS = 1024;
+    engine::PreTradeRisk risk(limits, NUM_ACCOUNTS);
+    risk.onTrade(100);
+    for (uint32_t owner = 1; owner < NUM_ACCOUNTS; ++owner) {
+        risk.onAccepted(owner, owner % 2 == 0, 10);
+        risk.onFill(owner, owner % 2 == 0, 5, false);
+    }
+
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> price_dist(95, 105);
+    std::uniform_int_distribution<int> qty_dist(1, 10);
+    std::uniform_int_distribution<uint32_t> owner_dist(1, NUM_ACCOUNTS - 1);
+    const size_t NUM_SAMPLES = 1 << 16;
+    std::vector<engine::NewOrder> orders;
+    orders.reserve(NUM_SAMPLES);
+    for (size_t i = 0; i < NUM_SAMPLES; ++i) {
+        orders.push_back(engine::Command::makeNew(i % 2 == 0, price_dist(rng), qty_dist(rng), 0, owner_dist(rng)).newOrder);
+    }
+
+    const size_t NUM_CHECKS = 20000000;
+    size_t rejected = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < NUM_CHECKS; ++i) {
+        rejected += risk.check(orders[i & (NUM_SAMPLES - 1)]) != nullptr;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    std::cout << "=== Benchmark Results: pre-trade risk check ===\n";
+    std::cout << "Checks: " << NUM_CHECKS << " (" << rejected << " rejected)\n";
+    std::cout << "Per check: " << seconds * 1e9 / NUM_CHECKS << " ns\n";
+}
+
+int main() {
+    // Cost of the check itself: the same flow, in which no order can meet its own
+    // owner, with STP off and on. Both arms execute the same trades.
+    const BenchCase off{"16 owners, no self-crossing, STP off", book::stp_none, 8, true};
+    const BenchCase on{"16 owners, no self-crossing, STP cancel oldest", book::stp_cancel_oldest, 8, true};
+    const double offSeconds = run_case(off, 5);
+    const double onSeconds = run_case(on, 5);
+    std::cout << "STP off: " << offSeconds * 1e9 / NUM_ORDERS << " ns/order, STP on: "
+              << onSeconds * 1e9 / NUM_ORDERS << " ns/order (" << (onSeconds / offSeconds - 1) * 100 << "%)\n";
+
+    // Self-crossing flow: the modes cancel or decrement orders, so trades differ.
+    const BenchCase cases[] = {
+        {"anonymous, STP off", book::stp_none, 0, false},
+        {"16 owners, STP cancel oldest", book::stp_cancel_oldest, 16, false},
+        {"16 owners, STP decrement and cancel", book::stp_decrement_and_cancel, 16, false},
+    };
+    for (const auto& bench : cases) {
+        run_case(bench);
+    }
+    run_risk_check();
 
     return 0;
 }
@@ -7,22 +7,22 @@
 
 
 #pragma once
-#include <string>
-#include <nlohmann/json.hpp>
+#include <iostream>
+#include "../engine/messages.h"
+#include "../engine/messages_json.h"
 
 namespace engine {
     class Broadcaster {
     public:
         virtual ~Broadcaster() = default;
-        virtual bool publish(const std::string& topic, const nlohmann::json& message) = 0;
+        virtual bool publish(const Event& event) = 0;
     };
 
     // --- Simple mock broadcaster (prints to stdout) ---
     class StdoutBroadcaster : public Broadcaster {
     public:
-        bool publish(const std::string& topic, const nlohmann::json& message) override {
-            std::cout << "[BROADCAST] topic=" << topic
-                      << " payload=" << message.dump() << "\n";
+        bool publish(const Event& event) override {
+            std::cout << "[BROADCAST] payload=" << toJson(event).dump() << "\n";
             return true; // simulate success
         }
     };
@@ -0,0 +1,327 @@
+#ifndef OME_BOOK_SNAPSHOT_H
+#define OME_BOOK_SNAPSHOT_H
+
+#include "../wal/wal_record.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace engine {
+
+    // Binary book snapshot: [header][bids][asks][accounts][crc32c:4][pad:4], host byte
+    // order. Each side is an array of fixed-size RestingOrder entries in priority order
+    // (best price first, oldest first within a level), so a reader can use the arrays in
+    // place, straight from a mapped or pinned buffer, and restore the book front to
+    // back without matching. accounts holds the net position each owner has built on
+    // this book, for the pre-trade risk stage. The CRC covers everything before it.
+    namespace book_snapshot {
+
+        inline constexpr char kMagic[4] = {'O', 'M', 'E', 'S'};
+        inline constexpr uint16_t kVersion = 1;
+
+        struct Header {
+            char magic[4];
+            uint16_t version;
+            uint16_t headerSize;     // lets later versions append fields
+            uint64_t seq;            // last inbound sequence the book reflects
+            uint64_t lastOrderId;
+            uint64_t events;         // events produced up to seq (processed mark numbering)
+            uint64_t bidCount;
+            uint64_t askCount;
+            // Snapshots of the first layout end here and read the fields below as 0.
+            uint64_t lastTradePrice;
+            uint64_t accountCount;
+        };
+        static_assert(sizeof(Header) == 64);
+        inline constexpr std::size_t kMinHeaderSize = offsetof(Header, lastTradePrice);
+
+        // Orders carry no entry time; their array position is their time priority.
+        struct RestingOrder {
+            uint64_t orderId;
+            uint64_t price;
+            uint64_t orderQty;   // as entered or last replaced; replay applies replaces against it
+            uint64_t openQty;
+            uint32_t owner;
+            uint32_t session;
+            uint32_t conditions;
+            uint32_t reserved;
+        };
+        static_assert(sizeof(RestingOrder) == 48 && alignof(RestingOrder) == 8);
+
+        // Sorted by owner; owners without a position are left out.
+        struct AccountPosition {
+            uint32_t owner;
+            uint32_t reserved;
+            int64_t position;
+        };
+        static_assert(sizeof(AccountPosition) == 16 && alignof(AccountPosition) == 8);
+
+        inline constexpr std::size_t kTrailerSize = 8;
+
+        inline std::size_t encodedSize(std::size_t bids, std::size_t asks, std::size_t accounts = 0) {
+            return sizeof(Header) + (bids + asks) * sizeof(RestingOrder) + accounts * sizeof(AccountPosition) +
+                   kTrailerSize;
+        }
+
+        // Fills header (magic, version, counts) and writes the snapshot into out.
+        inline void encode(Header header, std::span<const RestingOrder> bids, std::span<const RestingOrder> asks,
+                           std::span<const AccountPosition> accounts, std::string& out) {
+            std::memcpy(header.magic, kMagic, sizeof(kMagic));
+            header.version = kVersion;
+            header.headerSize = sizeof(Header);
+            header.bidCount = bids.size();
+            header.askCount = asks.size();
+            header.accountCount = accounts.size();
+            out.resize(encodedSize(bids.size(), asks.size(), accounts.size()));
+            char* p = out.data();
+            std::memcpy(p, &header, sizeof(header));
+            p += sizeof(header);
+            for (const auto bytes : {std::as_bytes(bids), std::as_bytes(asks), std::as_bytes(accounts)}) {
+                std::memcpy(p, bytes.data(), bytes.size());
+                p += bytes.size();
+            }
+            const uint32_t crc = wal::crc32c(0, out.data(), static_cast<std::size_t>(p - out.data()));
+            std::memset(p, 0, kTrailerSize);
+            std::memcpy(p, &crc, sizeof(crc));
+        }
+
+        struct View {
+            Header header;
+            std::span<const RestingOrder> bids;   // point into the decoded buffer
+            std::span<const RestingOrder> asks;
+            std::span<const AccountPosition> accounts;
+        };
+
+        inline bool isBinary(std::string_view in) {
+            return in.size() >= sizeof(kMagic) && std::memcmp(in.data(), kMagic, sizeof(kMagic)) == 0;
+        }
+
+        // Validates in and points view at its arrays without copying them. in must stay
+        // alive while the view is used and be 8-byte aligned (heap and mapped buffers are).
+        inline bool decode(std::string_view in, View& view) {
+            if (!isBinary(in) || in.size() < kMinHeaderSize + kTrailerSize) return false;
+            view.header = Header{};
+            std::memcpy(&view.header, in.data(), kMinHeaderSize);
+            const Header& h = view.header;
+            if (h.version != kVersion || h.headerSize < kMinHeaderSize || h.headerSize % alignof(RestingOrder)) {
+                return false;
+            }
+            if (in.size() < h.headerSize + kTrailerSize) return false;
+            std::memcpy(&view.header, in.data(), std::min<std::size_t>(h.headerSize, sizeof(Header)));
+            const uint64_t room = in.size() - h.headerSize - kTrailerSize;
+            const uint64_t maxOrders = room / sizeof(RestingOrder);
+            if (h.bidCount > maxOrders || h.askCount > maxOrders - h.bidCount ||
+                h.accountCount > room / sizeof(AccountPosition)) {
+                return false;
+            }
+            const std::size_t body = h.headerSize + (h.bidCount + h.askCount) * sizeof(RestingOrder) +
+                                     h.accountCount * sizeof(AccountPosition);
+            if (in.size() != body + kTrailerSize) return false;
+            if (reinterpret_cast<uintptr_t>(in.data()) % alignof(RestingOrder) != 0) return false;
+            uint32_t crc;
+            std::memcpy(&crc, in.data() + body, sizeof(crc));
+            if (wal::crc32c(0, in.data(), body) != crc) return false;
+
+            const auto* orders = reinterpret_cast<const RestingOrder*>(in.data() + h.headerSize);
+            view.bids = {orders, static_cast<std::size_t>(h.bidCount)};
+            view.asks = {orders + h.bidCount, static_cast<std::size_t>(h.askCount)};
+            view.accounts = {reinterpret_cast<const AccountPosition*>(orders + h.bidCount + h.askCount),
+                             static_cast<std::size_t>(h.accountCount)};
+            return true;
+        }
+
+        // Delta: [header][removed ids][updated][appended bids][appended asks][accounts]
+        // [crc32c:4][pad:4]. Holds only the orders changed since the previous snapshot of
+        // the same base: removed ones by id, ones changed in place (fills, size reductions)
+        // with their new quantities, and ones that joined the back of a level since (new
+        // or requeued), in the order they joined. accounts and lastTradePrice are carried
+        // whole and replace the base's.
+        inline constexpr char kDeltaMagic[4] = {'O', 'M', 'E', 'D'};
+
+        struct DeltaHeader {
+            char magic[4];
+            uint16_t version;
+            uint16_t headerSize;
+            uint64_t seq;
+            uint64_t lastOrderId;
+            uint64_t events;
+            uint64_t baseSeq;        // seq of the full snapshot this delta applies to
+            uint64_t removedCount;
+            uint64_t updatedCount;
+            uint64_t bidCount;       // appended
+            uint64_t askCount;
+            // Deltas of the first layout end here and read the fields below as 0.
+            uint64_t lastTradePrice;
+            uint64_t accountCount;
+        };
+        static_assert(sizeof(DeltaHeader) == 88);
+        inline constexpr std::size_t kMinDeltaHeaderSize = offsetof(DeltaHeader, lastTradePrice);
+
+        struct Delta {
+            std::span<const uint64_t> removed;
+            std::span<const RestingOrder> updated;
+            std::span<const RestingOrder> bids;
+            std::span<const RestingOrder> asks;
+            std::span<const AccountPosition> accounts;
+        };
+
+        struct DeltaView {
+            DeltaHeader header;
+            Delta delta;
+        };
+
+        inline void encodeDelta(DeltaHeader header, const Delta& delta, std::string& out) {
+            std::memcpy(header.magic, kDeltaMagic, sizeof(kDeltaMagic));
+            header.version = kVersion;
+            header.headerSize = sizeof(DeltaHeader);
+            header.removedCount = delta.removed.size();
+            header.updatedCount = delta.updated.size();
+            header.bidCount = delta.bids.size();
+            header.askCount = delta.asks.size();
+            header.accountCount = delta.accounts.size();
+            out.resize(sizeof(header) + delta.removed.size_bytes() + delta.updated.size_bytes() +
+                       delta.bids.size_bytes() + delta.asks.size_bytes() + delta.accounts.size_bytes() + kTrailerSize);
+            char* p = out.data();
+            std::memcpy(p, &header, sizeof(header));
+            p += sizeof(header);
+            for (const auto bytes : {std::as_bytes(delta.removed), std::as_bytes(delta.updated),
+                                     std::as_bytes(delta.bids), std::as_bytes(delta.asks),
+                                     std::as_bytes(delta.accounts)}) {
+                std::memcpy(p, bytes.data(), bytes.size());
+                p += bytes.size();
+            }
+            const uint32_t crc = wal::crc32c(0, out.data(), static_cast<std::size_t>(p - out.data()));
+            std::memset(p, 0, kTrailerSize);
+            std::memcpy(p, &crc, sizeof(crc));
+        }
+
+        // Same contract as decode().
+        inline bool decodeDelta(std::string_view in, DeltaView& view) {
+            if (in.size() < kMinDeltaHeaderSize + kTrailerSize ||
+                std::memcmp(in.data(), kDeltaMagic, sizeof(kDeltaMagic)) != 0) {
+                return false;
+            }
+            view.header = DeltaHeader{};
+            std::memcpy(&view.header, in.data(), kMinDeltaHeaderSize);
+            const DeltaHeader& h = view.header;
+            if (h.version != kVersion || h.headerSize < kMinDeltaHeaderSize || h.headerSize % alignof(RestingOrder)) {
+                return false;
+            }
+            if (in.size() < h.headerSize + kTrailerSize) return false;
+            std::memcpy(&view.header, in.data(), std::min<std::size_t>(h.headerSize, sizeof(DeltaHeader)));
+            const uint64_t room = in.size() - h.headerSize - kTrailerSize;
+            const uint64_t entries = room / sizeof(RestingOrder);
+            if (h.removedCount > room / sizeof(uint64_t) || h.updatedCount > entries || h.bidCount > entries ||
+                h.askCount > entries || h.accountCount > room / sizeof(AccountPosition)) {
+                return false;
+            }
+            const std::size_t body = h.headerSize + h.removedCount * sizeof(uint64_t) +
+                                     (h.updatedCount + h.bidCount + h.askCount) * sizeof(RestingOrder) +
+                                     h.accountCount * sizeof(AccountPosition);
+            if (in.size() != body + kTrailerSize) return false;
+            if (reinterpret_cast<uintptr_t>(in.data()) % alignof(RestingOrder) != 0) return false;
+            uint32_t crc;
+            std::memcpy(&crc, in.data() + body, sizeof(crc));
+            if (wal::crc32c(0, in.data(), body) != crc) return false;
+
+            const auto* removed = reinterpret_cast<const uint64_t*>(in.data() + h.headerSize);
+            const auto* orders = reinterpret_cast<const RestingOrder*>(removed + h.removedCount);
+            view.delta.removed = {removed, static_cast<std::size_t>(h.removedCount)};
+            view.delta.updated = {orders, static_cast<std::size_t>(h.updatedCount)};
+            orders += h.updatedCount;
+            view.delta.bids = {orders, static_cast<std::size_t>(h.bidCount)};
+            view.delta.asks = {orders + h.bidCount, static_cast<std::size_t>(h.askCount)};
+            view.delta.accounts = {reinterpret_cast<const AccountPosition*>(orders + h.bidCount + h.askCount),
+                                   static_cast<std::size_t>(h.accountCount)};
+            return true;
+        }
+
+        // Folds a base snapshot and its deltas, oldest first, into the book as of the last
+        // delta. Entries are copied, so the decoded buffers may go away after apply().
+        class Merged {
+        public:
+            explicit Merged(const View& base) : header(base.header), bids(base.bids.begin(), base.bids.end()),
+                                                asks(base.asks.begin(), base.asks.end()),
+                                                accounts(base.accounts.begin(), base.accounts.end()) {
+                index_.reserve(bids.size() + asks.size());
+                for (std::size_t i = 0; i < bids.size(); ++i) index_.emplace(bids[i].orderId, Slot{true, i});
+                for (std::size_t i = 0; i < asks.size(); ++i) index_.emplace(asks[i].orderId, Slot{false, i});
+            }
+
+            void apply(const DeltaView& view) {
+                const Delta& d = view.delta;
+                for (const uint64_t orderId : d.removed) remove(orderId);
+                for (const auto& entry : d.updated) {
+                    auto it = index_.find(entry.orderId);
+                    if (it != index_.end()) side(it->second.isBuy)[it->second.pos] = entry;
+                }
+                // Joined the back of its level: behind every entry already there.
+                for (const bool isBuy : {true, false}) {
+                    for (const auto& entry : isBuy ? d.bids : d.asks) {
+                        remove(entry.orderId);
+                        index_[entry.orderId] = Slot{isBuy, side(isBuy).size()};
+                        side(isBuy).push_back(entry);
+                        appended_ = true;
+                    }
+                }
+                header.seq = view.header.seq;
+                header.lastOrderId = view.header.lastOrderId;
+                header.events = view.header.events;
+                header.lastTradePrice = view.header.lastTradePrice;
+                accounts.assign(d.accounts.begin(), d.accounts.end());
+            }
+
+            // Drops removed entries and puts appended ones into price order. The sort is
+            // stable, so each level keeps its time order.
+            void finish() {
+                for (const bool isBuy : {true, false}) {
+                    auto& entries = side(isBuy);
+                    std::erase_if(entries, [](const RestingOrder& e) { return e.orderId == 0; });
+                    if (!appended_) continue;
+                    std::stable_sort(entries.begin(), entries.end(), [isBuy](const RestingOrder& a, const RestingOrder& b) {
+                        return isBuy ? a.price > b.price : a.price < b.price;
+                    });
+                }
+                header.bidCount = bids.size();
+                header.askCount = asks.size();
+                header.accountCount = accounts.size();
+                index_.clear();
+            }
+
+            Header header;
+            std::vector<RestingOrder> bids;
+            std::vector<RestingOrder> asks;
+            std::vector<AccountPosition> accounts;
+
+        private:
+            struct Slot {
+                bool isBuy;
+                std::size_t pos;
+            };
+
+            std::vector<RestingOrder>& side(bool isBuy) { return isBuy ? bids : asks; }
+
+            void remove(uint64_t orderId) {
+                auto it = index_.find(orderId);
+                if (it == index_.end()) return;
+                side(it->second.isBuy)[it->second.pos].orderId = 0;   // tombstone until finish()
+                index_.erase(it);
+            }
+
+            std::unordered_map<uint64_t, Slot> index_;
+            bool appended_{false};
+        };
+
+    } // namespace book_snapshot
+
+} // namespace engine
+
+#endif // OME_BOOK_SNAPSHOT_H
@@ -1,168 +1,771 @@
 #include "matching_engine.h"
+#include "messages_json.h"
+
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+
+bool Broadcaster::publish(const engine::Event& event) {
+    LOG_DEBUG(logger_, "[BROADCAST] msg={}", engine::toJson(event).dump());
+    return true;
+}
 
 namespace engine {
 
     using namespace liquibook;
 
-    MatchingEngine::MatchingEngine(const std::string& symbol, wal::WalManager* wal, Broadcaster* broadcaster)
-        : orderBook_(symbol), wal_(wal), broadcaster_(broadcaster) {
+    MatchingEngine::MatchingEngine(const std::string& symbol,
+                                   wal::WalManager* wal,
+                                   Broadcaster* broadcaster,
+                                   logging::AsyncLogger* logger,
+                                   uint16_t shard)
+        : orderBook_(symbol), wal_(wal), broadcaster_(broadcaster), logger_(logger), ids_(shard) {
         orderBook_.set_order_listener(this);
         orderBook_.set_trade_listener(this);
+        if (logger_) orderBook_.set_logger(logger_);
+        if (wal_) wal_->registerEngine(symbol, shard);
     }
 
-    void MatchingEngine::addOrder(bool isBuy, uint64_t price, uint64_t qty, bool fromReplay) {
-        auto order = std::make_shared<simple::SimpleOrder>(isBuy, price, qty);
+    void MatchingEngine::addOrder(bool isBuy, uint64_t price, uint64_t qty, uint32_t owner, uint32_t session,
+                                  bool fromReplay) {
+        submitNew(Command::makeNew(isBuy, price, qty, 0, owner, session).newOrder, fromReplay);
+    }
+
+    void MatchingEngine::submitNew(NewOrder req, bool fromReplay) {
+        const bool isBuy = req.isBuy;
+        // A second live order under one id would be linked into the owner and session
+        // lists twice.
+        if (req.orderId != 0 && liveOrders_.count(req.orderId)) {
+            LOG_WARN(logger_, "[ENGINE] Order id {} is already live", req.orderId);
+            if (fromReplay) {
+                publish(Event::makeReject(req.orderId, kDuplicateId));
+                settleSequenced(req);
+            } else {
+                rejectUnjournaled(req.orderId, kDuplicateId);
+            }
+            return;
+        }
+        if (!fromReplay) {
+            if (const char* reason = risk_ ? risk_->admit(req) : nullptr) {
+                LOG_WARN(logger_, "[RISK] Rejected {} qty={} @ price={}: {}",
+                         isBuy ? "BUY" : "SELL", req.qty, req.price, reason);
+                rejectUnjournaled(req.orderId, reason);
+                return;
+            }
+        }
+        // The id is fixed before the order is journaled, so replay rebuilds the same ids.
+        if (req.orderId == 0) {
+            req.orderId = ids_.next();
+        } else {
+            ids_.observe(req.orderId);
+        }
+        auto order = std::make_shared<simple::SimpleOrder>(isBuy, req.price, req.qty, 0,
+                                                           book::oc_no_conditions, req.owner, req.orderId);
 
         if (!fromReplay) {
-            nlohmann::json payload = {
-                {"id", order->order_id()},
-                {"side", isBuy ? "BUY" : "SELL"},
-                {"price", price},
-                {"qty", qty}
-            };
-            uint64_t seq = wal_->appendInbound("add", payload);
-            std::cout << "[ENGINE] Adding order " << order->order_id()
-                      << " (" << (isBuy ? "BUY" : "SELL")
-                      << " qty=" << qty << " @ price=" << price
-                      << " seq=" << seq << ")\n";
+            uint64_t seq = journal(Command::makeNew(isBuy, req.price, req.qty, req.orderId,
+                                                                req.owner, req.session));
+            LOG_DEBUG(logger_, "[ENGINE] Adding order {} ({} qty={} @ price={})",
+                      req.orderId, isBuy ? "BUY" : "SELL", req.qty, req.price);
+            LOG_DEBUG(logger_, "[ENGINE] Order {} journaled at seq={}", req.orderId, seq);
         }
+        trackOrder(order, req.owner, req.session);
+        markDirty(req.orderId, kQueued | kAdded);
         orderBook_.add(order);
+        // The account state has the order now, or the book refused it.
+        if (!fromReplay) {
+            if (risk_) risk_->settle(req.owner, isBuy, 1, req.qty);
+        } else {
+            settleSequenced(req);
+        }
+        snapshotIfDue();
+    }
+
+    void MatchingEngine::settleSequenced(const NewOrder& req) {
+        // submitBatch settles its own reservations once the whole batch is matched.
+        if (risk_ && !batching_) risk_->settle(req.owner, req.isBuy, 1, req.qty);
+    }
+
+    void MatchingEngine::removeOrder(uint64_t orderId, bool fromReplay) {
+        auto it = liveOrders_.find(orderId);
+        if (it == liveOrders_.end()) {
+            LOG_WARN(logger_, "[ENGINE] Order {} not found", orderId);
+            return;
+        }
+        if (!fromReplay) {
+            journal(Command::makeCancel(orderId));
+        }
+        // copy: the cancel callback erases the index entry
+        const OrderPtr order = it->second.order;
+        orderBook_.cancel(order);
+        snapshotIfDue();
+    }
+
+    void MatchingEngine::modifyOrder(uint64_t orderId, uint64_t newQty, uint64_t newPrice, bool fromReplay) {
+        auto it = liveOrders_.find(orderId);
+        const char* invalid = nullptr;
+        if (it == liveOrders_.end()) {
+            invalid = "unknown order";
+        } else if (const OrderPtr& live = it->second.order; newQty <= live->order_qty() - live->open_qty()) {
+            invalid = "qty at or below filled";   // would leave nothing open
+        }
+        if (invalid) {
+            LOG_WARN(logger_, "[ENGINE] Replace of order {} rejected: {}", orderId, invalid);
+            // A journaled command's reject comes back on replay, so it is numbered with the rest.
+            if (fromReplay) {
+                publish(Event::makeReject(orderId, invalid));
+            } else {
+                rejectUnjournaled(orderId, invalid);
+            }
+            return;
+        }
+        const OrderPtr order = it->second.order;
+        Reservation reserved;
+        if (!fromReplay) {
+            const Command cmd = Command::makeReplace(orderId, newQty, newPrice);
+            if (const char* reason = admit(cmd, reserved)) {
+                LOG_WARN(logger_, "[RISK] Rejected replace of order {} qty={} @ price={}: {}",
+                         orderId, newQty, newPrice, reason);
+                rejectUnjournaled(orderId, reason);
+                return;
+            }
+            journal(cmd);
+        }
+        const int64_t sizeDelta = static_cast<int64_t>(newQty) - static_cast<int64_t>(order->order_qty());
+        const book::Price price = (newPrice == order->price()) ? book::PRICE_UNCHANGED : newPrice;
+        orderBook_.replace(order, sizeDelta, price);
+        settle(reserved);
+        snapshotIfDue();
+    }
+
+    void MatchingEngine::massCancel(uint32_t owner, MassCancel::Side side, uint64_t minPrice, uint64_t maxPrice,
+                                    bool fromReplay) {
+        cancelMatching(Command::makeMassCancel(owner, side, minPrice, maxPrice).massCancel, fromReplay);
+    }
+
+    void MatchingEngine::cancelSession(uint32_t session, bool fromReplay) {
+        cancelMatching(Command::makeSessionCancel(session).massCancel, fromReplay);
     }
 
-    void MatchingEngine::removeOrder(uint32_t orderId, bool fromReplay) {
-        auto findOrder = [&](const auto& container) -> simple::SimpleOrderPtr {
-            for (const auto& entry : container) {
-                if (entry.second.ptr()->order_id() == orderId) {
-                    return entry.second.ptr();
+    void MatchingEngine::cancelMatching(const MassCancel& filter, bool fromReplay) {
+        if (!fromReplay) {
+            Command cmd;
+            cmd.type = MsgType::MassCancel;
+            cmd.massCancel = filter;
+            journal(cmd);
+        }
+        const bool bySession = filter.scope == MassCancel::Session;
+        ListHeads& heads = bySession ? sessionOrders_ : ownerOrders_;
+        Links LiveOrder::*links = bySession ? &LiveOrder::bySession : &LiveOrder::byOwner;
+        const MassCancel::Side side = filter.side;
+        auto head = heads.find(filter.id);
+        if (head == heads.end()) return;
+
+        cancelledScratch_.clear();
+        for (LiveOrder* node = head->second; node != nullptr;) {
+            // the cancel callback unlinks and frees this node
+            LiveOrder* next = (node->*links).next;
+            const OrderPtr order = node->order;
+            const bool sideMatches = side == MassCancel::AnySide ||
+                                     (side == MassCancel::BuySide) == order->is_buy();
+            if (sideMatches && order->price() >= filter.minPrice && order->price() <= filter.maxPrice) {
+                const book::Quantity open = order->open_qty();
+                orderBook_.cancel(order);
+                if (order->state() == simple::os_cancelled) {
+                    cancelledScratch_.push_back({order->is_buy(), order->price(), open});
                 }
             }
-            return nullptr;
+            node = next;
+        }
+
+        std::sort(cancelledScratch_.begin(), cancelledScratch_.end(),
+                  [](const CancelledQty& a, const CancelledQty& b) {
+                      return a.isBuy != b.isBuy ? a.isBuy : a.price < b.price;
+                  });
+        for (std::size_t i = 0; i < cancelledScratch_.size();) {
+            const auto& level = cancelledScratch_[i];
+            int64_t qty = 0;
+            int32_t orders = 0;
+            for (; i < cancelledScratch_.size() && cancelledScratch_[i].isBuy == level.isBuy &&
+                   cancelledScratch_[i].price == level.price; ++i) {
+                qty += static_cast<int64_t>(cancelledScratch_[i].qty);
+                ++orders;
+            }
+            publish(Event::makeLevelUpdate(level.isBuy, level.price, -qty, -orders));
+        }
+        LOG_DEBUG(logger_, "[ENGINE] Mass cancel {}={} removed {} orders",
+                  bySession ? "session" : "owner", filter.id, cancelledScratch_.size());
+        snapshotIfDue();
+    }
+
+    uint64_t MatchingEngine::journal(const Command& cmd) {
+        Command routed = cmd;
+        routed.route(ids_.shard());
+        appliedSeq_ = wal_->appendInbound(routed);
+        if (replicaFeed_) {
+            routed.seq = appliedSeq_;
+            replicaFeed_->push(routed);
+        }
+        return appliedSeq_;
+    }
+
+    void MatchingEngine::apply(const Command& cmd) {
+        currentSeq_ = cmd.seq;
+        if (cmd.seq) {
+            appliedSeq_ = cmd.seq;
+            if (replicaFeed_) replicaFeed_->push(cmd);
+        }
+        dispatch(cmd, cmd.seq != 0);
+        currentSeq_ = 0;
+    }
+
+    void MatchingEngine::dispatch(const Command& cmd, bool fromReplay) {
+        switch (cmd.type) {
+            case MsgType::NewOrder:
+                submitNew(cmd.newOrder, fromReplay);
+                break;
+            case MsgType::Cancel:
+                removeOrder(cmd.cancel.orderId, fromReplay);
+                break;
+            case MsgType::Replace:
+                modifyOrder(cmd.replace.orderId, cmd.replace.newQty, cmd.replace.newPrice, fromReplay);
+                break;
+            case MsgType::MassCancel:
+                cancelMatching(cmd.massCancel, fromReplay);
+                break;
+            default:
+                LOG_WARN(logger_, "[ENGINE] Unsupported command type {}", static_cast<uint8_t>(cmd.type));
+                break;
+        }
+    }
+
+    void MatchingEngine::trackOrder(const OrderPtr& order, uint32_t owner, uint32_t session) {
+        LiveOrder& node = liveOrders_[order->order_id()];
+        node.order = order;
+        node.owner = owner;
+        node.session = session;
+        node.queuedAt = ++queueClock_;
+        link(ownerOrders_, owner, node, &LiveOrder::byOwner);
+        link(sessionOrders_, session, node, &LiveOrder::bySession);
+    }
+
+    void MatchingEngine::untrackOrder(uint64_t orderId) {
+        auto it = liveOrders_.find(orderId);
+        if (it == liveOrders_.end()) return;
+        LiveOrder& node = it->second;
+        unlink(ownerOrders_, node.owner, node, &LiveOrder::byOwner);
+        unlink(sessionOrders_, node.session, node, &LiveOrder::bySession);
+        liveOrders_.erase(it);
+    }
+
+    void MatchingEngine::link(ListHeads& heads, uint32_t key, LiveOrder& node, Links LiveOrder::*links) {
+        LiveOrder*& head = heads[key];
+        node.*links = {nullptr, head};
+        if (head) (head->*links).prev = &node;
+        head = &node;
+    }
+
+    void MatchingEngine::unlink(ListHeads& heads, uint32_t key, LiveOrder& node, Links LiveOrder::*links) {
+        const Links& l = node.*links;
+        if (l.next) (l.next->*links).prev = l.prev;
+        if (l.prev) {
+            (l.prev->*links).next = l.next;
+        } else if (l.next) {
+            heads[key] = l.next;
+        } else {
+            heads.erase(key);
+        }
+    }
+
+    void MatchingEngine::submitBatch(std::span<const Command> commands) {
+        if (commands.empty()) return;
+        batching_ = true;
+        outboundBatch_.clear();
+        batch_.clear();
+        batchIds_.clear();
+        batchReserved_.clear();
+        for (const auto& cmd : commands) {
+            // Each admitted command is reserved, so later ones in the batch are checked
+            // against it although none has reached the book yet.
+            Reservation reserved;
+            const char* reason = nullptr;
+            if (cmd.type == MsgType::NewOrder && cmd.newOrder.orderId != 0 &&
+                (liveOrders_.count(cmd.newOrder.orderId) || !batchIds_.insert(cmd.newOrder.orderId).second)) {
+                reason = kDuplicateId;
+            } else {
+                reason = admit(cmd, reserved);
+            }
+            if (reason) {
+                rejectUnjournaled(cmd.type == MsgType::Replace ? cmd.replace.orderId : cmd.newOrder.orderId, reason);
+                continue;
+            }
+            if (reserved.orders || reserved.qty) batchReserved_.push_back(reserved);
+            batch_.push_back(cmd);
+        }
+        if (!batch_.empty()) {
+            uint64_t seq = wal_->reserveSequences(batch_.size());
+            for (auto& cmd : batch_) {
+                cmd.seq = seq++;
+                cmd.route(ids_.shard());
+                if (cmd.type == MsgType::NewOrder && cmd.newOrder.orderId == 0) {
+                    cmd.newOrder.orderId = ids_.next();
+                }
+            }
+            wal_->appendInboundBatch(batch_);
+        }
+
+        for (const auto& cmd : batch_) {
+            apply(cmd);
+        }
+        for (const auto& reserved : batchReserved_) settle(reserved);
+        batching_ = false;
+        // Queued behind any events still held back and released with them; when nothing
+        // waits and the watermark covers the batch, it goes out under one mark.
+        pendingOutbound_.insert(pendingOutbound_.end(), outboundBatch_.begin(), outboundBatch_.end());
+        releaseDurable();
+        snapshotIfDue();
+    }
+
+    const char* MatchingEngine::admit(const Command& cmd, Reservation& reserved) {
+        reserved = {};
+        if (!risk_) return nullptr;
+        if (cmd.type == MsgType::NewOrder) {
+            const NewOrder& req = cmd.newOrder;
+            const char* reason = risk_->admit(req);
+            if (!reason) reserved = {req.owner, req.isBuy != 0, 1, req.qty};
+            return reason;
+        }
+        if (cmd.type != MsgType::Replace) return nullptr;
+        auto it = liveOrders_.find(cmd.replace.orderId);
+        if (it == liveOrders_.end()) return nullptr;   // modifyOrder rejects it
+        const OrderPtr& order = it->second.order;
+        const uint32_t owner = static_cast<uint32_t>(order->owner());
+        const int64_t sizeDelta = static_cast<int64_t>(cmd.replace.newQty) - static_cast<int64_t>(order->order_qty());
+        const bool priceChanged = cmd.replace.newPrice && cmd.replace.newPrice != order->price();
+        const char* reason = risk_->admitReplace(owner, order->is_buy(),
+                                                 priceChanged ? cmd.replace.newPrice : order->price(),
+                                                 cmd.replace.newQty, sizeDelta, priceChanged);
+        if (!reason && sizeDelta > 0) reserved = {owner, order->is_buy(), 0, static_cast<uint64_t>(sizeDelta)};
+        return reason;
+    }
+
+    void MatchingEngine::publish(Event event) {
+        // Events are numbered in the order they are produced; replay produces the same
+        // ones again, and those up to the persisted mark went out before the restart.
+        if (++eventCount_ <= deliveredMark_ || shadow_) return;
+        event.seq = currentSeq_;
+        if (batching_) {
+            outboundBatch_.push_back(event);
+            return;
+        }
+        // Events go out in order: behind any still held back, and only once durable.
+        if (!pendingOutbound_.empty() ||
+            (durableSeq_ && currentSeq_ != 0 && currentSeq_ > durableSeq_->load(std::memory_order_acquire))) {
+            pendingOutbound_.push_back(event);
+            return;
+        }
+        if (!deliver({&event, 1})) pendingOutbound_.push_back(event);
+    }
+
+    // Rejects of commands that never reached the journal: replay cannot produce them
+    // again, so they go out directly and stay outside the processed mark's numbering.
+    void MatchingEngine::rejectUnjournaled(uint64_t orderId, const char* reason) {
+        if (!broadcaster_->publish(Event::makeReject(orderId, reason))) {
+            LOG_WARN(logger_, "[ENGINE] Broadcaster refused reject for order {}", orderId);
+        }
+    }
+
+    void MatchingEngine::releaseDurable() {
+        saveHeldSnapshot();
+        if (pendingOutbound_.empty()) return;
+        const uint64_t durable = durableSeq_ ? durableSeq_->load(std::memory_order_acquire) : UINT64_MAX;
+        outboundBatch_.clear();
+        for (const auto& event : pendingOutbound_) {
+            if (event.seq > durable) break;
+            outboundBatch_.push_back(event);
+        }
+        // Refused events stay at the front and are offered again on the next call.
+        pendingOutbound_.erase(pendingOutbound_.begin(), pendingOutbound_.begin() + deliver(outboundBatch_));
+        snapshotIfDue();
+    }
+
+    std::size_t MatchingEngine::deliver(std::span<const Event> events) {
+        std::size_t delivered = 0;
+        for (const auto& event : events) {
+            if (!broadcaster_->publish(event)) {
+                if (!outboundRefused_) {
+                    LOG_WARN(logger_, "[ENGINE] Broadcaster refused event for seq {}; holding it and later ones",
+                             event.seq);
+                }
+                outboundRefused_ = true;
+                break;
+            }
+            outboundRefused_ = false;
+            ++delivered;
+        }
+        if (!delivered) return 0;
+
+        // One mark per delivery advances the processed watermark over what went out.
+        const uint64_t before = processedCount_.load(std::memory_order_relaxed);
+        const uint64_t processed = before + delivered;
+        wal_->markProcessed(ids_.shard(), processed, events[delivered - 1]);
+        processedCount_.store(processed, std::memory_order_release);
+        saveHeldSnapshot();
+
+        // Events go out while the book is still matching; the snapshot waits for the
+        // command to finish so it matches the sequence it is keyed by.
+        if (processed / 1000 != before / 1000) snapshotDue_ = true;
+        return delivered;
+    }
+
+    void MatchingEngine::takeSnapshot() {
+        if (replicaFeed_) {
+            replicaFeed_->push(Command());   // MsgType::None marks the cut
+            return;
+        }
+        writeSnapshot();
+    }
+
+    book_snapshot::RestingOrder MatchingEngine::restingEntry(const OrderPtr& order, uint32_t session) {
+        return {order->order_id(), order->price(), order->order_qty(), order->open_qty(),
+                static_cast<uint32_t>(order->owner()), session, static_cast<uint32_t>(order->conditions()), 0};
+    }
+
+    void MatchingEngine::encodeSnapshot(std::string& out) {
+        auto collect = [this](const auto& side, std::vector<book_snapshot::RestingOrder>& entries) {
+            entries.clear();
+            entries.reserve(side.size());
+            for (const auto& entry : side) {
+                const OrderPtr& order = entry.second.ptr();
+                auto live = liveOrders_.find(order->order_id());
+                entries.push_back(restingEntry(order, live != liveOrders_.end() ? live->second.session : 0));
+            }
         };
+        collect(orderBook_.bids(), snapshotBids_);
+        collect(orderBook_.asks(), snapshotAsks_);
 
-        auto order = findOrder(orderBook_.bids());
-        if (!order) order = findOrder(orderBook_.asks());
+        collectAccounts();
 
-        if (order) {
-            if (!fromReplay) {
-                nlohmann::json payload = {{"id", orderId}};
-                uint64_t seq = wal_->appendInbound("cancel", payload);
+        book_snapshot::Header header{};
+        header.seq = appliedSeq_;
+        header.lastOrderId = ids_.last();
+        header.events = eventCount_;
+        header.lastTradePrice = lastTradePrice_;
+        book_snapshot::encode(header, snapshotBids_, snapshotAsks_, snapshotAccounts_, out);
+    }
+
+    void MatchingEngine::collectAccounts() {
+        snapshotAccounts_.clear();
+        for (const auto& [owner, position] : positions_) {
+            if (position) snapshotAccounts_.push_back({owner, 0, position});
+        }
+        std::sort(snapshotAccounts_.begin(), snapshotAccounts_.end(),
+                  [](const auto& a, const auto& b) { return a.owner < b.owner; });
+    }
+
+    void MatchingEngine::encodeDelta(std::string& out) {
+        deltaRemoved_.clear();
+        deltaUpdated_.clear();
+        deltaQueued_.clear();
+        for (const auto& [orderId, flags] : dirty_) {
+            auto live = liveOrders_.find(orderId);
+            if (live == liveOrders_.end()) {
+                if (!(flags & kAdded)) deltaRemoved_.push_back(orderId);
+                continue;
+            }
+            const LiveOrder& node = live->second;
+            if (flags & kQueued) {
+                deltaQueued_.push_back({node.queuedAt, node.order->is_buy(), restingEntry(node.order, node.session)});
+            } else {
+                deltaUpdated_.push_back(restingEntry(node.order, node.session));
             }
-            orderBook_.cancel(order);
+        }
+        // Orders that joined a level since the last snapshot go behind the others, in the order they joined.
+        std::sort(deltaQueued_.begin(), deltaQueued_.end(),
+                  [](const QueuedEntry& a, const QueuedEntry& b) { return a.queuedAt < b.queuedAt; });
+        snapshotBids_.clear();
+        snapshotAsks_.clear();
+        for (const auto& queued : deltaQueued_) {
+            (queued.isBuy ? snapshotBids_ : snapshotAsks_).push_back(queued.entry);
+        }
+
+        book_snapshot::DeltaHeader header{};
+        header.seq = appliedSeq_;
+        header.lastOrderId = ids_.last();
+        header.events = eventCount_;
+        header.baseSeq = baseSeq_;
+        header.lastTradePrice = lastTradePrice_;
+        collectAccounts();
+        book_snapshot::encodeDelta(header, {deltaRemoved_, deltaUpdated_, snapshotBids_, snapshotAsks_, snapshotAccounts_},
+                                   out);
+    }
+
+    void MatchingEngine::writeSnapshot() {
+        if (heldSnapshot_) return;   // the next one is taken once this is saved
+        std::optional<PendingSnapshot> snapshot = encodeNextSnapshot();
+        if (!snapshot) return;
+        // Otherwise held until releaseDurable() or deliver() finds it ready.
+        if (snapshotReady(*snapshot)) {
+            saveSnapshot(*snapshot);
         } else {
-            std::cout << "[ENGINE] Order " << orderId << " not found\n";
+            heldSnapshot_ = std::move(snapshot);
         }
     }
 
-    void MatchingEngine::takeSnapshot() {
-        nlohmann::json snapshot;
-        snapshot["bids"] = nlohmann::json::array();
-        snapshot["asks"] = nlohmann::json::array();
+    void MatchingEngine::saveHeldSnapshot() {
+        if (heldSnapshot_ && snapshotReady(*heldSnapshot_)) {
+            saveSnapshot(*heldSnapshot_);
+            heldSnapshot_.reset();
+        }
+    }
+
+    std::optional<MatchingEngine::PendingSnapshot> MatchingEngine::encodeNextSnapshot() {
+        // Keyed by the last inbound sequence the book reflects; recovery replays from the next one.
+        const bool full = !deltasPerBase_ || !baseWritten_ || deltasSinceBase_ >= deltasPerBase_ ||
+                          dirty_.size() > liveOrders_.size() / 2;
+        std::optional<PendingSnapshot> snapshot;
+        if (full) {
+            snapshot.emplace();
+            encodeSnapshot(snapshot->bytes);
+            baseWritten_ = true;
+            baseSeq_ = appliedSeq_;
+            deltasSinceBase_ = 0;
+        } else if (appliedSeq_ != snapshotSeq_) {
+            snapshot.emplace();
+            encodeDelta(snapshot->bytes);
+            ++deltasSinceBase_;
+        }
+        if (snapshot) {
+            snapshot->seq = appliedSeq_;
+            snapshot->events = eventCount_;
+            snapshot->full = full;
+            snapshot->changed = dirty_.size();
+        }
+        snapshotSeq_ = appliedSeq_;
+        dirty_.clear();
+        return snapshot;
+    }
+
+    void MatchingEngine::saveSnapshot(const PendingSnapshot& snapshot) {
+        if (snapshot.full) {
+            wal_->saveSnapshot(orderBook_.symbol(), snapshot.bytes, snapshot.seq);
+            LOG_INFO(logger_, "[SNAPSHOT] Saved at seq={}", snapshot.seq);
+        } else {
+            wal_->saveSnapshotDelta(orderBook_.symbol(), snapshot.bytes, snapshot.seq);
+            LOG_INFO(logger_, "[SNAPSHOT] Saved delta at seq={} ({} orders changed)", snapshot.seq, snapshot.changed);
+        }
+    }
+
+    void MatchingEngine::restoreSnapshot(std::string_view saved) {
+        book_snapshot::View view;
+        if (!book_snapshot::decode(saved, view)) {
+            throw std::runtime_error("Corrupt snapshot for " + orderBook_.symbol());
+        }
+        restoreBook(view.header, view.bids, view.asks, view.accounts);
+    }
 
-        for (const auto& entry : orderBook_.bids()) {
-            snapshot["bids"].push_back({
-                {"orderId", entry.second.ptr()->order_id()},
-                {"price", entry.second.ptr()->price()},
-                {"qty", entry.second.ptr()->order_qty()}
-            });
+    uint64_t MatchingEngine::restoreSnapshotChain(std::string_view saved, uint64_t baseSeq) {
+        book_snapshot::View base;
+        if (!book_snapshot::decode(saved, base)) {
+            throw std::runtime_error("Corrupt snapshot for " + orderBook_.symbol());
         }
-        for (const auto& entry : orderBook_.asks()) {
-            snapshot["asks"].push_back({
-                {"orderId", entry.second.ptr()->order_id()},
-                {"price", entry.second.ptr()->price()},
-                {"qty", entry.second.ptr()->order_qty()}
-            });
+        std::optional<book_snapshot::Merged> merged;
+        std::string buffer;   // an aligned copy for decodeDelta
+        wal_->loadSnapshotDeltas(orderBook_.symbol(), baseSeq, [&](uint64_t seq, std::string_view delta) {
+            buffer.assign(delta);
+            book_snapshot::DeltaView view;
+            if (!book_snapshot::decodeDelta(buffer, view) || view.header.baseSeq != baseSeq) {
+                throw std::runtime_error("Corrupt snapshot delta for " + orderBook_.symbol() + " at seq " +
+                                         std::to_string(seq));
+            }
+            if (!merged) merged.emplace(base);
+            merged->apply(view);
+            return true;
+        });
+        if (!merged) {
+            restoreBook(base.header, base.bids, base.asks, base.accounts);
+            return baseSeq;
+        }
+        merged->finish();
+        restoreBook(merged->header, merged->bids, merged->asks, merged->accounts);
+        return merged->header.seq;
+    }
+
+    void MatchingEngine::restoreBook(const book_snapshot::Header& header,
+                                     std::span<const book_snapshot::RestingOrder> bids,
+                                     std::span<const book_snapshot::RestingOrder> asks,
+                                     std::span<const book_snapshot::AccountPosition> accounts) {
+        appliedSeq_ = header.seq;
+        ids_.observe(header.lastOrderId);
+        eventCount_ = header.events;
+        liveOrders_.reserve(bids.size() + asks.size());
+        orderBook_.reserve(bids.size() + asks.size());
+
+        // Entries are in priority order, so each one rests behind the previous without matching.
+        auto load = [this](std::span<const book_snapshot::RestingOrder> side, bool isBuy) {
+            for (const auto& entry : side) {
+                auto order = std::make_shared<simple::SimpleOrder>(isBuy, entry.price, entry.orderQty, 0,
+                                                                   entry.conditions, entry.owner, entry.orderId);
+                order->accept();
+                order->fill(entry.orderQty - entry.openQty, 0, 0);
+                ids_.observe(entry.orderId);
+                trackOrder(order, entry.owner, entry.session);
+                orderBook_.restore(order, entry.openQty, entry.conditions);
+                if (risk_) risk_->onAccepted(entry.owner, isBuy, entry.openQty);
+            }
+        };
+        load(bids, true);
+        load(asks, false);
+
+        lastTradePrice_ = header.lastTradePrice;
+        positions_.clear();
+        for (const auto& account : accounts) positions_[account.owner] = account.position;
+        if (risk_) {
+            if (lastTradePrice_) risk_->onTrade(lastTradePrice_);
+            for (const auto& account : accounts) risk_->restorePosition(account.owner, account.position);
         }
+    }
 
-        wal_->saveSnapshot(orderBook_.symbol(), snapshot, processedCount_);
-        std::cout << "[SNAPSHOT] Saved at seq=" << processedCount_ << "\n";
+    void MatchingEngine::restoreLegacySnapshot(std::string_view text) {
+        const nlohmann::json saved = nlohmann::json::parse(text);
+        ids_.observe(saved.value("lastOrderId", uint64_t{0}));
+        // Snapshots without an event count predate the mark: republish what replay produces.
+        eventCount_ = saved.value("events", deliveredMark_);
+        for (const char* side : {"bids", "asks"}) {
+            const bool isBuy = side[0] == 'b';
+            for (const auto& entry : saved[side]) {
+                const uint64_t orderId = entry["orderId"];
+                ids_.observe(orderId);
+                auto order = std::make_shared<simple::SimpleOrder>(isBuy, entry["price"], entry["qty"], 0,
+                                                                   book::oc_no_conditions, 0, orderId);
+                trackOrder(order, 0, 0);
+                orderBook_.add(order);
+            }
+        }
     }
 
     // --- Listeners ---
-    void MatchingEngine::on_accept(const simple::SimpleOrderPtr& order) {}
+    void MatchingEngine::on_accept(const simple::SimpleOrderPtr& order) {
+        order->accept();
+        if (risk_) risk_->onAccepted(order->owner(), order->is_buy(), order->open_qty());
+    }
 
-    void MatchingEngine::on_reject(const simple::SimpleOrderPtr& order, const char* reason) {}
+    void MatchingEngine::on_reject(const simple::SimpleOrderPtr& order, const char* reason) {
+        untrackOrder(order->order_id());
+        LOG_WARN(logger_, "[LISTENER] Order {} rejected reason={}", order->order_id(), reason);
+        publish(Event::makeReject(order->order_id(), reason));
+    }
 
     void MatchingEngine::on_fill(const simple::SimpleOrderPtr& order,
                                  const simple::SimpleOrderPtr& matched_order,
                                  book::Quantity qty,
                                  book::Price price) {
-        const nlohmann::json trade = {
-            {"orderId", order->order_id()},
-            {"matchedId", matched_order->order_id()},
-            {"qty", qty},
-            {"price", price}
-        };
-
-        if (broadcaster_->publish("trades", trade)) {
-            processedCount_++;
-            wal_->markProcessed(processedCount_, trade);
-
-            if (processedCount_ % 1000 == 0) {
-                takeSnapshot();
+        const book::Cost cost = qty * price;
+        order->fill(qty, cost, 0);
+        matched_order->fill(qty, cost, 0);
+        markDirty(order->order_id(), 0);
+        markDirty(matched_order->order_id(), 0);
+        if (!order->open_qty()) untrackOrder(order->order_id());
+        if (!matched_order->open_qty()) untrackOrder(matched_order->order_id());
+        for (const auto* side : {&order, &matched_order}) {
+            const simple::SimpleOrderPtr& filled = *side;
+            if (filled->owner()) {
+                const int64_t signedQty = static_cast<int64_t>(qty);
+                positions_[static_cast<uint32_t>(filled->owner())] += filled->is_buy() ? signedQty : -signedQty;
             }
+            if (risk_) risk_->onFill(filled->owner(), filled->is_buy(), qty, !filled->open_qty());
         }
+
+        publish(Event::makeFill(order->order_id(), matched_order->order_id(), qty, price));
     }
 
     void MatchingEngine::on_cancel(const simple::SimpleOrderPtr& order) {
-        std::cout << "[LISTENER] Order " << order->order_id() << " canceled\n";
+        order->cancel();
+        markDirty(order->order_id(), 0);
+        untrackOrder(order->order_id());
+        if (risk_) risk_->onClosed(order->owner(), order->is_buy(), order->open_qty());
+        LOG_DEBUG(logger_, "[LISTENER] Order {} canceled", order->order_id());
+        publish(Event::makeAck(order->order_id(), Ack::Cancelled, order->open_qty(), order->price()));
     }
 
     void MatchingEngine::on_cancel_reject(const simple::SimpleOrderPtr& order, const char* reason) {
-        std::cout << "[LISTENER] Cancel reject for " << order->order_id()
-                  << " reason=" << reason << "\n";
+        LOG_WARN(logger_, "[LISTENER] Cancel reject for {} reason={}", order->order_id(), reason);
     }
 
     void MatchingEngine::on_replace(const simple::SimpleOrderPtr& order,
                                     const int64_t& size_delta,
                                     book::Price new_price) {
-        std::cout << "[LISTENER] Order " << order->order_id()
-                  << " replaced size_delta=" << size_delta
-                  << " new_price=" << new_price << "\n";
+        // Only a size reduction at the same price keeps the order's place (OrderBook::replace).
+        if (new_price != order->price() || size_delta > 0 || order->all_or_none()) {
+            auto live = liveOrders_.find(order->order_id());
+            if (live != liveOrders_.end()) live->second.queuedAt = ++queueClock_;
+            markDirty(order->order_id(), kQueued);
+        } else {
+            markDirty(order->order_id(), 0);
+        }
+        order->replace(size_delta, new_price);
+        if (risk_) risk_->onReplaced(order->owner(), order->is_buy(), size_delta);
+        LOG_DEBUG(logger_, "[LISTENER] Order {} replaced size_delta={} new_price={}",
+                  order->order_id(), size_delta, new_price);
     }
 
     void MatchingEngine::on_replace_reject(const simple::SimpleOrderPtr& order, const char* reason) {
-        std::cout << "[LISTENER] Replace rejected for " << order->order_id()
-                  << " reason=" << reason << "\n";
+        LOG_WARN(logger_, "[LISTENER] Replace rejected for {} reason={}", order->order_id(), reason);
+        publish(Event::makeReject(order->order_id(), reason));
     }
 
     void MatchingEngine::on_trade(const book::OrderBook<simple::SimpleOrderPtr>* book,
                                   book::Quantity qty,
                                   book::Price price) {
-        std::cout << "[TRADE] Executed qty=" << qty
-                  << " @ " << price
-                  << " on " << book->symbol() << "\n";
+        lastTradePrice_ = price;
+        if (risk_) risk_->onTrade(price);
+        LOG_DEBUG(logger_, "[TRADE] Executed qty={} @ {} on {}", qty, price, book->symbol());
     }
 
     void MatchingEngine::recover() {
-        uint64_t lastSnapshotSeq = 0;
-        auto snapshot = wal_->loadSnapshot(orderBook_.symbol(), lastSnapshotSeq);
+        // Every record is applied to rebuild the book; publish() drops the events the
+        // processed mark says were already delivered.
+        wal_->replayInbound(recoverSnapshot() + 1, [&](const wal::WalRecord& rec) {
+            replay(rec.cmd);
+            return true;
+        });
+        LOG_INFO(logger_, "[RECOVERY] Replay complete, last order id {}", ids_.last());
+    }
 
-        if (!snapshot->empty()) {
-            std::cout << "[RECOVERY] Restored snapshot seq=" << lastSnapshotSeq << "\n";
-            for (const auto& bid : snapshot.value()["bids"]) {
-                auto order = std::make_shared<simple::SimpleOrder>(true, bid["price"], bid["qty"]);
-                orderBook_.add(order);
-            }
-            for (const auto& ask : snapshot.value()["asks"]) {
-                auto order = std::make_shared<simple::SimpleOrder>(false, ask["price"], ask["qty"]);
-                orderBook_.add(order);
-            }
-        } else {
-            std::cout << "[RECOVERY] No snapshot, starting fresh\n";
+    bool MatchingEngine::owns(const Command& cmd) const {
+        if (const auto shard = commandShard(cmd)) return *shard == ids_.shard();
+        if (unrouted_ == Unrouted::Unowned) {
+            throw std::runtime_error("replay: journal record " + std::to_string(cmd.seq) +
+                                     " carries no shard, and no shard-0 engine shares the WAL to replay it");
         }
+        return unrouted_ == Unrouted::Own;
+    }
 
-        auto entries = wal_->replayInbound(lastSnapshotSeq + 1);
-        for (auto& rec : entries) {
-            if (wal_->isProcessed(rec.id)) continue;
+    uint64_t MatchingEngine::recoverSnapshot() {
+        const auto shards = wal_->registeredShards();
+        if (shards.size() == 1 || ids_.shard() == 0) {
+            unrouted_ = Unrouted::Own;
+        } else {
+            unrouted_ = shards.front() == 0 ? Unrouted::Skip : Unrouted::Unowned;
+        }
+        deliveredMark_ = wal_->processedMark(ids_.shard());
+        processedCount_.store(deliveredMark_, std::memory_order_relaxed);
+        uint64_t lastSnapshotSeq = 0;
+        auto snapshot = wal_->loadSnapshot(orderBook_.symbol(), lastSnapshotSeq);
 
-            if (rec.type == "add") {
-                bool isBuy = (rec.payload["side"] == "BUY");
-                addOrder(isBuy, rec.payload["price"], rec.payload["qty"], true);
-            } else if (rec.type == "cancel") {
-                removeOrder(rec.payload["id"], true);
+        if (snapshot) {
+            appliedSeq_ = lastSnapshotSeq;
+            if (book_snapshot::isBinary(*snapshot)) {
+                lastSnapshotSeq = restoreSnapshotChain(*snapshot, lastSnapshotSeq);
+            } else {
+                restoreLegacySnapshot(*snapshot);
             }
+            LOG_INFO(logger_, "[RECOVERY] Restored snapshot seq={}", lastSnapshotSeq);
+        } else {
+            LOG_INFO(logger_, "[RECOVERY] No snapshot, starting fresh");
         }
-        std::cout << "[RECOVERY] Replay complete\n";
+        return lastSnapshotSeq;
     }
 
 } // namespace engine
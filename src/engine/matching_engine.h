@@ -3,22 +3,44 @@
 
 #include <book/order_book.h>
 #include <simple/simple_order.h>
-#include <nlohmann/json.hpp>
+#include "../log/async_logger.h"
 #include "../wal/wal_manager.h"
+#include "book_snapshot.h"
+#include "messages.h"
+#include "order_id.h"
+#include "risk.h"
+#include "spsc_ring.h"
+#include <atomic>
+#include <deque>
 #include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <iostream>
 
 // Minimal Broadcaster stub
 class Broadcaster {
 public:
-    bool publish(const std::string& topic, const nlohmann::json& msg) {
-        std::cout << "[BROADCAST] topic=" << topic << " msg=" << msg.dump() << "\n";
-        return true;
-    }
+    explicit Broadcaster(logging::AsyncLogger* logger = nullptr) : logger_(logger) {}
+
+    virtual ~Broadcaster() = default;
+
+    // False if the event could not be sent; the engine offers it again later.
+    virtual bool publish(const engine::Event& event);
+
+private:
+    logging::AsyncLogger* logger_;
 };
 
 namespace engine {
+
+    // Sequenced commands and snapshot markers handed from the matching thread to a SnapshotReplica.
+    using ReplicaFeed = SpscRing<Command, 1 << 15>;
+
     class MatchingEngine final
         : public liquibook::book::OrderListener<liquibook::simple::SimpleOrderPtr>,
           public liquibook::book::TradeListener<liquibook::book::OrderBook<liquibook::simple::SimpleOrderPtr>> {
@@ -26,14 +48,90 @@ namespace engine {
     public:
         MatchingEngine() = delete;
         MatchingEngine(const MatchingEngine&) = delete;
-        explicit MatchingEngine(const std::string& symbol, wal::WalManager* wal, Broadcaster* broadcaster);
+        explicit MatchingEngine(const std::string& symbol,
+                                wal::WalManager* wal,
+                                Broadcaster* broadcaster,
+                                logging::AsyncLogger* logger = nullptr,
+                                uint16_t shard = 0);
         virtual ~MatchingEngine() = default;
 
-        void addOrder(bool isBuy, uint64_t price, uint64_t qty, bool fromReplay = false);
-        void removeOrder(uint32_t orderId, bool fromReplay = false);
+        void addOrder(bool isBuy, uint64_t price, uint64_t qty, uint32_t owner = 0, uint32_t session = 0,
+                      bool fromReplay = false);
+        void removeOrder(uint64_t orderId, bool fromReplay = false);
+        // Amends a live order with one journal record. newQty is the new total order
+        // quantity; newPrice of 0 keeps the current price. A quantity reduction at the
+        // same price keeps time priority, anything else requeues the order. An unknown order
+        // or a quantity at or below what has already filled is rejected before journaling.
+        void modifyOrder(uint64_t orderId, uint64_t newQty, uint64_t newPrice, bool fromReplay = false);
+        // Cancels every live order of owner on the given side(s) priced within
+        // [minPrice, maxPrice] under one journal record. Walks only that owner's orders;
+        // publishes a cancel ack per order, then one LevelUpdate per affected level.
+        void massCancel(uint32_t owner, MassCancel::Side side, uint64_t minPrice, uint64_t maxPrice,
+                        bool fromReplay = false);
+        // Cancel-on-disconnect: pulls every live order entered through session in one
+        // pass over that session's list, with one journal record.
+        void cancelSession(uint32_t session, bool fromReplay = false);
+
+        // Applies a command coming off a shard ring. Commands carrying a sequence number
+        // were already journaled by the Sequencer and are matched without touching the WAL.
+        // A NewOrder whose caller-supplied id is already live is rejected: before journaling
+        // when the engine journals it (here or in submitBatch), otherwise with a Reject
+        // event that replay produces again.
+        void apply(const Command& cmd);
 
+        // Gateway burst path: journals every command with one WAL write, matches them in
+        // order and publishes the resulting events together, behind any still held back.
+        // Any seq on the input is ignored; the batch takes the WAL's next sequences (the
+        // counter a Sequencer draws from too) and is durable before it is matched.
+        void submitBatch(std::span<const Command> commands);
+
+        // Pre-trade risk stage for commands this engine journals itself (addOrder and
+        // modifyOrder from a gateway, submitBatch): new orders, and replaces that grow an
+        // order or move its price. Rejected commands never reach the WAL or the book.
+        // Sequenced commands are checked by the Sequencer instead. The engine settles what
+        // either admitted once the book has the order, keeps the account table up to date,
+        // and rebuilds its share of it in recover(), so set it before recovering.
+        void setRiskCheck(PreTradeRisk* risk) { risk_ = risk; }
+
+        // Self-trade prevention between orders of the same non-zero owner; off by default.
+        void setSelfTradePrevention(liquibook::book::SelfTradePrevention mode) {
+            orderBook_.set_self_trade_prevention(mode);
+        }
+
+        // Pipelined mode: outbound effects of sequence N are held back until the journal
+        // watermark reaches N. Pass nullptr to publish immediately (the default).
+        void setDurableWatermark(const std::atomic<uint64_t>* durableSeq) { durableSeq_ = durableSeq; }
+        void releaseDurable();
+
+        // Order ids of this engine's shard. After recover() it continues where the journal
+        // left off; a Sequencer in front of the engine issues from it too.
+        OrderIdAllocator& orderIds() { return ids_; }
+        const OrderIdAllocator& orderIds() const { return ids_; }
+
+        // Snapshots the book at the last applied sequence. With a SnapshotReplica attached
+        // this only queues a marker behind the commands applied so far; the replica writes
+        // the book as of that cut on its own thread.
         void takeSnapshot();
+        // Restores the newest snapshot, then replays the journal after it. Engines sharing
+        // a journal must have distinct shards; each replays only its own commands (owns()).
         void recover();
+        // recover() in two steps, for recoverEngines(): recoverSnapshot() restores the newest
+        // snapshot and returns the sequence it reflects (0 without one); replay() is then
+        // handed every journaled command after it, in order.
+        uint64_t recoverSnapshot();
+        void replay(const Command& cmd) {
+            if (owns(cmd)) apply(cmd);
+        }
+        // Whether replay applies cmd: it was journaled by this engine's shard. Records from
+        // before commands carried their shard belong to the only engine registered with the
+        // WAL, else to its shard-0 engine; with neither, replaying one throws. Valid after
+        // recoverSnapshot().
+        bool owns(const Command& cmd) const;
+        wal::WalManager* wal() const { return wal_; }
+        // Snapshots between two full ones are deltas holding only the orders changed since
+        // the previous snapshot. Every deltasPerBase-th one is full again, as is one whose
+        // delta would cover most of the book. 0 writes only full snapshots.
+        void setSnapshotDeltas(uint32_t deltasPerBase) { deltasPerBase_ = deltasPerBase; }
 
         // --- Listener methods ---
         void on_accept(const liquibook::simple::SimpleOrderPtr& order) override;
@@ -53,14 +151,174 @@ namespace engine {
                       liquibook::book::Price price) override;
 
     private:
+        friend class SnapshotReplica;
+
         typedef liquibook::book::OrderBook<liquibook::simple::SimpleOrderPtr> OrderBookT;
         typedef liquibook::simple::SimpleOrderPtr OrderPtr;
 
+        struct LiveOrder;
+        struct Links {
+            LiveOrder* prev{nullptr};
+            LiveOrder* next{nullptr};
+        };
+        typedef std::unordered_map<uint32_t, LiveOrder*> ListHeads;
+
+        // Live order plus its links in the owner's and the session's intrusive lists.
+        // Nodes live in liveOrders_, whose elements never move, so the links stay valid.
+        struct LiveOrder {
+            OrderPtr order;
+            uint32_t owner{0};
+            uint32_t session{0};
+            uint64_t queuedAt{0};   // when it last joined the back of its level
+            Links byOwner;
+            Links bySession;
+        };
+
+        struct CancelledQty {
+            bool isBuy;
+            uint64_t price;
+            uint64_t qty;
+        };
+
+        static constexpr const char* kDuplicateId = "duplicate order id";
+
+        void dispatch(const Command& cmd, bool fromReplay);
+        uint64_t journal(const Command& cmd);
+        void submitNew(NewOrder order, bool fromReplay);
+        // What the risk stage reserved for an admitted command, until settle().
+        struct Reservation {
+            uint32_t owner{0};
+            bool isBuy{false};
+            uint32_t orders{0};
+            uint64_t qty{0};
+        };
+        // Risk stage for a NewOrder or a Replace of a live order; other commands pass.
+        const char* admit(const Command& cmd, Reservation& reserved);
+        void settle(const Reservation& reserved) {
+            if (risk_ && (reserved.orders || reserved.qty)) {
+                risk_->settle(reserved.owner, reserved.isBuy, reserved.orders, reserved.qty);
+            }
+        }
+        // A NewOrder applied with its sequence: the Sequencer admitted it, or recovery
+        // replays it and nothing is reserved.
+        void settleSequenced(const NewOrder& req);
+        void cancelMatching(const MassCancel& filter, bool fromReplay);
+        void trackOrder(const OrderPtr& order, uint32_t owner, uint32_t session);
+        void untrackOrder(uint64_t orderId);
+        static void link(ListHeads& heads, uint32_t key, LiveOrder& node, Links LiveOrder::*links);
+        static void unlink(ListHeads& heads, uint32_t key, LiveOrder& node, Links LiveOrder::*links);
+
+        // Dirty flags: joined the back of its level, did not exist at the previous snapshot.
+        static constexpr uint8_t kQueued = 1;
+        static constexpr uint8_t kAdded = 2;
+        void markDirty(uint64_t orderId, uint8_t flags) {
+            if (deltasPerBase_ && !replicaFeed_) dirty_[orderId] |= flags;
+        }
+        static book_snapshot::RestingOrder restingEntry(const OrderPtr& order, uint32_t session);
+        void encodeSnapshot(std::string& out);
+        void encodeDelta(std::string& out);
+        // An encoded snapshot, full or delta, and the event count it reflects.
+        struct PendingSnapshot {
+            std::string bytes;
+            uint64_t seq{0};
+            uint64_t events{0};
+            bool full{false};
+            std::size_t changed{0};   // deltas: orders changed since the previous snapshot
+        };
+        void writeSnapshot();
+        // Encodes the next snapshot at appliedSeq_; nothing if a delta would be empty.
+        std::optional<PendingSnapshot> encodeNextSnapshot();
+        void saveSnapshot(const PendingSnapshot& snapshot);
+        // Recovery replays the journal after the snapshot's seq and republishes only the
+        // events after its count: the records it covers must be durable and its events
+        // delivered before it is saved. Safe to call from a replica's thread.
+        bool snapshotReady(const PendingSnapshot& snapshot) const {
+            return processedCount_.load(std::memory_order_acquire) >= snapshot.events &&
+                   (!durableSeq_ || durableSeq_->load(std::memory_order_acquire) >= snapshot.seq);
+        }
+        void saveHeldSnapshot();
+        void snapshotIfDue() {
+            if (snapshotDue_) {
+                snapshotDue_ = false;
+                takeSnapshot();
+            }
+        }
+        void restoreSnapshot(std::string_view saved);
+        // Restores the full snapshot at baseSeq plus the deltas taken after it; returns
+        // the sequence the restored book reflects.
+        uint64_t restoreSnapshotChain(std::string_view saved, uint64_t baseSeq);
+        void restoreBook(const book_snapshot::Header& header, std::span<const book_snapshot::RestingOrder> bids,
+                         std::span<const book_snapshot::RestingOrder> asks,
+                         std::span<const book_snapshot::AccountPosition> accounts);
+        void collectAccounts();   // positions_ into snapshotAccounts_, by owner
+        void restoreLegacySnapshot(std::string_view saved);   // JSON snapshots from older builds
+
+        void publish(Event event);
+        void rejectUnjournaled(uint64_t orderId, const char* reason);
+        // Sends events in order up to the first one the broadcaster refuses and advances
+        // the processed mark over them; returns how many went out.
+        std::size_t deliver(std::span<const Event> events);
+
         OrderBookT orderBook_;
+        std::unordered_map<uint64_t, LiveOrder> liveOrders_;
+        // Net position each owner has built on this book and the last trade price, kept
+        // for snapshots so recovery can rebuild the risk stage's account table.
+        std::unordered_map<uint32_t, int64_t> positions_;
+        uint64_t lastTradePrice_{0};
+        ListHeads ownerOrders_;     // owner -> list head
+        ListHeads sessionOrders_;   // session -> list head
+        std::vector<CancelledQty> cancelledScratch_;
+        std::vector<book_snapshot::RestingOrder> snapshotBids_;   // takeSnapshot scratch
+        std::vector<book_snapshot::RestingOrder> snapshotAsks_;
+        std::vector<book_snapshot::AccountPosition> snapshotAccounts_;
+        struct QueuedEntry {
+            uint64_t queuedAt;
+            bool isBuy;
+            book_snapshot::RestingOrder entry;
+        };
+        std::vector<uint64_t> deltaRemoved_;   // encodeDelta scratch
+        std::vector<book_snapshot::RestingOrder> deltaUpdated_;
+        std::vector<QueuedEntry> deltaQueued_;
+
+        // Delta snapshots: orders changed since the previous snapshot, and the full one
+        // they build on. A delta is only written on a full snapshot this engine wrote
+        // and has tracked changes since.
+        std::unordered_map<uint64_t, uint8_t> dirty_;
+        uint32_t deltasPerBase_{7};
+        uint32_t deltasSinceBase_{0};
+        bool baseWritten_{false};
+        uint64_t baseSeq_{0};
+        uint64_t snapshotSeq_{0};   // seq of the last snapshot written, full or delta
+        uint64_t queueClock_{0};
+        bool snapshotDue_{false};   // set by deliver(), taken between commands
         wal::WalManager* wal_;
         Broadcaster* broadcaster_;
+        logging::AsyncLogger* logger_;
+        PreTradeRisk* risk_{nullptr};
+        OrderIdAllocator ids_;
+
+        std::atomic<uint64_t> processedCount_{0};   // events delivered, persisted as the processed mark
+        uint64_t eventCount_{0};       // events produced, including those replay suppresses
+        uint64_t deliveredMark_{0};    // processed mark found by recover()
+        uint64_t appliedSeq_{0};   // last inbound sequence applied to the book
+        enum class Unrouted : uint8_t { Skip, Own, Unowned };
+        Unrouted unrouted_{Unrouted::Own};   // who replays unstamped records, set by recoverSnapshot()
+
+        ReplicaFeed* replicaFeed_{nullptr};   // set while a SnapshotReplica is attached
+        bool shadow_{false};                  // this engine is a replica: events are counted, not sent
+
+        const std::atomic<uint64_t>* durableSeq_{nullptr};
+        uint64_t currentSeq_{0};
+        std::deque<Event> pendingOutbound_;   // not yet durable, or behind a refused event
+        bool outboundRefused_{false};
+        std::optional<PendingSnapshot> heldSnapshot_;   // waits until snapshotReady()
 
-        uint64_t processedCount_{0};
+        // submitBatch: events are collected here and delivered once the batch is matched
+        bool batching_{false};
+        std::vector<Command> batch_;
+        std::unordered_set<uint64_t> batchIds_;   // caller-supplied order ids in batch_
+        std::vector<Reservation> batchReserved_;
+        std::vector<Event> outboundBatch_;
     };
 }
 
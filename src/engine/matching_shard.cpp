@@ -0,0 +1,69 @@
+#include "matching_shard.h"
+
+#include <stdexcept>
+
+namespace engine {
+
+    MatchingShard::MatchingShard(MatchingEngine* engine, const ShardConfig& config)
+        : engine_(engine), config_(config) {
+        if (config_.producers == 0) {
+            throw std::invalid_argument("MatchingShard needs at least one producer ring");
+        }
+        rings_.reserve(config_.producers);
+        for (std::size_t i = 0; i < config_.producers; ++i) {
+            rings_.push_back(std::make_unique<Ring>());
+        }
+    }
+
+    MatchingShard::~MatchingShard() {
+        stop();
+    }
+
+    void MatchingShard::start() {
+        if (running_.exchange(true)) return;
+        thread_ = std::thread([this] { run(); });
+    }
+
+    void MatchingShard::stop() {
+        running_.store(false, std::memory_order_release);
+        if (thread_.joinable()) thread_.join();
+    }
+
+    void MatchingShard::run() {
+        uint32_t idlePasses = 0;
+        while (running_.load(std::memory_order_acquire)) {
+            if (pollOnce() > 0) {
+                idlePasses = 0;
+            } else {
+                idle(idlePasses);
+            }
+        }
+        // Producers have been told to stop; apply whatever they managed to enqueue.
+        while (pollOnce() > 0) {
+        }
+        engine_->releaseDurable();
+    }
+
+    std::size_t MatchingShard::pollOnce() {
+        std::size_t total = 0;
+        for (auto& ring : rings_) {
+            total += ring->consume([this](const Command& cmd) { engine_->apply(cmd); },
+                                   config_.batchSize);
+        }
+        if (total > 0) processed_.fetch_add(total, std::memory_order_relaxed);
+        engine_->releaseDurable();
+        return total;
+    }
+
+    void MatchingShard::idle(uint32_t& idlePasses) {
+        ++idlePasses;
+        if (config_.idle == IdleStrategy::BusySpin || idlePasses < config_.spinsBeforeYield) {
+            cpuRelax();
+        } else if (idlePasses < config_.spinsBeforeYield + config_.yieldsBeforePark) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(config_.parkInterval);
+        }
+    }
+
+} // namespace engine
@@ -0,0 +1,65 @@
+#ifndef OME_MATCHING_SHARD_H
+#define OME_MATCHING_SHARD_H
+
+#include "matching_engine.h"
+#include "messages.h"
+#include "spsc_ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace engine {
+
+    enum class IdleStrategy {
+        BusySpin, // never leave the core; lowest handoff latency
+        Backoff   // spin, then yield, then park for parkInterval when idle for long
+    };
+
+    struct ShardConfig {
+        std::size_t producers{1};     // one ring per gateway thread
+        std::size_t batchSize{64};    // max commands drained from a ring per pass
+        IdleStrategy idle{IdleStrategy::BusySpin};
+        uint32_t spinsBeforeYield{1000};
+        uint32_t yieldsBeforePark{100};
+        std::chrono::microseconds parkInterval{50};
+    };
+
+    // Owns the matching thread for one engine. Gateways push commands into their own
+    // SPSC ring; the shard thread is the only caller of the engine once started.
+    class MatchingShard {
+    public:
+        static constexpr std::size_t kRingCapacity = 1 << 14;
+        using Ring = SpscRing<Command, kRingCapacity>;
+
+        MatchingShard(MatchingEngine* engine, const ShardConfig& config = ShardConfig());
+        MatchingShard(const MatchingShard&) = delete;
+        ~MatchingShard();
+
+        // Ring reserved for gateway thread `producer`; only that thread may push into it.
+        Ring& ingress(std::size_t producer) { return *rings_[producer]; }
+
+        void start();
+        // Drains every ring, then joins the shard thread.
+        void stop();
+
+        uint64_t processed() const { return processed_.load(std::memory_order_relaxed); }
+
+    private:
+        void run();
+        std::size_t pollOnce();
+        void idle(uint32_t& idlePasses);
+
+        MatchingEngine* engine_;
+        ShardConfig config_;
+        std::vector<std::unique_ptr<Ring>> rings_;
+        std::thread thread_;
+        std::atomic<bool> running_{false};
+        std::atomic<uint64_t> processed_{0};
+    };
+
+} // namespace engine
+
+#endif // OME_MATCHING_SHARD_H
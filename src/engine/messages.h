@@ -0,0 +1,297 @@
+#ifndef OME_MESSAGES_H
+#define OME_MESSAGES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace engine {
+
+    // Fixed-layout wire/journal messages. Every struct is trivially copyable with
+    // explicit padding, so the codec below is a type byte followed by a memcpy.
+    enum class MsgType : uint8_t {
+        None = 0,
+        // inbound commands
+        NewOrder = 1,
+        Cancel = 2,
+        Replace = 3,
+        MassCancel = 4,
+        // outbound events
+        Fill = 16,
+        Ack = 17,
+        Reject = 18,
+        LevelUpdate = 19
+    };
+
+    // Journaled commands carry the shard of the engine that journaled them (routed = 1),
+    // so replay of a shared journal can hand each record back to that engine. Records
+    // from before the stamp read routed = 0.
+
+    struct NewOrder {
+        uint64_t orderId;
+        uint64_t price;
+        uint64_t qty;
+        uint8_t isBuy;
+        uint8_t routed;
+        uint16_t shard;
+        uint32_t owner;    // 0 when the gateway does not tag orders
+        uint32_t session;  // gateway session that entered the order, 0 if none
+        uint8_t pad2[4];
+    };
+
+    struct Cancel {
+        uint64_t orderId;
+        uint8_t routed;
+        uint8_t pad;
+        uint16_t shard;
+        uint8_t pad2[4];
+    };
+
+    struct Replace {
+        uint64_t orderId;
+        uint64_t newQty;
+        uint64_t newPrice;
+        uint8_t routed;
+        uint8_t pad;
+        uint16_t shard;
+        uint8_t pad2[4];
+    };
+
+    // Cancels every live order of one owner or session on the selected side(s) whose
+    // price lies in [minPrice, maxPrice].
+    struct MassCancel {
+        enum Side : uint8_t { AnySide, BuySide, SellSide };
+        enum Scope : uint8_t { Owner, Session };
+
+        uint32_t id;       // owner or session id, per scope
+        Side side;
+        Scope scope;
+        uint16_t shard;    // shard of the engine it was sent to, valid when routed
+        uint64_t minPrice;
+        uint64_t maxPrice;
+        uint8_t routed;
+        uint8_t pad[7];
+    };
+
+    struct Fill {
+        uint64_t orderId;
+        uint64_t matchedId;
+        uint64_t qty;
+        uint64_t price;
+    };
+
+    struct Ack {
+        enum Kind : uint8_t { Accepted, Cancelled, Replaced };
+
+        uint64_t orderId;
+        uint64_t openQty;
+        uint64_t price;
+        Kind kind;
+        uint8_t pad[7];
+    };
+
+    struct Reject {
+        uint64_t orderId;
+        char reason[32];   // NUL-padded, truncated
+    };
+
+    // Aggregated change of one price level, e.g. all orders a mass cancel took out of it.
+    struct LevelUpdate {
+        uint64_t price;
+        int64_t qtyDelta;
+        int32_t orderDelta;
+        uint8_t isBuy;
+        uint8_t pad[3];
+    };
+
+    // Inbound command as carried on the shard and journal rings.
+    struct Command {
+        MsgType type{MsgType::None};
+        uint64_t seq{0};   // assigned by the Sequencer; 0 means the engine journals it inline
+        union {
+            NewOrder newOrder;
+            Cancel cancel;
+            Replace replace;
+            MassCancel massCancel;
+        };
+
+        Command() : newOrder{} {}
+
+        static Command makeNew(bool isBuy, uint64_t price, uint64_t qty, uint64_t orderId = 0,
+                               uint32_t owner = 0, uint32_t session = 0) {
+            Command c;
+            c.type = MsgType::NewOrder;
+            c.newOrder.orderId = orderId;
+            c.newOrder.price = price;
+            c.newOrder.qty = qty;
+            c.newOrder.isBuy = isBuy ? 1 : 0;
+            c.newOrder.owner = owner;
+            c.newOrder.session = session;
+            return c;
+        }
+
+        static Command makeCancel(uint64_t orderId) {
+            Command c;
+            c.type = MsgType::Cancel;
+            c.cancel.orderId = orderId;
+            return c;
+        }
+
+        static Command makeReplace(uint64_t orderId, uint64_t newQty, uint64_t newPrice) {
+            Command c;
+            c.type = MsgType::Replace;
+            c.replace = {orderId, newQty, newPrice};
+            return c;
+        }
+
+        static Command makeMassCancel(uint32_t owner, MassCancel::Side side = MassCancel::AnySide,
+                                      uint64_t minPrice = 0, uint64_t maxPrice = UINT64_MAX) {
+            Command c;
+            c.type = MsgType::MassCancel;
+            c.massCancel.id = owner;
+            c.massCancel.side = side;
+            c.massCancel.scope = MassCancel::Owner;
+            c.massCancel.minPrice = minPrice;
+            c.massCancel.maxPrice = maxPrice;
+            return c;
+        }
+
+        // Cancel-on-disconnect: every live order entered through the session.
+        static Command makeSessionCancel(uint32_t session) {
+            Command c = makeMassCancel(session);
+            c.massCancel.scope = MassCancel::Session;
+            return c;
+        }
+
+        // Stamps the shard of the engine journaling this command.
+        void route(uint16_t shard) {
+            switch (type) {
+                case MsgType::NewOrder:   newOrder.routed = 1;   newOrder.shard = shard;   break;
+                case MsgType::Cancel:     cancel.routed = 1;     cancel.shard = shard;     break;
+                case MsgType::Replace:    replace.routed = 1;    replace.shard = shard;    break;
+                case MsgType::MassCancel: massCancel.routed = 1; massCancel.shard = shard; break;
+                default: break;
+            }
+        }
+    };
+
+    // Outbound event handed to the broadcaster and the outbound journal.
+    struct Event {
+        MsgType type{MsgType::None};
+        uint64_t seq{0};   // inbound sequence that caused it, 0 if none
+        union {
+            Fill fill;
+            Ack ack;
+            Reject reject;
+            LevelUpdate levelUpdate;
+        };
+
+        Event() : reject{} {}
+
+        static Event makeFill(uint64_t orderId, uint64_t matchedId, uint64_t qty, uint64_t price) {
+            Event e;
+            e.type = MsgType::Fill;
+            e.fill = {orderId, matchedId, qty, price};
+            return e;
+        }
+
+        static Event makeAck(uint64_t orderId, Ack::Kind kind, uint64_t openQty, uint64_t price) {
+            Event e;
+            e.type = MsgType::Ack;
+            e.ack.orderId = orderId;
+            e.ack.openQty = openQty;
+            e.ack.price = price;
+            e.ack.kind = kind;
+            return e;
+        }
+
+        static Event makeReject(uint64_t orderId, const char* reason) {
+            Event e;
+            e.type = MsgType::Reject;
+            e.reject.orderId = orderId;
+            std::strncpy(e.reject.reason, reason, sizeof(e.reject.reason) - 1);
+            return e;
+        }
+
+        static Event makeLevelUpdate(bool isBuy, uint64_t price, int64_t qtyDelta, int32_t orderDelta) {
+            Event e;
+            e.type = MsgType::LevelUpdate;
+            e.levelUpdate.price = price;
+            e.levelUpdate.qtyDelta = qtyDelta;
+            e.levelUpdate.orderDelta = orderDelta;
+            e.levelUpdate.isBuy = isBuy ? 1 : 0;
+            return e;
+        }
+    };
+
+    static_assert(std::is_trivially_copyable_v<Command>, "Command must be memcpy-able");
+    static_assert(std::is_trivially_copyable_v<Event>, "Event must be memcpy-able");
+    static_assert(sizeof(NewOrder) == 40 && sizeof(Cancel) == 16 && sizeof(Replace) == 32);
+    static_assert(sizeof(MassCancel) == 32);
+    static_assert(sizeof(Fill) == 32 && sizeof(Ack) == 32 && sizeof(Reject) == 40);
+    static_assert(sizeof(LevelUpdate) == 24);
+
+    inline std::size_t payloadSize(MsgType type) {
+        switch (type) {
+            case MsgType::NewOrder:    return sizeof(NewOrder);
+            case MsgType::Cancel:      return sizeof(Cancel);
+            case MsgType::Replace:     return sizeof(Replace);
+            case MsgType::MassCancel:  return sizeof(MassCancel);
+            case MsgType::Fill:        return sizeof(Fill);
+            case MsgType::Ack:         return sizeof(Ack);
+            case MsgType::Reject:      return sizeof(Reject);
+            case MsgType::LevelUpdate: return sizeof(LevelUpdate);
+            default:                   return 0;
+        }
+    }
+
+    // Older journals hold shorter payloads for some types; the missing trailing fields read as 0.
+    inline std::size_t minPayloadSize(MsgType type) {
+        switch (type) {
+            case MsgType::NewOrder:   return offsetof(NewOrder, session);
+            case MsgType::Cancel:     return offsetof(Cancel, routed);
+            case MsgType::Replace:    return offsetof(Replace, routed);
+            case MsgType::MassCancel: return offsetof(MassCancel, routed);
+            default:                  return payloadSize(type);
+        }
+    }
+
+    inline bool isCommand(MsgType type) {
+        return type == MsgType::NewOrder || type == MsgType::Cancel || type == MsgType::Replace ||
+               type == MsgType::MassCancel;
+    }
+
+    // --- Codec: [type:1][payload] in host byte order ---
+
+    inline const void* payloadOf(const Command& c) { return &c.newOrder; }
+    inline void* payloadOf(Command& c) { return &c.newOrder; }
+    inline const void* payloadOf(const Event& e) { return &e.fill; }
+    inline void* payloadOf(Event& e) { return &e.fill; }
+
+    template <typename Msg>
+    void encode(const Msg& msg, std::string& out) {
+        const std::size_t n = payloadSize(msg.type);
+        out.resize(1 + n);
+        out[0] = static_cast<char>(msg.type);
+        std::memcpy(out.data() + 1, payloadOf(msg), n);
+    }
+
+    template <typename Msg>
+    bool decode(std::string_view in, Msg& msg) {
+        if (in.empty()) return false;
+        const auto type = static_cast<MsgType>(static_cast<uint8_t>(in[0]));
+        const std::size_t n = payloadSize(type);
+        if (n == 0 || in.size() > 1 + n || in.size() < 1 + minPayloadSize(type)) return false;
+        if (std::is_same_v<Msg, Command> != isCommand(type)) return false;
+        msg.type = type;
+        std::memset(payloadOf(msg), 0, n);
+        std::memcpy(payloadOf(msg), in.data() + 1, in.size() - 1);
+        return true;
+    }
+
+} // namespace engine
+
+#endif // OME_MESSAGES_H
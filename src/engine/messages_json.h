@@ -0,0 +1,74 @@
+#ifndef OME_MESSAGES_JSON_H
+#define OME_MESSAGES_JSON_H
+
+#include "messages.h"
+#include <nlohmann/json.hpp>
+
+// JSON rendering of the binary messages, and decoding of the JSON records older
+// builds journaled. Only cold paths include it: debug logging and legacy snapshot
+// restore in matching_engine.cpp, legacy replay in wal_manager.cpp and the stdout
+// broadcaster. Engine and WAL headers must not, so the hot path does not pull in JSON.
+namespace engine {
+
+    inline nlohmann::json toJson(const Command& c) {
+        switch (c.type) {
+            case MsgType::NewOrder:
+                return {{"type", "add"}, {"seq", c.seq}, {"id", c.newOrder.orderId},
+                        {"side", c.newOrder.isBuy ? "BUY" : "SELL"},
+                        {"price", c.newOrder.price}, {"qty", c.newOrder.qty},
+                        {"owner", c.newOrder.owner}, {"session", c.newOrder.session}};
+            case MsgType::Cancel:
+                return {{"type", "cancel"}, {"seq", c.seq}, {"id", c.cancel.orderId}};
+            case MsgType::Replace:
+                return {{"type", "replace"}, {"seq", c.seq}, {"id", c.replace.orderId},
+                        {"qty", c.replace.newQty}, {"price", c.replace.newPrice}};
+            case MsgType::MassCancel:
+                return {{"type", "mass_cancel"}, {"seq", c.seq},
+                        {c.massCancel.scope == MassCancel::Session ? "session" : "owner", c.massCancel.id},
+                        {"side", static_cast<int>(c.massCancel.side)},
+                        {"minPrice", c.massCancel.minPrice}, {"maxPrice", c.massCancel.maxPrice}};
+            default:
+                return {{"type", "unknown"}, {"seq", c.seq}};
+        }
+    }
+
+    inline nlohmann::json toJson(const Event& e) {
+        switch (e.type) {
+            case MsgType::Fill:
+                return {{"type", "fill"}, {"seq", e.seq}, {"orderId", e.fill.orderId},
+                        {"matchedId", e.fill.matchedId}, {"qty", e.fill.qty}, {"price", e.fill.price}};
+            case MsgType::Ack:
+                return {{"type", "ack"}, {"seq", e.seq}, {"orderId", e.ack.orderId},
+                        {"kind", static_cast<int>(e.ack.kind)},
+                        {"openQty", e.ack.openQty}, {"price", e.ack.price}};
+            case MsgType::Reject:
+                return {{"type", "reject"}, {"seq", e.seq}, {"orderId", e.reject.orderId},
+                        {"reason", std::string(e.reject.reason, strnlen(e.reject.reason, sizeof(e.reject.reason)))}};
+            case MsgType::LevelUpdate:
+                return {{"type", "level"}, {"seq", e.seq}, {"side", e.levelUpdate.isBuy ? "BUY" : "SELL"},
+                        {"price", e.levelUpdate.price}, {"qtyDelta", e.levelUpdate.qtyDelta},
+                        {"orderDelta", e.levelUpdate.orderDelta}};
+            default:
+                return {{"type", "unknown"}, {"seq", e.seq}};
+        }
+    }
+
+    // Reads the {"id","type","payload"} records written before the binary format.
+    inline bool commandFromLegacyJson(const nlohmann::json& record, Command& out) {
+        const std::string type = record.value("type", "");
+        const auto& payload = record["payload"];
+        if (type == "add") {
+            out = Command::makeNew(payload["side"] == "BUY", payload["price"], payload["qty"],
+                                   payload.value("id", uint64_t{0}));
+        } else if (type == "cancel") {
+            out = Command::makeCancel(payload["id"]);
+        } else {
+            return false;
+        }
+        out.seq = record["id"];
+        return true;
+    }
+
+} // namespace engine
+
+#endif // OME_MESSAGES_JSON_H
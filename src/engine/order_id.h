@@ -0,0 +1,78 @@
+#ifndef OME_ORDER_ID_H
+#define OME_ORDER_ID_H
+
+#include "messages.h"
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+
+namespace engine {
+
+    // Per-shard order id allocator: [shard:16][sequence:48]. Each shard owns one
+    // allocator, so shards never share a counter, and the shard of any id can be read
+    // back from it. The last issued id is persisted with snapshots and every journaled
+    // NewOrder carries its id, so replay reproduces the same ids.
+    //
+    // The engine's allocator is the shard's only one: a Sequencer in front of it issues
+    // from the same instance, so next() and observe() are safe to call concurrently.
+    class OrderIdAllocator {
+    public:
+        static constexpr unsigned kSequenceBits = 48;
+        static constexpr uint64_t kSequenceMask = (uint64_t{1} << kSequenceBits) - 1;
+
+        explicit OrderIdAllocator(uint16_t shard = 0) : shard_(shard) {}
+        OrderIdAllocator(const OrderIdAllocator&) = delete;
+
+        uint64_t next() { return compose(shard_, last_.fetch_add(1, std::memory_order_relaxed) + 1); }
+
+        // Last id issued, or the shard's base id if none yet.
+        uint64_t last() const { return compose(shard_, last_.load(std::memory_order_relaxed)); }
+        uint16_t shard() const { return shard_; }
+
+        // Moves past an id issued earlier (journal, snapshot). Ids of other shards are ignored.
+        void observe(uint64_t id) {
+            if (shardOf(id) != shard_) return;
+            uint64_t last = last_.load(std::memory_order_relaxed);
+            while (sequenceOf(id) > last &&
+                   !last_.compare_exchange_weak(last, sequenceOf(id), std::memory_order_relaxed)) {
+            }
+        }
+
+        static uint64_t compose(uint16_t shard, uint64_t sequence) {
+            return (static_cast<uint64_t>(shard) << kSequenceBits) | (sequence & kSequenceMask);
+        }
+        static uint16_t shardOf(uint64_t id) { return static_cast<uint16_t>(id >> kSequenceBits); }
+        static uint64_t sequenceOf(uint64_t id) { return id & kSequenceMask; }
+
+    private:
+        const uint16_t shard_;
+        std::atomic<uint64_t> last_{0};
+    };
+
+    // Shard of the engine that journaled cmd (Command::route), which lets the shards
+    // sharing a journal each replay only their own. Order ids are not used: a client may
+    // supply any id. Empty for records journaled before commands carried their shard.
+    inline std::optional<uint16_t> commandShard(const Command& cmd) {
+        switch (cmd.type) {
+            case MsgType::NewOrder:
+                if (cmd.newOrder.routed) return cmd.newOrder.shard;
+                break;
+            case MsgType::Cancel:
+                if (cmd.cancel.routed) return cmd.cancel.shard;
+                break;
+            case MsgType::Replace:
+                if (cmd.replace.routed) return cmd.replace.shard;
+                break;
+            case MsgType::MassCancel:
+                if (cmd.massCancel.routed) return cmd.massCancel.shard;
+                break;
+            default:
+                break;
+        }
+        return std::nullopt;
+    }
+
+} // namespace engine
+
+#endif // OME_ORDER_ID_H
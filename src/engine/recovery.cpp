@@ -0,0 +1,162 @@
+#include "recovery.h"
+#include "spsc_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace engine {
+
+    namespace {
+
+        // Runs task(i) for every i in [0, n) on up to `threads` threads, rethrowing the
+        // first exception once all of them are done.
+        template <typename Task>
+        void parallelFor(std::size_t n, std::size_t threads, const Task& task) {
+            std::atomic<std::size_t> next{0};
+            std::exception_ptr error;
+            std::mutex errorMu;
+            auto work = [&] {
+                for (std::size_t i; (i = next.fetch_add(1)) < n;) {
+                    try {
+                        task(i);
+                    } catch (...) {
+                        std::lock_guard lock(errorMu);
+                        if (!error) error = std::current_exception();
+                        next = n;
+                    }
+                }
+            };
+            std::vector<std::thread> pool;
+            for (std::size_t t = 1; t < std::min(threads, n); ++t) pool.emplace_back(work);
+            work();
+            for (auto& thread : pool) thread.join();
+            if (error) std::rethrow_exception(error);
+        }
+
+        struct Routed {
+            MatchingEngine* engine;
+            Command cmd;
+        };
+        using ReplayRing = SpscRing<Routed, 1 << 13>;
+
+        struct Target {
+            MatchingEngine* engine;
+            std::size_t worker;
+            uint64_t after;   // snapshot seq; the engine replays what follows it
+        };
+
+        // One pass over the journal of wal for the engines in group, whose snapshots are
+        // already restored.
+        void replayShared(wal::WalManager* wal, std::span<const Target> group, std::size_t workers) {
+            std::unordered_map<uint16_t, const Target*> byShard;
+            uint64_t from = UINT64_MAX;
+            for (const auto& target : group) {
+                if (!byShard.emplace(target.engine->orderIds().shard(), &target).second) {
+                    throw std::invalid_argument("recoverEngines: engines sharing a WAL need distinct shards");
+                }
+                from = std::min(from, target.after + 1);
+            }
+
+            std::vector<std::unique_ptr<ReplayRing>> rings;
+            for (std::size_t w = 0; w < workers; ++w) rings.push_back(std::make_unique<ReplayRing>());
+            std::atomic<bool> readDone{false};
+            std::atomic<bool> failed{false};
+            std::exception_ptr error;
+            std::mutex errorMu;
+            auto fail = [&] {
+                std::lock_guard lock(errorMu);
+                if (!error) error = std::current_exception();
+                failed = true;
+            };
+
+            std::vector<std::thread> pool;
+            for (std::size_t w = 0; w < workers; ++w) {
+                pool.emplace_back([&, w] {
+                    ReplayRing& ring = *rings[w];
+                    try {
+                        for (;;) {
+                            const bool done = readDone.load(std::memory_order_acquire);
+                            if (ring.consume([](const Routed& r) { r.engine->replay(r.cmd); }) == 0) {
+                                if (done || failed.load(std::memory_order_relaxed)) return;
+                                std::this_thread::yield();
+                            }
+                        }
+                    } catch (...) {
+                        fail();
+                    }
+                });
+            }
+
+            try {
+                wal->replayInbound(from, [&](const wal::WalRecord& rec) {
+                    const Target* target = nullptr;
+                    if (const auto shard = commandShard(rec.cmd)) {
+                        auto it = byShard.find(*shard);
+                        if (it != byShard.end()) target = it->second;
+                    } else {
+                        // Journaled before commands carried their shard: the engine that owns() it.
+                        for (const auto& t : group) {
+                            if (t.engine->owns(rec.cmd)) {
+                                target = &t;
+                                break;
+                            }
+                        }
+                    }
+                    if (!target || rec.cmd.seq <= target->after) return true;
+                    ReplayRing& ring = *rings[target->worker];
+                    while (!ring.tryPush({target->engine, rec.cmd})) {
+                        if (failed.load(std::memory_order_relaxed)) return false;
+                        std::this_thread::yield();
+                    }
+                    return true;
+                });
+            } catch (...) {
+                fail();
+            }
+            readDone.store(true, std::memory_order_release);
+            for (auto& thread : pool) thread.join();
+            if (error) std::rethrow_exception(error);
+        }
+
+    } // namespace
+
+    void recoverEngines(std::span<MatchingEngine* const> engines, std::size_t threads) {
+        threads = std::max<std::size_t>(threads, 1);
+        std::vector<uint64_t> after(engines.size());
+        parallelFor(engines.size(), threads, [&](std::size_t i) { after[i] = engines[i]->recoverSnapshot(); });
+
+        // Engines with a WAL of their own replay it on a worker each. Engines sharing a WAL
+        // get one reader for it, and its workers split those engines round-robin, so each
+        // engine's commands are still applied by one thread in journal order.
+        std::vector<std::vector<Target>> groups;
+        for (std::size_t i = 0; i < engines.size(); ++i) {
+            auto group = std::find_if(groups.begin(), groups.end(),
+                                      [&](const auto& g) { return g.front().engine->wal() == engines[i]->wal(); });
+            if (group == groups.end()) group = groups.emplace(groups.end());
+            group->push_back({engines[i], 0, after[i]});
+        }
+        std::vector<Target> own;
+        for (const auto& group : groups) {
+            if (group.size() == 1) own.push_back(group.front());
+        }
+        parallelFor(own.size(), threads, [&](std::size_t i) {
+            own[i].engine->wal()->replayInbound(own[i].after + 1, [&](const wal::WalRecord& rec) {
+                own[i].engine->replay(rec.cmd);
+                return true;
+            });
+        });
+        for (auto& group : groups) {
+            if (group.size() == 1) continue;
+            const std::size_t workers = std::min(threads, group.size());
+            for (std::size_t i = 0; i < group.size(); ++i) group[i].worker = i % workers;
+            replayShared(group.front().engine->wal(), group, workers);
+        }
+    }
+
+} // namespace engine
@@ -0,0 +1,26 @@
+#ifndef OME_RECOVERY_H
+#define OME_RECOVERY_H
+
+#include "matching_engine.h"
+
+#include <cstddef>
+#include <span>
+#include <thread>
+
+namespace engine {
+
+    // Recovers many engines at once. Snapshots are loaded, decoded and restored on
+    // `threads` workers. The journal of each WAL is then read once and partitioned by
+    // the shard each record was journaled by (commandShard; MatchingEngine::owns for
+    // records without one): one reader streams it and every worker applies the commands
+    // of the engines it owns, so books are rebuilt side by side instead of one after
+    // another. Same result as calling recover() on each engine.
+    //
+    // Engines sharing a WAL must have distinct shards, and engines must not share a
+    // PreTradeRisk while they recover.
+    void recoverEngines(std::span<MatchingEngine* const> engines,
+                        std::size_t threads = std::thread::hardware_concurrency());
+
+} // namespace engine
+
+#endif // OME_RECOVERY_H
@@ -0,0 +1,236 @@
+#ifndef OME_RISK_H
+#define OME_RISK_H
+
+#include "messages.h"
+#include "spsc_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+
+namespace engine {
+
+    // Pre-trade limits. A limit of 0 disables that check.
+    struct RiskLimits {
+        uint64_t maxOrderQty{0};
+        uint64_t maxNotional{0};     // price * qty of a single order
+        uint32_t priceCollarBps{0};  // max distance from the last trade price, in basis points; market orders are exempt
+        uint32_t maxOpenOrders{0};   // per account
+        int64_t maxPosition{0};      // per account, absolute net position if the order and every open order on its side fill
+    };
+
+    // Consistent copy of one account's state.
+    struct AccountRisk {
+        int64_t position{0};
+        uint32_t openOrders{0};
+        uint64_t openBuyQty{0};    // open quantity of resting buys
+        uint64_t openSellQty{0};
+        // Admitted by admit() but not yet settled by the matching thread.
+        uint32_t pendingOrders{0};
+        uint64_t pendingBuyQty{0};
+        uint64_t pendingSellQty{0};
+    };
+
+    // Pre-trade risk stage. Account state lives in a flat, cache-line-per-account table.
+    // The matching thread is the only writer of open orders and positions and updates
+    // them without locks; any thread (gateways, the sequencing stage) may run check() or
+    // admit() or read an account, through a per-account seqlock.
+    //
+    // Owner 0 is anonymous: only the per-order checks apply. Owners outside the table
+    // are rejected.
+    //
+    // Engines rebuild the table on recovery: open orders from the restored book,
+    // positions and the last trade price from the snapshot, the rest by replay. Set the
+    // engine's risk stage before it recovers.
+    //
+    // Orders on their way to the book (in a ring or a batch) are not in the table yet.
+    // admit() therefore reserves what it lets through, and the account limits count
+    // those reservations until the matching thread settles them, once the book has
+    // taken or refused the order. Admitters reserve before they check, so concurrent
+    // admits of one account may both reject but never both pass over a limit.
+    class PreTradeRisk {
+    public:
+        explicit PreTradeRisk(const RiskLimits& limits, std::size_t maxAccounts = 4096)
+            : limits_(limits), accounts_(std::make_unique<Slot[]>(maxAccounts)), maxAccounts_(maxAccounts) {}
+        PreTradeRisk(const PreTradeRisk&) = delete;
+
+        // Returns nullptr if the order may proceed, otherwise the reject reason. Reserves
+        // nothing: a caller that goes on to journal the order uses admit().
+        const char* check(const NewOrder& order) const {
+            if (const char* reason = orderLimits(order.price, order.qty)) return reason;
+            if (order.owner == 0) return nullptr;
+            if (order.owner >= maxAccounts_) return "unknown account";
+            if (!accountLimited()) return nullptr;
+            return accountLimits(account(order.owner), order.isBuy, 1, order.qty);
+        }
+
+        // check(), and when the order passes, reserves it against its account's limits
+        // until settle(owner, isBuy, 1, qty).
+        const char* admit(const NewOrder& order) {
+            if (const char* reason = orderLimits(order.price, order.qty)) return reason;
+            if (order.owner == 0) return nullptr;
+            if (order.owner >= maxAccounts_) return "unknown account";
+            if (!accountLimited()) return nullptr;
+            return reserve(order.owner, order.isBuy, 1, order.qty);
+        }
+
+        // Replace of a resting order of owner to newQty at price. Shrinking an order at its
+        // price always passes. Anything else faces the per-order limits at the new price
+        // and quantity, and a size increase is reserved against maxPosition until
+        // settle(owner, isBuy, 0, sizeDelta).
+        const char* admitReplace(uint32_t owner, bool isBuy, uint64_t price, uint64_t newQty, int64_t sizeDelta,
+                                 bool priceChanged) {
+            if (!priceChanged && sizeDelta <= 0) return nullptr;
+            if (const char* reason = orderLimits(price, newQty)) return reason;
+            if (sizeDelta <= 0 || owner == 0 || owner >= maxAccounts_ || !accountLimited()) return nullptr;
+            return reserve(owner, isBuy, 0, static_cast<uint64_t>(sizeDelta));
+        }
+
+        // Matching thread, once the book has taken or refused an admitted order: drops its
+        // reservation. Orders recovery replays were never admitted; nothing is reserved
+        // then, and settle() releases no more than is reserved.
+        void settle(uint32_t owner, bool isBuy, uint32_t orders, uint64_t qty) {
+            if (owner == 0 || owner >= maxAccounts_) return;
+            Slot& slot = accounts_[owner];
+            releaseAtMost(slot.pendingOrders, orders);
+            releaseAtMost(isBuy ? slot.pendingBuyQty : slot.pendingSellQty, qty);
+        }
+
+        AccountRisk account(uint32_t owner) const {
+            const Slot& slot = accounts_[owner];
+            AccountRisk out;
+            // Reservations first: settle() drops one only after the order's open state is
+            // in, so this reads an order twice at worst, never not at all.
+            out.pendingOrders = slot.pendingOrders.load(std::memory_order_acquire);
+            out.pendingBuyQty = slot.pendingBuyQty.load(std::memory_order_acquire);
+            out.pendingSellQty = slot.pendingSellQty.load(std::memory_order_acquire);
+            uint32_t before;
+            uint32_t after;
+            do {
+                before = slot.version.load(std::memory_order_acquire);
+                while (before & 1) {
+                    cpuRelax();
+                    before = slot.version.load(std::memory_order_acquire);
+                }
+                out.position = slot.position.load(std::memory_order_relaxed);
+                out.openOrders = slot.openOrders.load(std::memory_order_relaxed);
+                out.openBuyQty = slot.openBuyQty.load(std::memory_order_relaxed);
+                out.openSellQty = slot.openSellQty.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = slot.version.load(std::memory_order_relaxed);
+            } while (before != after);
+            return out;
+        }
+
+        const RiskLimits& limits() const { return limits_; }
+
+        // --- Matching thread only ---
+
+        void onAccepted(uint32_t owner, bool isBuy, uint64_t openQty) {
+            update(owner, 0, 1, isBuy, static_cast<int64_t>(openQty));
+        }
+        void onClosed(uint32_t owner, bool isBuy, uint64_t openQty) {
+            update(owner, 0, -1, isBuy, -static_cast<int64_t>(openQty));
+        }
+        void onFill(uint32_t owner, bool isBuy, uint64_t qty, bool completed) {
+            const int64_t signedQty = static_cast<int64_t>(qty);
+            update(owner, isBuy ? signedQty : -signedQty, completed ? -1 : 0, isBuy, -signedQty);
+        }
+        void onReplaced(uint32_t owner, bool isBuy, int64_t sizeDelta) { update(owner, 0, 0, isBuy, sizeDelta); }
+        void onTrade(uint64_t price) { lastTradePrice_.store(price, std::memory_order_relaxed); }
+        // Recovery: adds a book's share of owner's position, saved with its snapshot.
+        void restorePosition(uint32_t owner, int64_t position) { update(owner, position, 0, true, 0); }
+
+    private:
+        struct alignas(kCacheLine) Slot {
+            std::atomic<uint32_t> version{0};   // odd while a write is in progress
+            std::atomic<uint32_t> openOrders{0};
+            std::atomic<int64_t> position{0};
+            std::atomic<uint64_t> openBuyQty{0};
+            std::atomic<uint64_t> openSellQty{0};
+            // admitted, unsettled; written by admitters and the matching thread, outside the seqlock
+            std::atomic<uint32_t> pendingOrders{0};
+            std::atomic<uint64_t> pendingBuyQty{0};
+            std::atomic<uint64_t> pendingSellQty{0};
+        };
+
+        const char* orderLimits(uint64_t price, uint64_t qty) const {
+            if (limits_.maxOrderQty && qty > limits_.maxOrderQty) return "max order qty";
+            if (limits_.maxNotional && price && qty > limits_.maxNotional / price) return "max notional";
+            if (limits_.priceCollarBps && price) {
+                const uint64_t last = lastTradePrice_.load(std::memory_order_relaxed);
+                const uint64_t distance = price > last ? price - last : last - price;
+                if (last && distance * 10000 > last * limits_.priceCollarBps) return "price collar";
+            }
+            return nullptr;
+        }
+
+        bool accountLimited() const { return limits_.maxOpenOrders || limits_.maxPosition; }
+
+        // Limits of an account that would take orders more orders and qty more open
+        // quantity on one side, on top of what is open and reserved.
+        const char* accountLimits(const AccountRisk& acct, bool isBuy, uint32_t orders, uint64_t qty) const {
+            if (orders && limits_.maxOpenOrders &&
+                acct.openOrders + acct.pendingOrders + orders > limits_.maxOpenOrders) {
+                return "max open orders";
+            }
+            if (qty && limits_.maxPosition) {
+                const int64_t open = static_cast<int64_t>(isBuy ? acct.openBuyQty + acct.pendingBuyQty + qty
+                                                                : acct.openSellQty + acct.pendingSellQty + qty);
+                const int64_t worst = isBuy ? acct.position + open : acct.position - open;
+                if (std::llabs(worst) > limits_.maxPosition) return "max position";
+            }
+            return nullptr;
+        }
+
+        // Reserves first, then checks against everything else open or reserved; a reject
+        // takes the reservation back.
+        const char* reserve(uint32_t owner, bool isBuy, uint32_t orders, uint64_t qty) {
+            Slot& slot = accounts_[owner];
+            std::atomic<uint64_t>& pendingQty = isBuy ? slot.pendingBuyQty : slot.pendingSellQty;
+            slot.pendingOrders.fetch_add(orders, std::memory_order_acq_rel);
+            pendingQty.fetch_add(qty, std::memory_order_acq_rel);
+            AccountRisk acct = account(owner);
+            acct.pendingOrders -= orders;
+            (isBuy ? acct.pendingBuyQty : acct.pendingSellQty) -= qty;
+            const char* reason = accountLimits(acct, isBuy, orders, qty);
+            if (reason) {
+                slot.pendingOrders.fetch_sub(orders, std::memory_order_release);
+                pendingQty.fetch_sub(qty, std::memory_order_release);
+            }
+            return reason;
+        }
+
+        template <typename T>
+        static void releaseAtMost(std::atomic<T>& pending, T n) {
+            T cur = pending.load(std::memory_order_relaxed);
+            while (cur && !pending.compare_exchange_weak(cur, cur - std::min(cur, n), std::memory_order_release)) {
+            }
+        }
+
+        void update(uint32_t owner, int64_t positionDelta, int32_t openDelta, bool isBuy, int64_t openQtyDelta) {
+            if (owner == 0 || owner >= maxAccounts_) return;
+            Slot& slot = accounts_[owner];
+            const uint32_t v = slot.version.load(std::memory_order_relaxed);
+            slot.version.store(v + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.position.store(slot.position.load(std::memory_order_relaxed) + positionDelta,
+                                std::memory_order_relaxed);
+            slot.openOrders.store(slot.openOrders.load(std::memory_order_relaxed) + openDelta,
+                                  std::memory_order_relaxed);
+            std::atomic<uint64_t>& openQty = isBuy ? slot.openBuyQty : slot.openSellQty;
+            openQty.store(openQty.load(std::memory_order_relaxed) + openQtyDelta, std::memory_order_relaxed);
+            slot.version.store(v + 2, std::memory_order_release);
+        }
+
+        const RiskLimits limits_;
+        std::unique_ptr<Slot[]> accounts_;
+        const std::size_t maxAccounts_;
+        alignas(kCacheLine) std::atomic<uint64_t> lastTradePrice_{0};
+    };
+
+} // namespace engine
+
+#endif // OME_RISK_H
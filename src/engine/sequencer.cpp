@@ -0,0 +1,77 @@
+#include "sequencer.h"
+
+namespace engine {
+
+    Sequencer::Sequencer(wal::WalManager* wal, MatchingShard::Ring* shardRing, OrderIdAllocator* ids,
+                         std::size_t journalBatch)
+        : wal_(wal), shardRing_(shardRing), ids_(ids), journalBatch_(journalBatch),
+          journalRing_(std::make_unique<SpscRing<Command, kJournalRingCapacity>>()),
+          durableSeq_(wal->lastSequence()) {
+        batch_.reserve(journalBatch_);
+    }
+
+    Sequencer::~Sequencer() {
+        stop();
+    }
+
+    void Sequencer::start() {
+        if (running_.exchange(true)) return;
+        journalThread_ = std::thread([this] { runJournal(); });
+    }
+
+    void Sequencer::stop() {
+        running_.store(false, std::memory_order_release);
+        if (journalThread_.joinable()) journalThread_.join();
+    }
+
+    uint64_t Sequencer::submit(Command cmd, const char** rejectReason) {
+        if (risk_ && cmd.type == MsgType::NewOrder) {
+            if (const char* reason = risk_->admit(cmd.newOrder)) {
+                if (rejectReason) *rejectReason = reason;
+                return 0;
+            }
+        }
+        if (cmd.type == MsgType::NewOrder && cmd.newOrder.orderId == 0) {
+            cmd.newOrder.orderId = ids_->next();
+        }
+        cmd.route(ids_->shard());
+        // The WAL's one counter: engines journaling directly (submitBatch) draw from it too.
+        cmd.seq = wal_->reserveSequences(1);
+        journalRing_->push(cmd);
+        shardRing_->push(cmd);
+        return cmd.seq;
+    }
+
+    void Sequencer::runJournal() {
+        while (running_.load(std::memory_order_acquire)) {
+            const std::size_t n = journalOnce();
+            releaseDurable();
+            if (n == 0) cpuRelax();
+        }
+        while (journalOnce() > 0) {
+        }
+        wal_->waitInboundDurable(journaledSeq_);
+        releaseDurable();
+    }
+
+    void Sequencer::releaseDurable() {
+        const uint64_t durable = wal_->durableInbound();
+        if (durable > durableSeq_.load(std::memory_order_relaxed)) {
+            durableSeq_.store(durable, std::memory_order_release);
+        }
+    }
+
+    std::size_t Sequencer::journalOnce() {
+        batch_.clear();
+        const std::size_t n = journalRing_->consume(
+            [&](const Command& cmd) { batch_.push_back(cmd); },
+            journalBatch_);
+        if (n == 0) return 0;
+        // One write for the whole batch. It is released to the engine by releaseDurable()
+        // once the journal reports it durable, so further batches can be queued meanwhile.
+        wal_->appendInboundAsync(batch_);
+        journaledSeq_ = batch_.back().seq;
+        return n;
+    }
+
+} // namespace engine
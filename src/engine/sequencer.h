@@ -0,0 +1,72 @@
+#ifndef OME_SEQUENCER_H
+#define OME_SEQUENCER_H
+
+#include "matching_shard.h"
+#include "messages.h"
+#include "order_id.h"
+#include "risk.h"
+#include "spsc_ring.h"
+#include "../wal/wal_manager.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace engine {
+
+    // Pipelined front of a shard: stamps each command with the WAL's next sequence number and
+    // hands it to the journal thread and the matching shard at the same time. The engine
+    // holds back outbound effects until durableSeq() covers the command that caused them,
+    // so write-ahead semantics hold while disk I/O overlaps with matching.
+    //
+    // submit() must be called from a single thread (the sequencing stage).
+    class Sequencer {
+    public:
+        static constexpr std::size_t kJournalRingCapacity = 1 << 14;
+
+        // ids is the shard engine's allocator (MatchingEngine::orderIds()), which the engine
+        // keeps drawing from too; pass it after the engine's recover().
+        Sequencer(wal::WalManager* wal, MatchingShard::Ring* shardRing, OrderIdAllocator* ids,
+                  std::size_t journalBatch = 256);
+        Sequencer(const Sequencer&) = delete;
+        ~Sequencer();
+
+        void start();
+        // Journals everything already submitted, then joins the journal thread.
+        void stop();
+
+        // Returns the assigned sequence number, or 0 if the risk stage rejected the
+        // command (reason in *rejectReason when given); rejected commands are not journaled.
+        // A NewOrder the risk stage admits stays reserved against its account until the
+        // engine applies it, so a burst still in the rings counts against the limits.
+        // A NewOrder without an id gets the next one of this shard before it is journaled.
+        uint64_t submit(Command cmd, const char** rejectReason = nullptr);
+
+        void setRiskCheck(PreTradeRisk* risk) { risk_ = risk; }
+
+        const std::atomic<uint64_t>& durableSeq() const { return durableSeq_; }
+
+    private:
+        void runJournal();
+        std::size_t journalOnce();
+        // Publishes the journal's durable sequence to durableSeq_.
+        void releaseDurable();
+
+        wal::WalManager* wal_;
+        MatchingShard::Ring* shardRing_;
+        PreTradeRisk* risk_{nullptr};
+        OrderIdAllocator* ids_;
+        std::size_t journalBatch_;
+        std::unique_ptr<SpscRing<Command, kJournalRingCapacity>> journalRing_;
+        std::vector<Command> batch_;   // journal thread only
+        uint64_t journaledSeq_{0};     // journal thread only
+
+        std::atomic<uint64_t> durableSeq_;
+        std::atomic<bool> running_{false};
+        std::thread journalThread_;
+    };
+
+} // namespace engine
+
+#endif // OME_SEQUENCER_H
@@ -0,0 +1,117 @@
+#include "snapshot_replica.h"
+
+namespace engine {
+
+    SnapshotReplica::SnapshotReplica(MatchingEngine* primary, wal::WalManager* wal, logging::AsyncLogger* logger,
+                                     std::chrono::microseconds parkInterval)
+        : primary_(primary),
+          shadow_(primary->orderBook_.symbol(), wal, nullptr, nullptr, primary->ids_.shard()),
+          logger_(logger),
+          parkInterval_(parkInterval),
+          feed_(std::make_unique<ReplicaFeed>()) {
+        shadow_.shadow_ = true;
+    }
+
+    SnapshotReplica::~SnapshotReplica() {
+        stop();
+    }
+
+    void SnapshotReplica::start() {
+        if (running_.exchange(true)) return;
+        // One in-memory snapshot carries the primary's book, ids and event count across.
+        std::string seed;
+        primary_->encodeSnapshot(seed);
+        shadow_.restoreSnapshot(seed);
+        shadow_.deltasPerBase_ = primary_->deltasPerBase_;
+        primary_->replicaFeed_ = feed_.get();
+        // The primary stops tracking changes while attached; its next own snapshot is full.
+        primary_->baseWritten_ = false;
+        writerStop_ = false;
+        writer_ = std::thread([this] { runWriter(); });
+        thread_ = std::thread([this] { run(); });
+    }
+
+    void SnapshotReplica::stop() {
+        running_.store(false, std::memory_order_release);
+        if (thread_.joinable()) thread_.join();
+        {
+            std::lock_guard lock(writeMu_);
+            writerStop_ = true;
+        }
+        writeWake_.notify_one();
+        if (writer_.joinable()) writer_.join();
+        if (primary_->replicaFeed_ == feed_.get()) primary_->replicaFeed_ = nullptr;
+    }
+
+    void SnapshotReplica::run() {
+        uint32_t idlePasses = 0;
+        while (running_.load(std::memory_order_acquire)) {
+            if (pollOnce() > 0) {
+                idlePasses = 0;
+            } else if (++idlePasses < 1000) {
+                cpuRelax();
+            } else {
+                // Snapshots are not latency critical; do not hold a core while idle.
+                std::this_thread::sleep_for(parkInterval_);
+            }
+        }
+        while (pollOnce() > 0) {
+        }
+    }
+
+    std::size_t SnapshotReplica::pollOnce() {
+        bool cut = false;
+        const std::size_t n = feed_->consumeUntil([&](const Command& cmd) {
+            if (cmd.type != MsgType::None) {
+                shadow_.apply(cmd);
+                return true;
+            }
+            cut = true;
+            return false;
+        });
+        if (!cut) return n;
+
+        {
+            // Like a primary's held snapshot: while one is still unwritten the marker is
+            // skipped, and the changes it would have covered go into the next one.
+            std::lock_guard lock(writeMu_);
+            if (!writes_.empty()) return n;
+        }
+        auto snapshot = shadow_.encodeNextSnapshot();
+        if (!snapshot) return n;
+        {
+            std::lock_guard lock(writeMu_);
+            writes_.push_back(std::move(*snapshot));
+        }
+        writeWake_.notify_one();
+        return n;
+    }
+
+    void SnapshotReplica::runWriter() {
+        std::unique_lock lock(writeMu_);
+        for (;;) {
+            writeWake_.wait(lock, [&] { return writerStop_ || !writes_.empty(); });
+            if (writes_.empty()) return;
+            const PendingSnapshot& snapshot = writes_.front();
+            lock.unlock();
+
+            bool ready;
+            while (!(ready = primary_->snapshotReady(snapshot))) {
+                if (!running_.load(std::memory_order_acquire)) break;
+                std::this_thread::sleep_for(parkInterval_);
+            }
+            if (ready) {
+                shadow_.saveSnapshot(snapshot);
+                written_.fetch_add(1, std::memory_order_relaxed);
+                LOG_INFO(logger_, "[SNAPSHOT] Saved at seq={} by replica", snapshot.seq);
+            } else {
+                LOG_WARN(logger_, "[SNAPSHOT] Dropped snapshot at seq={}: its records were not durable or "
+                                  "its events not delivered", snapshot.seq);
+            }
+
+            lock.lock();
+            writes_.pop_front();
+        }
+    }
+
+} // namespace engine
@@ -0,0 +1,65 @@
+#ifndef OME_SNAPSHOT_REPLICA_H
+#define OME_SNAPSHOT_REPLICA_H
+
+#include "matching_engine.h"
+#include "spsc_ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace engine {
+
+    // Shadow copy of one engine's book, kept on its own thread, that takes the engine's
+    // snapshots. The matching thread copies every sequenced command into a ring, and
+    // takeSnapshot() only appends a marker to it. The replica applies the same commands
+    // to its own book, so at a marker its state is exactly the primary's at that
+    // sequence; it encodes the snapshot there, once the commands before the marker are
+    // released from the ring. A writer thread stores it once the primary has made its
+    // records durable and delivered its events, so the ring never waits on a sync.
+    class SnapshotReplica {
+    public:
+        SnapshotReplica(MatchingEngine* primary, wal::WalManager* wal, logging::AsyncLogger* logger = nullptr,
+                        std::chrono::microseconds parkInterval = std::chrono::microseconds(100));
+        SnapshotReplica(const SnapshotReplica&) = delete;
+        ~SnapshotReplica();
+
+        // Seeds the shadow book from the primary and attaches to it. Call after
+        // primary->recover() and before the matching thread starts.
+        void start();
+        // Writes every snapshot already requested, then detaches and joins. Call once
+        // the matching thread has stopped.
+        void stop();
+
+        uint64_t snapshotsWritten() const { return written_.load(std::memory_order_relaxed); }
+
+    private:
+        void run();
+        std::size_t pollOnce();
+        void runWriter();
+        using PendingSnapshot = MatchingEngine::PendingSnapshot;
+
+        MatchingEngine* primary_;
+        MatchingEngine shadow_;
+        logging::AsyncLogger* logger_;
+        std::chrono::microseconds parkInterval_;
+        std::unique_ptr<ReplicaFeed> feed_;
+        std::atomic<uint64_t> written_{0};
+        std::atomic<bool> running_{false};
+        std::thread thread_;
+
+        // encoded snapshots on their way to the WAL; at most one, as with a primary's held one
+        std::mutex writeMu_;
+        std::condition_variable writeWake_;
+        std::deque<PendingSnapshot> writes_;
+        bool writerStop_{false};
+        std::thread writer_;
+    };
+
+} // namespace engine
+
+#endif // OME_SNAPSHOT_REPLICA_H
@@ -0,0 +1,120 @@
+#ifndef OME_SPSC_RING_H
+#define OME_SPSC_RING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+namespace engine {
+
+    inline constexpr std::size_t kCacheLine = 64;
+
+    inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield" ::: "memory");
+#endif
+    }
+
+    // Bounded lock-free ring for exactly one producer thread and one consumer thread.
+    // Head and tail live on their own cache lines, and each side keeps a cached copy
+    // of the other side's index so the shared line is only touched when the ring
+    // looks full (producer) or empty (consumer).
+    template <typename T, std::size_t Capacity>
+    class SpscRing {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                      "SpscRing capacity must be a power of two");
+        static_assert(std::is_trivially_copyable_v<T>, "SpscRing slots are copied by value");
+
+    public:
+        SpscRing() = default;
+        SpscRing(const SpscRing&) = delete;
+        SpscRing& operator=(const SpscRing&) = delete;
+
+        // Producer side
+        bool tryPush(const T& item) {
+            const uint64_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail - headCache_ >= Capacity) {
+                headCache_ = head_.load(std::memory_order_acquire);
+                if (tail - headCache_ >= Capacity) return false;
+            }
+            slots_[tail & kMask] = item;
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        void push(const T& item) {
+            while (!tryPush(item)) cpuRelax();
+        }
+
+        // Consumer side
+        bool tryPop(T& out) {
+            const uint64_t head = head_.load(std::memory_order_relaxed);
+            if (head == tailCache_) {
+                tailCache_ = tail_.load(std::memory_order_acquire);
+                if (head == tailCache_) return false;
+            }
+            out = slots_[head & kMask];
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Hands up to maxItems queued entries to fn and publishes the new head once
+        // for the whole batch. Returns the number of entries consumed.
+        template <typename Fn>
+        std::size_t consume(Fn&& fn, std::size_t maxItems = Capacity) {
+            const uint64_t head = head_.load(std::memory_order_relaxed);
+            if (head == tailCache_) {
+                tailCache_ = tail_.load(std::memory_order_acquire);
+                if (head == tailCache_) return 0;
+            }
+            uint64_t available = tailCache_ - head;
+            if (available > maxItems) available = maxItems;
+            for (uint64_t i = 0; i < available; ++i) {
+                fn(slots_[(head + i) & kMask]);
+            }
+            head_.store(head + available, std::memory_order_release);
+            return available;
+        }
+
+        // Like consume(), but stops after the first entry for which fn returns false.
+        // The entries handed over so far are released before it returns.
+        template <typename Fn>
+        std::size_t consumeUntil(Fn&& fn, std::size_t maxItems = Capacity) {
+            const uint64_t head = head_.load(std::memory_order_relaxed);
+            if (head == tailCache_) {
+                tailCache_ = tail_.load(std::memory_order_acquire);
+                if (head == tailCache_) return 0;
+            }
+            uint64_t available = tailCache_ - head;
+            if (available > maxItems) available = maxItems;
+            uint64_t taken = 0;
+            while (taken < available && fn(slots_[(head + taken++) & kMask])) {
+            }
+            head_.store(head + taken, std::memory_order_release);
+            return taken;
+        }
+
+        bool empty() const {
+            return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+        }
+
+        static constexpr std::size_t capacity() { return Capacity; }
+
+    private:
+        static constexpr uint64_t kMask = Capacity - 1;
+
+        alignas(kCacheLine) std::atomic<uint64_t> head_{0};
+        uint64_t tailCache_{0};                       // consumer's view of tail_
+        alignas(kCacheLine) std::atomic<uint64_t> tail_{0};
+        uint64_t headCache_{0};                       // producer's view of head_
+        alignas(kCacheLine) std::array<T, Capacity> slots_{};
+    };
+
+} // namespace engine
+
+#endif // OME_SPSC_RING_H
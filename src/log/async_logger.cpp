@@ -0,0 +1,200 @@
+#include "async_logger.h"
+
+#include <algorithm>
+
+namespace logging {
+
+    namespace {
+        std::atomic<uint64_t> nextLoggerId{1};
+
+        // The ring of the logger this thread wrote to last: the common case needs no lookup.
+        struct LocalRing {
+            uint64_t owner{0};
+            AsyncLogger::Ring* ring{nullptr};
+        };
+        thread_local LocalRing tlsRing;
+
+        // Every ring of this thread, one per logger it has written to. They are closed
+        // when the thread exits.
+        struct LocalRings {
+            struct Entry {
+                uint64_t owner;
+                std::shared_ptr<AsyncLogger::ThreadRing> ring;
+            };
+            std::vector<Entry> entries;
+
+            ~LocalRings() {
+                for (auto& entry : entries) entry.ring->closed.store(true, std::memory_order_release);
+            }
+        };
+        thread_local LocalRings tlsRings;
+
+        const char* levelName(Level level) {
+            switch (level) {
+                case Level::Debug: return "DEBUG";
+                case Level::Info:  return "INFO ";
+                case Level::Warn:  return "WARN ";
+                case Level::Error: return "ERROR";
+                default:           return "?    ";
+            }
+        }
+    }
+
+    AsyncLogger::AsyncLogger(FILE* out, std::chrono::microseconds idleSleep)
+        : out_(out), idleSleep_(idleSleep), id_(nextLoggerId.fetch_add(1)),
+          startTicks_(readTicks()), startTime_(std::chrono::steady_clock::now()) {
+        thread_ = std::thread([this] { run(); });
+    }
+
+    AsyncLogger::~AsyncLogger() {
+        running_.store(false, std::memory_order_release);
+        if (thread_.joinable()) thread_.join();
+    }
+
+    AsyncLogger::Ring& AsyncLogger::localRing() {
+        if (tlsRing.owner != id_) return addLocalRing();
+        return *tlsRing.ring;
+    }
+
+    AsyncLogger::Ring& AsyncLogger::addLocalRing() {
+        auto& entries = tlsRings.entries;
+        // Rings of loggers destroyed since are held by this thread alone.
+        std::erase_if(entries, [](const LocalRings::Entry& e) { return e.ring.use_count() == 1; });
+        auto it = std::find_if(entries.begin(), entries.end(),
+                               [this](const LocalRings::Entry& e) { return e.owner == id_; });
+        if (it == entries.end()) {
+            auto ring = std::make_shared<ThreadRing>();
+            {
+                std::lock_guard<std::mutex> lock(ringsMutex_);
+                rings_.push_back(ring);
+                ringsVersion_.fetch_add(1, std::memory_order_release);
+            }
+            entries.push_back({id_, std::move(ring)});
+            it = entries.end() - 1;
+        }
+        tlsRing = {id_, &it->ring->ring};
+        return *tlsRing.ring;
+    }
+
+    void AsyncLogger::log_exception(const std::string& context, const std::exception& ex) {
+        write(Level::Error, "{}{}", context, std::string_view(ex.what()));
+    }
+
+    void AsyncLogger::log_message(const std::string& message) {
+        write(Level::Info, "{}", message);
+    }
+
+    void AsyncLogger::flush() {
+        // Two full passes after the call: the first may have been mid-way through a ring.
+        const uint64_t target = passes_.load(std::memory_order_acquire) + 2;
+        while (passes_.load(std::memory_order_acquire) < target && thread_.joinable()) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    void AsyncLogger::run() {
+        while (running_.load(std::memory_order_acquire)) {
+            if (drain() == 0) {
+                std::this_thread::sleep_for(idleSleep_);
+            }
+        }
+        while (drain() > 0) {
+        }
+    }
+
+    std::size_t AsyncLogger::drain() {
+        if (drainVersion_ != ringsVersion_.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(ringsMutex_);
+            drainRings_ = rings_;
+            drainVersion_ = ringsVersion_.load(std::memory_order_relaxed);
+        }
+
+        std::size_t total = 0;
+        bool closed = false;
+        for (auto& ring : drainRings_) {
+            // Read before draining: once set, the consume below sees the thread's last push.
+            closed |= ring->closed.load(std::memory_order_acquire);
+            total += ring->ring.consume([&](const LogRecord& rec) {
+                line_.clear();
+                format(rec, line_);
+                std::fwrite(line_.data(), 1, line_.size(), out_);
+            });
+        }
+        if (closed) releaseClosedRings();
+        const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reportedDrops_) {
+            LogRecord rec{};
+            rec.ticks = readTicks();
+            rec.fmt = "[LOGGER] {} records dropped (ring full), {} in total";
+            rec.level = Level::Warn;
+            encode(rec, dropped - reportedDrops_);
+            encode(rec, dropped);
+            reportedDrops_ = dropped;
+            line_.clear();
+            format(rec, line_);
+            std::fwrite(line_.data(), 1, line_.size(), out_);
+            ++total;
+        }
+        if (total > 0) std::fflush(out_);
+        passes_.fetch_add(1, std::memory_order_release);
+        return total;
+    }
+
+    void AsyncLogger::releaseClosedRings() {
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        const std::size_t before = rings_.size();
+        std::erase_if(rings_, [](const std::shared_ptr<ThreadRing>& r) {
+            return r->closed.load(std::memory_order_acquire) && r->ring.empty();
+        });
+        if (rings_.size() != before) {
+            ringsVersion_.fetch_add(1, std::memory_order_release);
+            drainRings_ = rings_;
+            drainVersion_ = ringsVersion_.load(std::memory_order_relaxed);
+        }
+    }
+
+    void AsyncLogger::format(const LogRecord& rec, std::string& out) const {
+        // Ticks are converted with the rate observed since construction, so no
+        // calibration pause is needed up front.
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - startTime_).count();
+        const uint64_t nowTicks = readTicks();
+        const double nsPerTick = nowTicks > startTicks_ ? double(elapsed) / double(nowTicks - startTicks_) : 1.0;
+        const uint64_t ticks = rec.ticks > startTicks_ ? rec.ticks - startTicks_ : 0;
+        const uint64_t ns = static_cast<uint64_t>(double(ticks) * nsPerTick);
+
+        char head[48];
+        const int n = std::snprintf(head, sizeof(head), "%llu.%09llu %s ",
+                                    static_cast<unsigned long long>(ns / 1000000000ULL),
+                                    static_cast<unsigned long long>(ns % 1000000000ULL),
+                                    levelName(rec.level));
+        out.append(head, n);
+
+        uint8_t arg = 0;
+        for (const char* p = rec.fmt; *p; ++p) {
+            if (p[0] != '{' || p[1] != '}' || arg >= rec.argc) {
+                out.push_back(*p);
+                continue;
+            }
+            ++p;
+            const uint64_t v = rec.args[arg];
+            switch ((rec.kinds >> (2 * arg)) & 3) {
+                case LogRecord::U64:
+                    out.append(std::to_string(v));
+                    break;
+                case LogRecord::I64:
+                    out.append(std::to_string(static_cast<int64_t>(v)));
+                    break;
+                case LogRecord::CStr:
+                    out.append(reinterpret_cast<const char*>(v));
+                    break;
+                case LogRecord::Text:
+                    out.append(rec.text + (v >> 8), v & 0xff);
+                    break;
+            }
+            ++arg;
+        }
+        out.push_back('\n');
+    }
+
+} // namespace logging
@@ -0,0 +1,170 @@
+#ifndef OME_ASYNC_LOGGER_H
+#define OME_ASYNC_LOGGER_H
+
+#include <book/logger.h>
+#include "../engine/spsc_ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Levels below OME_LOG_LEVEL are removed at compile time, arguments included.
+// 0 = debug, 1 = info, 2 = warn, 3 = error, 4 = off
+#ifndef OME_LOG_LEVEL
+#define OME_LOG_LEVEL 1
+#endif
+
+namespace logging {
+
+    enum class Level : uint8_t { Debug, Info, Warn, Error, Off };
+
+    inline constexpr Level kCompiledLevel = static_cast<Level>(OME_LOG_LEVEL);
+
+    // One log call, as captured on the hot path. Formatting happens on the logger
+    // thread: fmt must be a string literal whose "{}" placeholders are filled from
+    // args in order. A single dynamic string per record is copied into text.
+    struct LogRecord {
+        enum ArgKind : uint8_t { U64, I64, CStr, Text };
+
+        uint64_t ticks;
+        const char* fmt;
+        uint64_t args[4];
+        Level level;
+        uint8_t argc;
+        uint8_t kinds;     // 2 bits per argument
+        uint8_t textLen;
+        char text[76];
+    };
+    static_assert(sizeof(LogRecord) == 128, "LogRecord should span exactly two cache lines");
+
+    // liquibook::book::Logger backed by per-thread SPSC rings of LogRecord.
+    // Producers never block: when a thread's ring is full the record is dropped and counted.
+    class AsyncLogger final : public liquibook::book::Logger {
+    public:
+        static constexpr std::size_t kRingCapacity = 4096;
+        using Ring = engine::SpscRing<LogRecord, kRingCapacity>;
+        // One producer thread's ring. Closed when that thread exits, after its last push;
+        // the logger thread then releases it once drained.
+        struct ThreadRing {
+            Ring ring;
+            std::atomic<bool> closed{false};
+        };
+
+        explicit AsyncLogger(FILE* out = stdout,
+                             std::chrono::microseconds idleSleep = std::chrono::microseconds(200));
+        AsyncLogger(const AsyncLogger&) = delete;
+        ~AsyncLogger();
+
+        template <typename... Args>
+        void write(Level level, const char* fmt, const Args&... args) {
+            static_assert(sizeof...(Args) <= 4, "at most four arguments per log record");
+            LogRecord rec;
+            rec.ticks = readTicks();
+            rec.fmt = fmt;
+            rec.level = level;
+            rec.argc = 0;
+            rec.kinds = 0;
+            rec.textLen = 0;
+            (encode(rec, args), ...);
+            if (!localRing().tryPush(rec)) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        // liquibook::book::Logger
+        void log_exception(const std::string& context, const std::exception& ex) override;
+        void log_message(const std::string& message) override;
+
+        // Blocks until every record pushed before the call has been written out.
+        void flush();
+
+        // Records dropped on full rings so far. The logger thread also reports new drops
+        // as a WARN line of their own, so a gap in the output is visible where it happened.
+        uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+        static uint64_t readTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+            return __builtin_ia32_rdtsc();
+#else
+            return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+        }
+
+        template <typename T>
+        static void encode(LogRecord& rec, const T& value) {
+            const uint8_t i = rec.argc++;
+            if constexpr (std::is_same_v<T, bool> || std::is_unsigned_v<T>) {
+                rec.args[i] = static_cast<uint64_t>(value);
+                rec.kinds |= LogRecord::U64 << (2 * i);
+            } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+                rec.args[i] = static_cast<uint64_t>(static_cast<int64_t>(value));
+                rec.kinds |= LogRecord::I64 << (2 * i);
+            } else if constexpr (std::is_convertible_v<T, const char*>) {
+                // string literals and other strings with static storage only
+                rec.args[i] = reinterpret_cast<uint64_t>(static_cast<const char*>(value));
+                rec.kinds |= LogRecord::CStr << (2 * i);
+            } else {
+                const std::string_view sv(value);
+                const std::size_t room = sizeof(rec.text) - rec.textLen;
+                const std::size_t n = sv.size() < room ? sv.size() : room;
+                std::memcpy(rec.text + rec.textLen, sv.data(), n);
+                rec.args[i] = (static_cast<uint64_t>(rec.textLen) << 8) | n;
+                rec.textLen += static_cast<uint8_t>(n);
+                rec.kinds |= LogRecord::Text << (2 * i);
+            }
+        }
+
+        Ring& localRing();
+        Ring& addLocalRing();
+        void run();
+        std::size_t drain();
+        void releaseClosedRings();
+        void format(const LogRecord& rec, std::string& out) const;
+
+        FILE* out_;
+        std::chrono::microseconds idleSleep_;
+        const uint64_t id_;
+        const uint64_t startTicks_;
+        const std::chrono::steady_clock::time_point startTime_;
+
+        std::mutex ringsMutex_;
+        std::vector<std::shared_ptr<ThreadRing>> rings_;
+        std::atomic<uint64_t> ringsVersion_{0};   // bumped on every change to rings_
+
+        // owned by the logger thread
+        std::vector<std::shared_ptr<ThreadRing>> drainRings_;
+        uint64_t drainVersion_{0};
+        std::string line_;
+        uint64_t reportedDrops_{0};
+
+        std::atomic<uint64_t> dropped_{0};
+        std::atomic<uint64_t> passes_{0};
+        std::atomic<bool> running_{true};
+        std::thread thread_;
+    };
+
+} // namespace logging
+
+#define OME_LOG(logger, level, ...)                                                                \
+    do {                                                                                           \
+        if constexpr ((level) >= logging::kCompiledLevel) {                                        \
+            if (logger) (logger)->write((level), __VA_ARGS__);                                     \
+        }                                                                                          \
+    } while (false)
+
+#define LOG_DEBUG(logger, ...) OME_LOG(logger, logging::Level::Debug, __VA_ARGS__)
+#define LOG_INFO(logger, ...) OME_LOG(logger, logging::Level::Info, __VA_ARGS__)
+#define LOG_WARN(logger, ...) OME_LOG(logger, logging::Level::Warn, __VA_ARGS__)
+#define LOG_ERROR(logger, ...) OME_LOG(logger, logging::Level::Error, __VA_ARGS__)
+
+#endif // OME_ASYNC_LOGGER_H
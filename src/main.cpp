@@ -4,41 +4,62 @@
 #include <chrono>
 
 #include "engine/matching_engine.h"
+#include "engine/matching_shard.h"
+#include "engine/risk.h"
+#include "engine/sequencer.h"
+#include "engine/snapshot_replica.h"
+#include "log/async_logger.h"
 #include "wal/wal_manager.h"
 
 using namespace engine;
 
 int main() {
+    logging::AsyncLogger logger;
     {
         std::cout << "=== Starting Order Matching Engine with WAL ===\n";
-        wal::WalManager wal("db/wal");
-        Broadcaster broadcaster;
-        MatchingEngine engine("usdtbtc", &wal, &broadcaster);
+        wal::WalManager wal("db/wal", wal::WalOptions::fromEnv());
+        Broadcaster broadcaster(&logger);
+        MatchingEngine engine("usdtbtc", &wal, &broadcaster, &logger);
+        PreTradeRisk risk({.maxOrderQty = 1000, .maxNotional = 1000000, .priceCollarBps = 2000});
+        engine.setRiskCheck(&risk);
+        MatchingShard shard(&engine);
+        Sequencer sequencer(&wal, &shard.ingress(0), &engine.orderIds());
+        sequencer.setRiskCheck(&risk);
+        engine.setDurableWatermark(&sequencer.durableSeq());
+        SnapshotReplica replica(&engine, &wal, &logger);   // snapshots are written off the matching thread
+        replica.start();
+        sequencer.start();
+        shard.start();
 
-        // insert ~200k orders
+        // insert ~200k orders; this thread plays the sequencing stage
         for (int i = 0; i < 200000; ++i) {
             bool isBuy = (rand() % 2 == 0);
             uint64_t price = 95 + rand() % 10;
             uint64_t qty   = 1 + rand() % 20;
-            engine.addOrder(isBuy, price, qty);
+            sequencer.submit(Command::makeNew(isBuy, price, qty));
 
             if ((i + 1) % 25000 == 0) {   // log progress every 25k
                 std::cout << "--- Inserted " << (i + 1) << " orders ---\n";
             }
         }
 
+        sequencer.stop();   // journal everything submitted so the shard can release it
+        shard.stop();       // drains the ring before the engine is touched from here again
         engine.takeSnapshot();
+        replica.stop();     // writes the snapshots still queued
     } // <-- wal + engine destructed here, RocksDB lock released
+    logger.flush();
 
     std::cout << "\n=== Simulating restart... ===\n";
 
     {
-        wal::WalManager wal("db/wal");
-        Broadcaster broadcaster;
-        engine::MatchingEngine engine("usdtbtc", &wal, &broadcaster);
+        wal::WalManager wal("db/wal", wal::WalOptions::fromEnv());
+        Broadcaster broadcaster(&logger);
+        engine::MatchingEngine engine("usdtbtc", &wal, &broadcaster, &logger);
 
         engine.recover();   // should succeed now
     }
+    logger.flush();
 
     return 0;
 }
@@ -0,0 +1,146 @@
+#include "engine/matching_engine.h"
+#include "engine/recovery.h"
+#include "wal/wal_manager.h"
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Recovery of several engines sharing one WAL: recover() on each engine in turn
+// against recoverEngines(), which reads the journal once and replays the engines on
+// worker threads. The journal holds no snapshot, so both replay all of it.
+// Then the snapshot path on its own: saving a large book and restoring it.
+
+constexpr size_t NUM_SYMBOLS = 8;
+constexpr size_t ORDERS_PER_SYMBOL = 100000;
+constexpr size_t SNAPSHOT_ORDERS = 1000000;
+
+static double since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void remove_db(const std::string& path) {
+    for (const char* suffix : {"", ".in", ".out"}) {
+        std::filesystem::remove_all(path + suffix);
+    }
+}
+
+static wal::WalOptions bench_options() {
+    wal::WalOptions options;
+    options.durability = wal::Durability::Async;
+    options.keepSnapshots = 0;   // keep every record for the replays below
+    return options;
+}
+
+// Interleaved records of every symbol as its engine would journal them: resting
+// orders on both sides, every fourth one cancelling an earlier order.
+static void write_journal(const std::string& path) {
+    wal::WalManager wal(path, bench_options());
+    for (size_t i = 0; i < ORDERS_PER_SYMBOL; ++i) {
+        for (size_t s = 0; s < NUM_SYMBOLS; ++s) {
+            const auto shard = static_cast<uint16_t>(s + 1);
+            engine::Command cmd = i % 4 == 3
+                ? engine::Command::makeCancel(engine::OrderIdAllocator::compose(shard, i - 2))
+                : engine::Command::makeNew(i % 2 == 0, i % 2 == 0 ? 10000 - i % 50 : 10001 + i % 50, 1 + i % 100,
+                                           engine::OrderIdAllocator::compose(shard, i + 1));
+            cmd.route(shard);
+            wal.appendInbound(cmd);
+        }
+    }
+    wal.sync();
+}
+
+static double recover_all(const std::string& path, bool parallel) {
+    // Recovery writes snapshots and processed marks: every run starts from a fresh journal.
+    remove_db(path);
+    write_journal(path);
+
+    double seconds;
+    {
+        wal::WalManager wal(path, bench_options());
+        Broadcaster broadcaster;
+        std::vector<std::unique_ptr<engine::MatchingEngine>> engines;
+        std::vector<engine::MatchingEngine*> raw;
+        for (size_t s = 0; s < NUM_SYMBOLS; ++s) {
+            engines.push_back(std::make_unique<engine::MatchingEngine>(
+                "SYM" + std::to_string(s), &wal, &broadcaster, nullptr, static_cast<uint16_t>(s + 1)));
+            raw.push_back(engines.back().get());
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        if (parallel) {
+            engine::recoverEngines(raw, NUM_SYMBOLS);
+        } else {
+            for (auto* e : raw) e->recover();
+        }
+        seconds = since(start);
+    }
+    remove_db(path);
+    return seconds;
+}
+
+struct SnapshotTimes {
+    double save;      // encode and store
+    double restore;   // load, decode and rebuild the book
+    double recover;   // restore, then scan the journal after the snapshot
+};
+
+// A book of SNAPSHOT_ORDERS resting orders, half bids and half asks that never cross.
+// The snapshot covers the whole journal, so recover() replays nothing after it; its
+// extra time is the journal scan.
+static SnapshotTimes snapshot_round_trip(const std::string& path) {
+    remove_db(path);
+    SnapshotTimes times{};
+    {
+        wal::WalManager wal(path, bench_options());
+        Broadcaster broadcaster;
+        engine::MatchingEngine engine("SNAP", &wal, &broadcaster);
+        engine.setSnapshotDeltas(0);
+        for (size_t i = 0; i < SNAPSHOT_ORDERS; ++i) {
+            const bool isBuy = i % 2 == 0;
+            engine.addOrder(isBuy, isBuy ? 10000 - i % 500 : 10001 + i % 500, 1 + i % 100);
+        }
+        const auto start = std::chrono::steady_clock::now();
+        engine.takeSnapshot();
+        wal.sync();
+        times.save = since(start);
+    }
+    {
+        wal::WalManager wal(path, bench_options());
+        Broadcaster broadcaster;
+        engine::MatchingEngine engine("SNAP", &wal, &broadcaster);
+        const auto start = std::chrono::steady_clock::now();
+        engine.recoverSnapshot();
+        times.restore = since(start);
+    }
+    {
+        wal::WalManager wal(path, bench_options());
+        Broadcaster broadcaster;
+        engine::MatchingEngine engine("SNAP", &wal, &broadcaster);
+        const auto start = std::chrono::steady_clock::now();
+        engine.recover();
+        times.recover = since(start);
+    }
+    remove_db(path);
+    return times;
+}
+
+int main() {
+    const std::string path = "recovery_bench_db";
+    const double serial = recover_all(path, false);
+    const double parallel = recover_all(path, true);
+
+    std::cout << "=== Recovery Benchmark: " << NUM_SYMBOLS << " symbols, one WAL, "
+              << NUM_SYMBOLS * ORDERS_PER_SYMBOL << " records ===\n";
+    std::cout << "recover() per engine: " << serial * 1000 << " ms\n";
+    std::cout << "recoverEngines(): " << parallel * 1000 << " ms (" << serial / parallel << "x)\n";
+
+    const SnapshotTimes snapshot = snapshot_round_trip(path);
+    std::cout << "=== Snapshot Benchmark: " << SNAPSHOT_ORDERS << " resting orders ===\n";
+    std::cout << "takeSnapshot(): " << snapshot.save * 1000 << " ms\n";
+    std::cout << "recoverSnapshot(): " << snapshot.restore * 1000 << " ms\n";
+    std::cout << "recover(): " << snapshot.recover * 1000 << " ms\n";
+    return 0;
+}
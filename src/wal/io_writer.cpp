@@ -0,0 +1,362 @@
+#include "io_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define OME_HAVE_IO_URING 1
+#endif
+namespace wal {
+    namespace {
+        constexpr std::size_t kAlignment = 4096;
+    } // namespace
+    // --- Slot bookkeeping and in-order durable release ---
+    IoWriter::IoWriter(const std::size_t slots, const std::size_t slotSize, const bool durableOnWrite)
+        : slots_(slots), slotSize_(slotSize),
+          memory_(static_cast<char*>(std::aligned_alloc(kAlignment, slots * slotSize)), &std::free),
+          durableOnWrite_(durableOnWrite) {
+        if (!memory_) throw std::bad_alloc();
+        for (std::size_t i = 0; i < slots; ++i) {
+            slots_[i].data = memory_.get() + i * slotSize;
+            free_.push_back(slots - 1 - i);
+        }
+    }
+    std::size_t IoWriter::acquire() {
+        std::unique_lock lock(mu_);
+        changed_.wait(lock, [&] { return !free_.empty() || error_ != 0; });
+        if (error_) throw std::system_error(error_, std::generic_category(), "journal write");
+        const std::size_t slot = free_.back();
+        free_.pop_back();
+        return slot;
+    }
+
+    void IoWriter::submit(const std::size_t slot, const int fd, const uint64_t offset, const std::size_t size,
+                          const uint64_t lastSeq, const bool sync, std::shared_ptr<const void> keepAlive) {
+        {
+            std::lock_guard lock(mu_);
+            if (error_) throw std::system_error(error_, std::generic_category(), "journal write");
+            Slot& s = slots_[slot];
+            s.fd = fd;
+            s.offset = offset;
+            s.size = size;
+            s.lastSeq = lastSeq;
+            s.sync = sync;
+            s.done = false;
+            s.error = 0;
+            s.keepAlive = std::move(keepAlive);
+            inFlight_.push_back(slot);
+        }
+        start(slot);
+    }
+    void IoWriter::complete(const std::size_t slot, const int error) {
+        std::lock_guard lock(mu_);
+        slots_[slot].done = true;
+        slots_[slot].error = error;
+        // Release the completed prefix, in submission order.
+        while (!inFlight_.empty() && slots_[inFlight_.front()].done) {
+            Slot& s = slots_[inFlight_.front()];
+            if (s.error && !error_) error_ = s.error;
+            if (!error_) {
+                written_.store(s.lastSeq, std::memory_order_release);
+                // a slot's fdatasync ran after every earlier write, so it covers them too
+                if (s.sync || durableOnWrite_) durable_.store(s.lastSeq, std::memory_order_release);
+            }
+            s.keepAlive.reset();
+            free_.push_back(inFlight_.front());
+            inFlight_.pop_front();
+        }
+        changed_.notify_all();
+    }
+    void IoWriter::waitWritten(const uint64_t seq) {
+        std::unique_lock lock(mu_);
+        changed_.wait(lock, [&] { return written() >= seq || error_ != 0; });
+        if (error_) throw std::system_error(error_, std::generic_category(), "journal write");
+    }
+    void IoWriter::waitDurable(const uint64_t seq) {
+        std::unique_lock lock(mu_);
+        changed_.wait(lock, [&] { return durable() >= seq || error_ != 0; });
+        if (error_) throw std::system_error(error_, std::generic_category(), "journal write");
+    }
+    void IoWriter::markDurable(const uint64_t seq) {
+        {
+            std::lock_guard lock(mu_);
+            if (seq > durable()) durable_.store(seq, std::memory_order_release);
+        }
+        changed_.notify_all();
+    }
+    void IoWriter::drain() {
+        std::unique_lock lock(mu_);
+        changed_.wait(lock, [&] { return inFlight_.empty(); });
+    }
+
+    void IoWriter::throwIfFailed() const {
+        std::lock_guard lock(mu_);
+        if (error_) throw std::system_error(error_, std::generic_category(), "journal write");
+    }
+    // --- Thread-pool fallback ---
+    namespace {
+        class ThreadPoolWriter final : public IoWriter {
+        public:
+            ThreadPoolWriter(std::size_t slots, std::size_t slotSize, bool durableOnWrite, std::size_t threads)
+                : IoWriter(slots, slotSize, durableOnWrite) {
+                for (std::size_t i = 0; i < threads; ++i) workers_.emplace_back([this] { run(); });
+            }
+            ~ThreadPoolWriter() override {
+                drain();
+                {
+                    std::lock_guard lock(queueMu_);
+                    stopping_ = true;
+                }
+                queued_.notify_all();
+                for (auto& worker : workers_) worker.join();
+            }
+            const char* name() const override { return "thread pool"; }
+        protected:
+            void start(const std::size_t slot) override {
+                {
+                    std::lock_guard lock(queueMu_);
+                    ticket_[slot] = nextTicket_;
+                    unwritten_.insert(nextTicket_++);
+                    queue_.push_back(slot);
+                }
+                queued_.notify_one();
+            }
+
+        private:
+            void run() {
+                for (;;) {
+                    std::size_t slot;
+                    uint64_t ticket;
+                    {
+                        std::unique_lock lock(queueMu_);
+                        queued_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+                        if (queue_.empty()) return;
+                        slot = queue_.front();
+                        queue_.pop_front();
+                        ticket = ticket_[slot];
+                    }
+                    const Slot& s = slots_[slot];
+                    int error = 0;
+                    for (std::size_t done = 0; done < s.size && !error;) {
+                        const ssize_t n = ::pwrite(s.fd, s.data + done, s.size - done,
+                                                   static_cast<off_t>(s.offset + done));
+                        if (n > 0) {
+                            done += static_cast<std::size_t>(n);
+                        } else if (n < 0 && errno != EINTR) {
+                            error = errno;
+                        }
+                    }
+                    {
+                        std::unique_lock lock(queueMu_);
+                        unwritten_.erase(ticket);
+                        written_.notify_all();
+                        // fdatasync only covers writes that finished before it, so a sync
+                        // waits for every write submitted ahead of it.
+                        if (s.sync) {
+                            written_.wait(lock, [&] { return unwritten_.empty() || *unwritten_.begin() > ticket; });
+                        }
+                    }
+                    if (!error && s.sync && ::fdatasync(s.fd) != 0) error = errno;
+                    complete(slot, error);
+                }
+            }
+            std::mutex queueMu_;
+            std::condition_variable queued_;
+            std::condition_variable written_;
+            std::deque<std::size_t> queue_;
+            std::vector<uint64_t> ticket_ = std::vector<uint64_t>(slots_.size());   // submission order per slot
+            std::set<uint64_t> unwritten_;
+            uint64_t nextTicket_{0};
+            bool stopping_{false};
+            std::vector<std::thread> workers_;
+        };
+
+#if defined(OME_HAVE_IO_URING)
+        // io_uring through the raw system calls. The submitting thread owns the SQ and a
+        // reaper thread owns the CQ; each slot is one WRITE_FIXED from its registered
+        // buffer, linked to an FDATASYNC when the slot asked for a sync. A syncing write
+        // also drains the ring first, so its fdatasync covers every earlier write.
+        class UringWriter final : public IoWriter {
+        public:
+            UringWriter(std::size_t slots, std::size_t slotSize, bool durableOnWrite)
+                : IoWriter(slots, slotSize, durableOnWrite) {
+                io_uring_params params{};
+                ringFd_ = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned>(2 * slots + 1),
+                                                     &params));
+                if (ringFd_ < 0) throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+                sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+                if (single) sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+                sqRing_ = map(sqRingSize_, IORING_OFF_SQ_RING);
+                cqRing_ = single ? sqRing_ : map(cqRingSize_, IORING_OFF_CQ_RING);
+                sqes_ = static_cast<io_uring_sqe*>(map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+                sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+
+                auto* sq = static_cast<char*>(sqRing_);
+                sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+                sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+                sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+                auto* cq = static_cast<char*>(cqRing_);
+                cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+                cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+                cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+                cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+                std::vector<iovec> buffers(slots);
+                for (std::size_t i = 0; i < slots; ++i) buffers[i] = {slots_[i].data, slotSize};
+                if (::syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_BUFFERS, buffers.data(),
+                              static_cast<unsigned>(slots)) != 0) {
+                    const int error = errno;
+                    release();
+                    throw std::system_error(error, std::generic_category(), "io_uring_register");
+                }
+                pending_.assign(slots, 0);
+                reaper_ = std::thread([this] { reap(); });
+            }
+
+            ~UringWriter() override {
+                drain();
+                io_uring_sqe* sqe = nextSqe();
+                sqe->opcode = IORING_OP_NOP;
+                sqe->user_data = kWake;
+                enter(1);
+                reaper_.join();
+                release();
+            }
+
+            const char* name() const override { return "io_uring"; }
+
+        protected:
+            void start(const std::size_t slot) override {
+                const Slot& s = slots_[slot];
+                pending_[slot] = s.sync ? 2 : 1;
+                io_uring_sqe* write = nextSqe();
+                write->opcode = IORING_OP_WRITE_FIXED;
+                write->fd = s.fd;
+                write->addr = reinterpret_cast<uint64_t>(s.data);
+                write->len = static_cast<uint32_t>(s.size);
+                write->off = s.offset;
+                write->buf_index = static_cast<uint16_t>(slot);
+                write->user_data = slot;
+                if (s.sync) {
+                    write->flags = IOSQE_IO_LINK | IOSQE_IO_DRAIN;
+                    io_uring_sqe* sync = nextSqe();
+                    sync->opcode = IORING_OP_FSYNC;
+                    sync->fd = s.fd;
+                    sync->fsync_flags = IORING_FSYNC_DATASYNC;
+                    sync->user_data = slot;
+                }
+                enter(s.sync ? 2 : 1);
+            }
+        private:
+            static constexpr uint64_t kWake = ~uint64_t{0};
+
+            void* map(std::size_t size, uint64_t offset) {
+                void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_,
+                                 static_cast<off_t>(offset));
+                if (p == MAP_FAILED) {
+                    const int error = errno;
+                    release();
+                    throw std::system_error(error, std::generic_category(), "io_uring mmap");
+                }
+                return p;
+            }
+            void release() {
+                if (sqes_) ::munmap(sqes_, sqesSize_);
+                if (cqRing_ && cqRing_ != sqRing_) ::munmap(cqRing_, cqRingSize_);
+                if (sqRing_) ::munmap(sqRing_, sqRingSize_);
+                if (ringFd_ >= 0) ::close(ringFd_);
+                sqes_ = nullptr;
+                sqRing_ = cqRing_ = nullptr;
+                ringFd_ = -1;
+            }
+            io_uring_sqe* nextSqe() {
+                const unsigned tail = localTail_++;
+                io_uring_sqe* sqe = &sqes_[tail & sqMask_];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqArray_[tail & sqMask_] = tail & sqMask_;
+                return sqe;
+            }
+            void enter(unsigned count) {
+                __atomic_store_n(sqTail_, localTail_, __ATOMIC_RELEASE);
+                while (::syscall(__NR_io_uring_enter, ringFd_, count, 0, 0, nullptr, 0) < 0) {
+                    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                        throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+                    }
+                }
+            }
+
+            void reap() {
+                for (;;) {
+                    unsigned head = __atomic_load_n(cqHead_, __ATOMIC_RELAXED);
+                    const unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+                    if (head == tail) {
+                        ::syscall(__NR_io_uring_enter, ringFd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                        continue;
+                    }
+                    for (; head != tail; ++head) {
+                        const io_uring_cqe& cqe = cqes_[head & cqMask_];
+                        if (cqe.user_data == kWake) {
+                            __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+                            return;
+                        }
+                        const std::size_t slot = static_cast<std::size_t>(cqe.user_data);
+                        int& error = slots_[slot].error;
+                        if (cqe.res < 0 && !error) {
+                            error = -cqe.res;
+                        } else if (cqe.res >= 0 && pending_[slot] == (slots_[slot].sync ? 2 : 1) &&
+                                   static_cast<std::size_t>(cqe.res) != slots_[slot].size && !error) {
+                            error = EIO;   // short write
+                        }
+                        if (--pending_[slot] == 0) complete(slot, error);
+                    }
+                    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+                }
+            }
+
+            int ringFd_{-1};
+            void* sqRing_{nullptr};
+            void* cqRing_{nullptr};
+            io_uring_sqe* sqes_{nullptr};
+            std::size_t sqRingSize_{0};
+            std::size_t cqRingSize_{0};
+            std::size_t sqesSize_{0};
+            unsigned* sqTail_{nullptr};
+            unsigned* sqArray_{nullptr};
+            unsigned sqMask_{0};
+            unsigned localTail_{0};
+            unsigned* cqHead_{nullptr};
+            unsigned* cqTail_{nullptr};
+            unsigned cqMask_{0};
+            io_uring_cqe* cqes_{nullptr};
+            std::vector<int> pending_;   // operations still outstanding per slot; reaper only
+            std::thread reaper_;
+        };
+#endif
+    } // namespace
+    std::unique_ptr<IoWriter> IoWriter::create(const std::size_t slots, const std::size_t slotSize,
+                                               const bool durableOnWrite) {
+#if defined(OME_HAVE_IO_URING)
+        try {
+            return std::make_unique<UringWriter>(slots, slotSize, durableOnWrite);
+        } catch (const std::system_error&) {
+            // no io_uring (old kernel, seccomp, io_uring_disabled): fall back below
+        }
+#endif
+        return std::make_unique<ThreadPoolWriter>(slots, slotSize, durableOnWrite, 2);
+    }
+
+} // namespace wal
@@ -0,0 +1,97 @@
+#ifndef OME_IO_WRITER_H
+#define OME_IO_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace wal {
+
+    // Asynchronous positional writer with completion-driven durable release. The
+    // caller fills one of a fixed set of write slots (pinned buffers), submits it with
+    // the last sequence it carries, and moves on. written() advances to that sequence
+    // once the slot and every slot submitted before it have completed; durable() only
+    // does so when the slot's fdatasync completed too (or a later markDurable() covers
+    // it), unless the writer was created durableOnWrite for a journal that never syncs.
+    // Up to `slots` writes are in flight at once.
+    //
+    // create() uses io_uring (registered buffers, write linked to fdatasync) when the
+    // kernel allows it and falls back to a small thread pool doing pwrite + fdatasync.
+    //
+    // acquire()/submit() must be serialized by the caller; durable() and waitDurable()
+    // may be called from any thread. An I/O error is sticky: every later call throws.
+    class IoWriter {
+    public:
+        static std::unique_ptr<IoWriter> create(std::size_t slots, std::size_t slotSize, bool durableOnWrite);
+        virtual ~IoWriter() = default;
+        IoWriter(const IoWriter&) = delete;
+
+        // Returns a free slot, waiting for a completion if every slot is in flight.
+        std::size_t acquire();
+        char* buffer(std::size_t slot) { return slots_[slot].data; }
+        std::size_t slotSize() const { return slotSize_; }
+
+        // Writes the first size bytes of the slot at offset of fd. keepAlive is held
+        // until the write completes (e.g. the owner of fd).
+        void submit(std::size_t slot, int fd, uint64_t offset, std::size_t size, uint64_t lastSeq, bool sync,
+                    std::shared_ptr<const void> keepAlive);
+
+        uint64_t written() const { return written_.load(std::memory_order_acquire); }
+        uint64_t durable() const { return durable_.load(std::memory_order_acquire); }
+        void waitWritten(uint64_t seq);
+        void waitDurable(uint64_t seq);
+        // Records an fdatasync the caller issued itself, started after written() had
+        // reached seq.
+        void markDurable(uint64_t seq);
+        // Waits until nothing is in flight.
+        void drain();
+
+        virtual const char* name() const = 0;
+
+    protected:
+        struct Slot {
+            char* data{nullptr};
+            int fd{-1};
+            uint64_t offset{0};
+            std::size_t size{0};
+            uint64_t lastSeq{0};
+            bool sync{false};
+            bool done{false};
+            int error{0};
+            std::shared_ptr<const void> keepAlive;
+        };
+
+        IoWriter(std::size_t slots, std::size_t slotSize, bool durableOnWrite);
+
+        // Starts the I/O of a submitted slot; called with no lock held.
+        virtual void start(std::size_t slot) = 0;
+        // Called by the implementation when a slot's last operation finished (error is
+        // 0 or an errno value).
+        void complete(std::size_t slot, int error);
+        void throwIfFailed() const;
+
+        std::vector<Slot> slots_;
+
+    private:
+        std::size_t slotSize_;
+        std::unique_ptr<char, void (*)(void*)> memory_;
+
+        mutable std::mutex mu_;
+        std::condition_variable changed_;
+        std::vector<std::size_t> free_;
+        std::deque<std::size_t> inFlight_;   // submission order
+        int error_{0};
+        const bool durableOnWrite_;
+        std::atomic<uint64_t> written_{0};
+        std::atomic<uint64_t> durable_{0};
+    };
+
+} // namespace wal
+
+#endif // OME_IO_WRITER_H
@@ -0,0 +1,119 @@
+#ifndef OME_JOURNAL_H
+#define OME_JOURNAL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <span>
+#include <string_view>
+
+namespace wal {
+
+    struct WalStats {
+        uint64_t records{0};
+        uint64_t groups{0};   // backend writes; concurrent appends share one
+        uint64_t syncs{0};
+    };
+
+    // How the sequences a journal is given are allocated.
+    enum class SequenceOrder {
+        Increasing,   // strictly increasing across appends, with gaps (outbound processed marks)
+        Dense         // allocated up front by WalManager, possibly appended by several threads
+                      // out of order; every sequence is appended once (inbound commands)
+    };
+
+    // Append-only log of opaque records keyed by strictly increasing sequence numbers.
+    // WalManager keeps one for inbound commands and one for outbound events. Every
+    // backend honours WalOptions::durability and lets concurrent append() calls share
+    // writes and syncs; append() returns once its records are durable per that mode.
+    class Journal {
+    public:
+        struct Entry {
+            uint64_t seq;
+            std::string_view record;
+        };
+        // Gets each record in sequence order; the view is only valid during the call.
+        // Returning false stops the scan.
+        using Visitor = std::function<bool(uint64_t seq, std::string_view record)>;
+
+        virtual ~Journal() = default;
+
+        // A batch that is not strictly increasing, or does not start above every sequence
+        // appended before, throws std::invalid_argument and appends none of its records.
+        virtual void append(std::span<const Entry> entries) = 0;
+        // Queues the records and returns without waiting for them to become durable;
+        // durableSequence() reports when they are. Backends without asynchronous
+        // writes simply append.
+        virtual void appendAsync(std::span<const Entry> entries) { append(entries); }
+        // Forces everything appended so far to stable storage.
+        virtual void sync() = 0;
+
+        // Highest sequence appended, 0 if the journal is empty.
+        virtual uint64_t lastSequence() const = 0;
+        // Highest sequence that, with everything before it, is durable per the mode.
+        virtual uint64_t durableSequence() const { return lastSequence(); }
+        virtual void waitDurable(uint64_t seq) { (void)seq; }
+        virtual bool contains(uint64_t seq) const = 0;
+        // Visits every record with seq >= from.
+        virtual void scan(uint64_t from, const Visitor& visit) const = 0;
+        // Drops records with seq < before. Backends may keep some of them (segments go
+        // whole); safe to call while others append.
+        virtual void truncateBefore(uint64_t before) = 0;
+
+        virtual WalStats stats() const = 0;
+    };
+
+    // Admits the records of a Dense journal in sequence order. A writer whose next
+    // record is ahead of the log waits, under the journal's lock, for the writers of
+    // the records before it. Sequences of a batch the journal rejected are skipped, so
+    // nobody waits for them. Increasing journals never wait.
+    class SequenceGate {
+    public:
+        explicit SequenceGate(SequenceOrder order) : dense_(order == SequenceOrder::Dense) {}
+
+        // Starts after the last sequence found on disk.
+        void reset(uint64_t last) { next_ = last + 1; }
+        // Lowest sequence that may still be appended.
+        uint64_t next() const { return next_; }
+        // Waits until seq is next in line, or stop() turns true.
+        template <typename Stop>
+        void wait(std::unique_lock<std::mutex>& lock, uint64_t seq, Stop stop) {
+            if (dense_) turn_.wait(lock, [&] { return next_ >= seq || stop(); });
+        }
+        void appended(uint64_t seq) {
+            next_ = seq + 1;
+            if (!dense_) return;
+            skipRejected();
+            turn_.notify_all();
+        }
+        // Dense only: the seqs of a refused batch are skipped rather than waited for.
+        void rejected(std::span<const Journal::Entry> entries) {
+            if (!dense_) return;
+            for (const auto& entry : entries) {
+                if (entry.seq >= next_) rejected_.insert(entry.seq);
+            }
+            skipRejected();
+            turn_.notify_all();
+        }
+        // Wakes every waiter, e.g. after the journal failed.
+        void wakeAll() { turn_.notify_all(); }
+
+    private:
+        void skipRejected() {
+            while (!rejected_.empty() && *rejected_.begin() <= next_) {
+                if (*rejected_.begin() == next_) ++next_;
+                rejected_.erase(rejected_.begin());
+            }
+        }
+
+        const bool dense_;
+        uint64_t next_{1};
+        std::set<uint64_t> rejected_;
+        std::condition_variable turn_;
+    };
+
+} // namespace wal
+
+#endif // OME_JOURNAL_H
@@ -0,0 +1,130 @@
+#include "rocks_journal.h"
+#include "wal_record.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+namespace wal {
+
+    RocksJournal::RocksJournal(rocksdb::DB* db, rocksdb::ColumnFamilyHandle* cf, const WalOptions& options,
+                               const SequenceOrder order)
+        : db_(db), cf_(cf), manualWalFlush_(options.rocksProfile == RocksProfile::GroupCommit),
+          dense_(order == SequenceOrder::Dense), gate_(order), syncPolicy_(options) {
+        const std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(rocksdb::ReadOptions(), cf_));
+        it->SeekToLast();
+        if (it->Valid()) last_ = seqFromKey(it->key().ToStringView());
+        gate_.reset(last_);
+    }
+
+    void RocksJournal::append(const std::span<const Entry> entries) {
+        if (entries.empty()) return;
+        std::unique_lock lock(mu_);
+        if (!failed_.ok()) throw std::runtime_error("WAL write failed: " + failed_.ToString());
+        // The whole batch is checked before any of it joins a group. Keys sort themselves,
+        // but the durable watermark must not pass a record still on its way, and a
+        // rewritten key would replace a record: records join the groups in sequence order.
+        uint64_t prev = gate_.next() - 1;
+        for (const auto& entry : entries) {
+            if (entry.seq <= prev) {
+                gate_.rejected(entries);
+                throw std::invalid_argument("RocksJournal: sequence out of order");
+            }
+            prev = entry.seq;
+        }
+        for (const auto& entry : entries) {
+            gate_.wait(lock, entry.seq, [this] { return !failed_.ok(); });
+            if (!failed_.ok()) throw std::runtime_error("WAL write failed: " + failed_.ToString());
+            if (dense_ && entry.seq < gate_.next()) {
+                throw std::invalid_argument("RocksJournal: sequence appended twice");
+            }
+            const SeqKey key = seqKey(entry.seq);
+            groups_[openGroup_].Put(cf_, rocksdb::Slice(key.data(), key.size()),
+                                    rocksdb::Slice(entry.record.data(), entry.record.size()));
+            openLast_ = std::max(openLast_, entry.seq);
+            ++openRecords_;
+            gate_.appended(entry.seq);
+        }
+        const uint64_t group = openGroupId_;
+        committed_.wait(lock, [&] { return doneGroupId_ >= group || !leaderActive_; });
+
+        if (doneGroupId_ < group) {
+            // Leader: take everything queued so far; new writers fill the other batch meanwhile.
+            leaderActive_ = true;
+            rocksdb::WriteBatch& batch = groups_[openGroup_];
+            openGroup_ ^= 1;
+            const uint64_t last = openGroupId_++;
+            const uint64_t groupRecords = openRecords_;
+            const uint64_t groupLast = openLast_;
+            openRecords_ = 0;
+            lock.unlock();
+
+            const bool sync = syncPolicy_.due(groupRecords);
+            rocksdb::WriteOptions writeOptions;
+            writeOptions.sync = sync && !manualWalFlush_;
+            rocksdb::Status s = db_->Write(writeOptions, &batch);
+            if (s.ok() && manualWalFlush_) s = db_->FlushWAL(sync);
+            batch.Clear();
+
+            lock.lock();
+            stats_.records += groupRecords;
+            ++stats_.groups;
+            if (sync) ++stats_.syncs;
+            if (s.ok()) {
+                if (groupLast > last_.load(std::memory_order_relaxed)) {
+                    last_.store(groupLast, std::memory_order_release);
+                }
+            } else {
+                failed_ = s;
+                gate_.wakeAll();
+            }
+            doneGroupId_ = last;
+            leaderActive_ = false;
+            committed_.notify_all();
+        }
+        if (!failed_.ok()) throw std::runtime_error("WAL write failed: " + failed_.ToString());
+    }
+
+    void RocksJournal::sync() {
+        // SyncWAL does not write out what manual_wal_flush still buffers.
+        auto s = manualWalFlush_ ? db_->FlushWAL(true) : db_->SyncWAL();
+        if (!s.ok()) throw std::runtime_error("WAL sync failed: " + s.ToString());
+        std::lock_guard lock(mu_);
+        ++stats_.syncs;
+    }
+
+    bool RocksJournal::contains(const uint64_t seq) const {
+        const SeqKey key = seqKey(seq);
+        std::string value;
+        return db_->Get(rocksdb::ReadOptions(), cf_, rocksdb::Slice(key.data(), key.size()), &value).ok();
+    }
+
+    void RocksJournal::scan(const uint64_t from, const Visitor& visit) const {
+        // A scan reads the log once, front to back: read ahead and keep it out of the block cache.
+        rocksdb::ReadOptions readOptions;
+        readOptions.readahead_size = 2 << 20;
+        readOptions.fill_cache = false;
+        const std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(readOptions, cf_));
+        const SeqKey start = seqKey(from);
+        for (it->Seek(rocksdb::Slice(start.data(), start.size())); it->Valid(); it->Next()) {
+            if (!visit(seqFromKey(it->key().ToStringView()), it->value().ToStringView())) return;
+        }
+        if (!it->status().ok()) throw std::runtime_error("WAL scan failed: " + it->status().ToString());
+    }
+
+    void RocksJournal::truncateBefore(const uint64_t before) {
+        if (before == 0) return;
+        const SeqKey begin = seqKey(0);
+        const SeqKey end = seqKey(before);
+        const rocksdb::Status s = db_->DeleteRange(rocksdb::WriteOptions(), cf_,
+                                                   rocksdb::Slice(begin.data(), begin.size()),
+                                                   rocksdb::Slice(end.data(), end.size()));
+        if (!s.ok()) throw std::runtime_error("WAL truncate failed: " + s.ToString());
+    }
+
+    WalStats RocksJournal::stats() const {
+        std::lock_guard lock(mu_);
+        return stats_;
+    }
+
+} // namespace wal
@@ -0,0 +1,64 @@
+#ifndef OME_ROCKS_JOURNAL_H
+#define OME_ROCKS_JOURNAL_H
+
+#include <rocksdb/db.h>
+#include <rocksdb/write_batch.h>
+#include "journal.h"
+#include "wal_options.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace wal {
+
+    // Journal stored in one RocksDB column family, keyed by seqKey(seq).
+    //
+    // Writes go through a leader/follower group commit: callers add their records to
+    // the open group, and the first one that finds no write in flight writes the whole
+    // group as one WriteBatch with at most one fsync. Records of a Dense journal join
+    // the groups in sequence order (SequenceGate). Under RocksProfile::GroupCommit the
+    // DB buffers its WAL (manual_wal_flush) and the leader flushes it once per group. A
+    // failed write makes the journal fail-stop for every later caller.
+    class RocksJournal final : public Journal {
+    public:
+        // db and cf are borrowed and must outlive the journal.
+        RocksJournal(rocksdb::DB* db, rocksdb::ColumnFamilyHandle* cf, const WalOptions& options,
+                     SequenceOrder order = SequenceOrder::Increasing);
+        RocksJournal(const RocksJournal&) = delete;
+
+        void append(std::span<const Entry> entries) override;
+        void sync() override;
+        uint64_t lastSequence() const override { return last_.load(std::memory_order_acquire); }
+        bool contains(uint64_t seq) const override;
+        void scan(uint64_t from, const Visitor& visit) const override;
+        void truncateBefore(uint64_t before) override;
+        WalStats stats() const override;
+
+    private:
+        rocksdb::DB* db_;
+        rocksdb::ColumnFamilyHandle* cf_;
+        const bool manualWalFlush_;
+        const bool dense_;
+        std::atomic<uint64_t> last_{0};
+
+        // group commit, guarded by mu_
+        mutable std::mutex mu_;
+        std::condition_variable committed_;
+        rocksdb::WriteBatch groups_[2];   // the open group and the one being written
+        int openGroup_{0};
+        uint64_t openGroupId_{1};
+        uint64_t doneGroupId_{0};
+        uint64_t openRecords_{0};
+        uint64_t openLast_{0};
+        bool leaderActive_{false};
+        SequenceGate gate_;
+        rocksdb::Status failed_;          // sticky
+        WalStats stats_;
+
+        SyncPolicy syncPolicy_;           // leader only
+    };
+
+} // namespace wal
+
+#endif // OME_ROCKS_JOURNAL_H
@@ -0,0 +1,432 @@
+#include "segment_journal.h"
+#include "wal_record.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace wal {
+
+    namespace {
+        struct FrameHeader {
+            uint32_t length;
+            uint32_t crc;
+            uint64_t seq;
+        };
+        static_assert(sizeof(FrameHeader) == 16);
+
+        [[noreturn]] void throwErrno(const std::string& what) {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        void syncDirectory(const std::string& dir) {
+            const int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+            if (dirFd >= 0) {
+                ::fsync(dirFd);
+                ::close(dirFd);
+            }
+        }
+
+        uint32_t frameCrc(uint64_t seq, const char* record, std::size_t length) {
+            return crc32c(crc32c(0, &seq, sizeof(seq)), record, length);
+        }
+
+        // Reads the frame at offset; returns its size, or 0 at the end of the segment.
+        std::size_t readFrame(const char* base, std::size_t size, std::size_t offset, uint64_t prevSeq,
+                              FrameHeader& header) {
+            if (offset + sizeof(FrameHeader) > size) return 0;
+            std::memcpy(&header, base + offset, sizeof(header));
+            const std::size_t frame = sizeof(FrameHeader) + header.length;
+            if (header.length == 0 || header.length > size - offset - sizeof(FrameHeader)) return 0;
+            if (header.seq <= prevSeq) return 0;
+            if (frameCrc(header.seq, base + offset + sizeof(FrameHeader), header.length) != header.crc) return 0;
+            return frame;
+        }
+    } // namespace
+
+    struct SegmentJournal::Segment {
+        int fd{-1};
+        char* base{nullptr};
+        std::size_t size{0};
+
+        Segment(const std::string& path, std::size_t preallocate, bool writable) {
+            fd = ::open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+            if (fd < 0) throwErrno("open " + path);
+            struct stat st{};
+            if (::fstat(fd, &st) != 0) throwErrno("stat " + path);
+            size = static_cast<std::size_t>(st.st_size);
+            if (writable && size < preallocate) {
+                if (::posix_fallocate(fd, 0, static_cast<off_t>(preallocate)) != 0 &&
+                    ::ftruncate(fd, static_cast<off_t>(preallocate)) != 0) {
+                    throwErrno("preallocate " + path);
+                }
+                size = preallocate;
+            }
+            if (size == 0) return;
+            void* map = ::mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED) throwErrno("mmap " + path);
+            base = static_cast<char*>(map);
+            if (!writable) ::madvise(base, size, MADV_SEQUENTIAL);
+        }
+        Segment(const Segment&) = delete;
+        ~Segment() {
+            if (base) ::munmap(base, size);
+            if (fd >= 0) ::close(fd);
+        }
+    };
+
+    SegmentJournal::SegmentJournal(std::string dir, const WalOptions& options, const SequenceOrder order)
+        : dir_(std::move(dir)), options_(options),
+          writer_(options.segmentIo == SegmentIo::Uring ? IoWriter::create(options.ioSlots, options.ioSlotSize,
+                                                                           options.durability == Durability::Async)
+                                                         : nullptr),
+          gate_(order), syncPolicy_(options) {
+        static const std::size_t kPage = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        if (options_.segmentSize < kPage || options_.segmentSize % kPage != 0) {
+            throw std::invalid_argument("SegmentJournal: segmentSize must be a non-zero multiple of the page size");
+        }
+        if (writer_ && options_.ioSlotSize < kPage) {
+            throw std::invalid_argument("SegmentJournal: ioSlotSize must be at least one page");
+        }
+        std::filesystem::create_directories(dir_);
+        for (const auto& file : std::filesystem::directory_iterator(dir_)) {
+            if (file.path().extension() != ".seg") continue;
+            segments_.push_back(std::stoull(file.path().stem().string()));
+        }
+        std::sort(segments_.begin(), segments_.end());
+        if (segments_.empty()) return;
+
+        // Find the write position in the newest segment and the last sequence written.
+        first_ = segments_.front();
+        active_ = std::make_shared<Segment>(segmentPath(segments_.back()), options_.segmentSize, true);
+        FrameHeader header;
+        uint64_t last = 0;
+        while (const std::size_t frame = readFrame(active_->base, active_->size, tail_, last, header)) {
+            tail_ += frame;
+            last = header.seq;
+        }
+        for (auto it = segments_.rbegin() + 1; last == 0 && it != segments_.rend(); ++it) {
+            const Segment older(segmentPath(*it), 0, false);
+            for (std::size_t offset = 0;
+                 const std::size_t frame = readFrame(older.base, older.size, offset, last, header);
+                 offset += frame) {
+                last = header.seq;
+            }
+        }
+        // Clear what a torn tail left behind, up to the first untouched page, so those bytes
+        // cannot pass for frames once new records end exactly where they start.
+        for (std::size_t offset = tail_; offset < active_->size;) {
+            const std::size_t end = std::min(active_->size, (offset / kPage + 1) * kPage);
+            char* from = active_->base + offset;
+            const bool dirty = std::any_of(from, active_->base + end, [](char c) { return c != 0; });
+            if (!dirty && offset % kPage == 0) break;
+            if (dirty) std::memset(from, 0, end - offset);
+            offset = end;
+        }
+        last_ = last;
+        openedLast_ = last;
+        gate_.reset(last);
+        activeStart_ = static_cast<uint64_t>(segments_.size() - 1) * options_.segmentSize;
+        syncedPosition_ = activeStart_ + tail_;
+    }
+
+    SegmentJournal::~SegmentJournal() {
+        if (writer_) {
+            writer_->drain();
+            if (active_ && options_.durability != Durability::Async) ::fdatasync(active_->fd);
+        } else if (active_ && options_.durability != Durability::Async) {
+            ::msync(active_->base, active_->size, MS_SYNC);
+        }
+    }
+
+    std::string SegmentJournal::segmentPath(const uint64_t firstSeq) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%020" PRIu64 ".seg", firstSeq);
+        return dir_ + "/" + name;
+    }
+
+    void SegmentJournal::append(const std::span<const Entry> entries) {
+        if (entries.empty()) return;
+        if (writer_) {
+            // Returns once written; durable too when this commit carried the sync.
+            if (submit(entries)) {
+                writer_->waitDurable(entries.back().seq);
+            } else {
+                writer_->waitWritten(entries.back().seq);
+            }
+            return;
+        }
+        std::unique_lock lock(mu_);
+        admit(entries, options_.segmentSize);
+        try {
+            for (const auto& entry : entries) {
+                awaitTurn(lock, entry);
+                const std::size_t frame = sizeof(FrameHeader) + entry.record.size();
+                if (!active_ || tail_ + frame > active_->size) roll(entry.seq);
+
+                char* out = active_->base + tail_;
+                const FrameHeader header{static_cast<uint32_t>(entry.record.size()),
+                                         frameCrc(entry.seq, entry.record.data(), entry.record.size()), entry.seq};
+                std::memcpy(out + sizeof(FrameHeader), entry.record.data(), entry.record.size());
+                std::memcpy(out, &header, sizeof(header));
+                tail_ += frame;
+                appended(entry.seq);
+            }
+        } catch (...) {
+            fail();
+            throw;
+        }
+        stats_.records += entries.size();
+        ++stats_.groups;
+        const bool sync = syncPolicy_.due(entries.size());
+        const uint64_t end = activeStart_ + tail_;
+        lock.unlock();
+
+        if (sync) syncTo(end);
+    }
+
+    void SegmentJournal::appendAsync(const std::span<const Entry> entries) {
+        if (!writer_) return append(entries);
+        if (entries.empty()) return;
+        submit(entries);
+    }
+
+    // Uring mode: frames entries into slots and submits them; returns whether the
+    // last slot carries an fdatasync.
+    bool SegmentJournal::submit(const std::span<const Entry> entries) {
+        std::unique_lock lock(mu_);
+        admit(entries, std::min(options_.segmentSize, writer_->slotSize()));
+        bool sync;
+        try {
+            for (const auto& entry : entries) {
+                awaitTurn(lock, entry);
+                const std::size_t frame = sizeof(FrameHeader) + entry.record.size();
+                if (!active_ || tail_ + frame > active_->size) {
+                    // fdatasync is per file: the old segment's last write carries its sync
+                    if (slotOpen_) submitSlot(options_.durability != Durability::Async);
+                    roll(entry.seq);
+                }
+                if (slotOpen_ && slotUsed_ + frame > writer_->slotSize()) submitSlot(false);
+                if (!slotOpen_) {
+                    slot_ = writer_->acquire();
+                    slotOpen_ = true;
+                    slotUsed_ = 0;
+                    slotOffset_ = tail_;
+                }
+
+                char* out = writer_->buffer(slot_) + slotUsed_;
+                const FrameHeader header{static_cast<uint32_t>(entry.record.size()),
+                                         frameCrc(entry.seq, entry.record.data(), entry.record.size()), entry.seq};
+                std::memcpy(out, &header, sizeof(header));
+                std::memcpy(out + sizeof(FrameHeader), entry.record.data(), entry.record.size());
+                slotUsed_ += frame;
+                slotLast_ = entry.seq;
+                tail_ += frame;
+                appended(entry.seq);
+            }
+            stats_.records += entries.size();
+            ++stats_.groups;
+            sync = syncPolicy_.due(entries.size());
+            submitSlot(sync);
+        } catch (...) {
+            fail();
+            throw;
+        }
+        return sync;
+    }
+
+    // Called with mu_ held: checks the whole batch before any of it is written, so a
+    // rejected batch leaves no frames behind.
+    void SegmentJournal::admit(const std::span<const Entry> entries, const std::size_t maxFrame) {
+        if (failed_) throw std::runtime_error("SegmentJournal: an earlier write failed");
+        const char* error = nullptr;
+        uint64_t prev = gate_.next() - 1;
+        for (const auto& entry : entries) {
+            if (entry.record.empty() || sizeof(FrameHeader) + entry.record.size() > maxFrame) {
+                error = "SegmentJournal: record does not fit a segment";
+            } else if (entry.seq <= prev) {
+                error = "SegmentJournal: sequence out of order";
+            }
+            if (error) break;
+            prev = entry.seq;
+        }
+        if (error) {
+            gate_.rejected(entries);
+            throw std::invalid_argument(error);
+        }
+    }
+
+    // Called with mu_ held: waits for the records before entry (Dense journals).
+    void SegmentJournal::awaitTurn(std::unique_lock<std::mutex>& lock, const Entry& entry) {
+        gate_.wait(lock, entry.seq, [this] { return failed_; });
+        if (failed_) throw std::runtime_error("SegmentJournal: an earlier write failed");
+        // Another writer was handed the same sequence.
+        if (entry.seq < gate_.next()) throw std::invalid_argument("SegmentJournal: sequence appended twice");
+    }
+
+    void SegmentJournal::appended(const uint64_t seq) {
+        if (first_ == 0) first_ = seq;
+        last_.store(seq, std::memory_order_release);
+        gate_.appended(seq);
+    }
+
+    // Called with mu_ held after a write failed part way: the log may now end before
+    // sequences other writers wait for, so every later append fails instead.
+    void SegmentJournal::fail() {
+        failed_ = true;
+        gate_.wakeAll();
+    }
+
+    // Called with mu_ held: hands the open slot to the writer.
+    void SegmentJournal::submitSlot(const bool sync) {
+        writer_->submit(slot_, active_->fd, slotOffset_, slotUsed_, slotLast_, sync, active_);
+        slotOpen_ = false;
+        if (sync) ++stats_.syncs;
+    }
+
+    uint64_t SegmentJournal::durableSequence() const {
+        if (!writer_) return lastSequence();
+        return std::max(writer_->durable(), openedLast_);
+    }
+
+    void SegmentJournal::waitDurable(const uint64_t seq) {
+        if (writer_ && seq > openedLast_) writer_->waitDurable(seq);
+    }
+
+    // Called with mu_ held. The finished segment is synced here (or by its last write in
+    // Uring mode) unless the journal is async, so syncs only ever cover the active segment.
+    void SegmentJournal::roll(const uint64_t firstSeq) {
+        if (active_) {
+            if (!writer_ && options_.durability != Durability::Async &&
+                ::msync(active_->base, tail_, MS_SYNC) != 0) {
+                throwErrno("msync " + segmentPath(segments_.back()));
+            }
+            activeStart_ += active_->size;
+        }
+        active_ = std::make_shared<Segment>(segmentPath(firstSeq), options_.segmentSize, true);
+        tail_ = 0;
+        segments_.push_back(firstSeq);
+        // make the new directory entry durable too
+        if (options_.durability != Durability::Async) syncDirectory(dir_);
+    }
+
+    void SegmentJournal::syncTo(const uint64_t position) {
+        std::lock_guard syncLock(syncMu_);
+        if (syncedPosition_ >= position) return;   // a later writer's sync already covered it
+
+        std::shared_ptr<Segment> segment;
+        uint64_t start;
+        uint64_t end;
+        {
+            std::lock_guard lock(mu_);
+            segment = active_;
+            start = activeStart_;
+            end = activeStart_ + tail_;
+        }
+        if (!segment) return;
+        static const std::size_t kPage = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        const std::size_t from = (syncedPosition_ > start ? syncedPosition_ - start : 0) & ~(kPage - 1);
+        if (::msync(segment->base + from, (end - start) - from, MS_SYNC) != 0) throwErrno("msync " + dir_);
+        syncedPosition_ = end;
+
+        std::lock_guard lock(mu_);
+        ++stats_.syncs;
+    }
+
+    void SegmentJournal::sync() {
+        if (writer_) {
+            // Everything written() reports lies in the active segment or in older ones,
+            // which were synced when the journal rolled past them.
+            writer_->drain();
+            std::shared_ptr<Segment> segment;
+            uint64_t written;
+            {
+                std::lock_guard lock(mu_);
+                segment = active_;
+                written = writer_->written();
+            }
+            if (segment && ::fdatasync(segment->fd) != 0) throwErrno("fdatasync " + dir_);
+            writer_->markDurable(written);
+            std::lock_guard lock(mu_);
+            ++stats_.syncs;
+            return;
+        }
+        uint64_t end;
+        {
+            std::lock_guard lock(mu_);
+            end = activeStart_ + tail_;
+        }
+        syncTo(end);
+    }
+
+    bool SegmentJournal::contains(const uint64_t seq) const {
+        std::lock_guard lock(mu_);
+        return first_ != 0 && seq >= first_ && seq <= last_.load(std::memory_order_relaxed);
+    }
+
+    void SegmentJournal::scan(const uint64_t from, const Visitor& visit) const {
+        std::vector<uint64_t> segments;
+        {
+            std::lock_guard lock(mu_);
+            segments = segments_;
+        }
+        const uint64_t last = lastSequence();
+        // Start at the last segment whose first sequence is <= from.
+        auto it = std::upper_bound(segments.begin(), segments.end(), from);
+        if (it != segments.begin()) --it;
+
+        uint64_t prev = 0;
+        for (; it != segments.end(); ++it) {
+            std::unique_ptr<Segment> segment;
+            try {
+                segment = std::make_unique<Segment>(segmentPath(*it), 0, false);
+            } catch (const std::system_error& e) {
+                // truncateBefore() unlinked it after the list was taken
+                if (e.code() == std::errc::no_such_file_or_directory) continue;
+                throw;
+            }
+            FrameHeader header;
+            for (std::size_t offset = 0;
+                 const std::size_t frame = readFrame(segment->base, segment->size, offset, prev, header);
+                 offset += frame) {
+                if (header.seq > last) return;
+                prev = header.seq;
+                if (header.seq < from) continue;
+                const std::string_view record(segment->base + offset + sizeof(FrameHeader), header.length);
+                if (!visit(header.seq, record)) return;
+            }
+        }
+    }
+
+    // A segment goes once the next one starts at or below `before`; the active segment stays.
+    void SegmentJournal::truncateBefore(const uint64_t before) {
+        std::vector<uint64_t> dropped;
+        {
+            std::lock_guard lock(mu_);
+            std::size_t n = 0;
+            while (n + 1 < segments_.size() && segments_[n + 1] <= before) ++n;
+            if (n == 0) return;
+            dropped.assign(segments_.begin(), segments_.begin() + static_cast<std::ptrdiff_t>(n));
+            segments_.erase(segments_.begin(), segments_.begin() + static_cast<std::ptrdiff_t>(n));
+            first_ = segments_.front();
+        }
+        for (const uint64_t firstSeq : dropped) ::unlink(segmentPath(firstSeq).c_str());
+        if (options_.durability != Durability::Async) syncDirectory(dir_);
+    }
+
+    WalStats SegmentJournal::stats() const {
+        std::lock_guard lock(mu_);
+        return stats_;
+    }
+
+} // namespace wal
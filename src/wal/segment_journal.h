@@ -0,0 +1,100 @@
+#ifndef OME_SEGMENT_JOURNAL_H
+#define OME_SEGMENT_JOURNAL_H
+
+#include "io_writer.h"
+#include "journal.h"
+#include "wal_options.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace wal {
+
+    // Native journal backend: a directory of preallocated segment files of
+    // WalOptions::segmentSize bytes, each named after the first sequence it holds and
+    // written through a shared memory mapping. Records are framed as
+    // [length:4][crc32c:4][seq:8][record]; the CRC covers seq and record. The first
+    // frame that is empty, torn or out of sequence ends a segment, so preallocated
+    // zeros and a half-written tail both read as the end of the log.
+    //
+    // An append is a memcpy into the mapping under a short lock. Syncs (msync of the
+    // dirty range) run outside it and are shared: a writer whose bytes another writer's
+    // sync already covered returns without syncing. Replay maps each segment read-only
+    // and hands out views into the mapping, so it copies nothing.
+    //
+    // With WalOptions::segmentIo == Uring, frames are instead built in IoWriter slots
+    // and written with pwrite-style I/O, each commit's slot linked to its fdatasync.
+    // appendAsync() returns once the slot is submitted; the journal thread keeps up to
+    // ioSlots writes in flight and durableSequence() follows the completions of the
+    // ones that carried an fdatasync (every write's, under Durability::Async).
+    //
+    // Sequences must be strictly increasing across appends (SequenceOrder says whether
+    // concurrent writers wait for each other); a batch is checked whole before any of
+    // it is written. A write that fails part way fails every later append. contains()
+    // treats every sequence between the first and the last record as present.
+    // truncateBefore() unlinks whole segments, never the active one.
+    class SegmentJournal final : public Journal {
+    public:
+        SegmentJournal(std::string dir, const WalOptions& options, SequenceOrder order = SequenceOrder::Increasing);
+        SegmentJournal(const SegmentJournal&) = delete;
+        ~SegmentJournal() override;
+
+        void append(std::span<const Entry> entries) override;
+        void appendAsync(std::span<const Entry> entries) override;
+        void sync() override;
+        uint64_t lastSequence() const override { return last_.load(std::memory_order_acquire); }
+        uint64_t durableSequence() const override;
+        void waitDurable(uint64_t seq) override;
+        bool contains(uint64_t seq) const override;
+        void scan(uint64_t from, const Visitor& visit) const override;
+        void truncateBefore(uint64_t before) override;
+        WalStats stats() const override;
+
+    private:
+        struct Segment;
+
+        std::string segmentPath(uint64_t firstSeq) const;
+        void roll(uint64_t firstSeq);
+        void syncTo(uint64_t position);
+        bool submit(std::span<const Entry> entries);
+        void admit(std::span<const Entry> entries, std::size_t maxFrame);
+        void awaitTurn(std::unique_lock<std::mutex>& lock, const Entry& entry);
+        void appended(uint64_t seq);
+        void fail();
+        void submitSlot(bool sync);
+
+        const std::string dir_;
+        const WalOptions options_;
+        std::unique_ptr<IoWriter> writer_;   // null in Mmap mode
+        uint64_t openedLast_{0};             // last sequence found on disk at open
+
+        // guarded by mu_
+        mutable std::mutex mu_;
+        std::vector<uint64_t> segments_;     // first sequence of every segment, ascending
+        std::shared_ptr<Segment> active_;
+        std::size_t tail_{0};                // write offset in active_
+        uint64_t activeStart_{0};            // log position of active_'s first byte
+        uint64_t first_{0};
+        SequenceGate gate_;
+        bool failed_{false};
+        WalStats stats_;
+        SyncPolicy syncPolicy_;
+        std::atomic<uint64_t> last_{0};
+        // slot being filled in Uring mode
+        bool slotOpen_{false};
+        std::size_t slot_{0};
+        std::size_t slotUsed_{0};
+        std::size_t slotOffset_{0};          // offset of the slot's first byte in active_
+        uint64_t slotLast_{0};
+
+        // guarded by syncMu_
+        std::mutex syncMu_;
+        uint64_t syncedPosition_{0};
+    };
+
+} // namespace wal
+
+#endif // OME_SEGMENT_JOURNAL_H
@@ -1,21 +1,123 @@
 #include "wal_manager.h"
+#include "rocks_journal.h"
+#include "segment_journal.h"
+#include "wal_record.h"
+#include "../engine/messages_json.h"
+#include "../engine/spsc_ring.h"
 #include <rocksdb/utilities/options_util.h>
+#include <algorithm>
+#include <charconv>
+#include <exception>
 #include <iostream>
+#include <thread>
 
 namespace wal {
 
+    namespace {
+        // snap and delta keys are "symbol:" + 8-byte seq; the prefix is everything before
+        // the seq, so a symbol's snapshots share one prefix bloom entry and prefix
+        // iteration works.
+        class SymbolPrefix final : public rocksdb::SliceTransform {
+        public:
+            const char* Name() const override { return "ome.SymbolPrefix"; }
+            rocksdb::Slice Transform(const rocksdb::Slice& key) const override {
+                return rocksdb::Slice(key.data(), key.size() - kSeqKeySize);
+            }
+            bool InDomain(const rocksdb::Slice& key) const override { return key.size() > kSeqKeySize; }
+        };
+
+        const char* const kFormatKey = "format";
+
+        // Processed marks of shard 0 keep the original name; other shards get their own.
+        std::string outboundName(const uint16_t shard) {
+            return shard ? "out." + std::to_string(shard) : std::string("out");
+        }
+
+        struct ColumnFamilyTuning {
+            rocksdb::ColumnFamilyOptions in;
+            rocksdb::ColumnFamilyOptions out;
+            rocksdb::ColumnFamilyOptions snap;   // snap and delta
+        };
+
+        // Empty column family present while every out column family of the DB has only
+        // ever been compacted FIFO.
+        constexpr const char* kFifoMarker = "fifo";
+
+        // Applies the DB-wide part of profile to options and returns the per-CF part.
+        ColumnFamilyTuning tune(const RocksProfile profile, rocksdb::Options& options) {
+            ColumnFamilyTuning cf;
+            cf.snap.prefix_extractor = std::make_shared<SymbolPrefix>();
+            if (profile == RocksProfile::Default) return cf;
+
+            // Consecutive groups overlap their WAL write with the previous memtable insert.
+            options.enable_pipelined_write = true;
+            options.manual_wal_flush = profile == RocksProfile::GroupCommit;
+            options.max_background_jobs = 4;
+            options.wal_bytes_per_sync = 1 << 20;
+
+            // in: small records written once in key order, read back front to back on
+            // replay and dropped by retention. Compression costs more than it saves on the
+            // hot path; universal compaction keeps write amplification low.
+            cf.in.compression = rocksdb::kNoCompression;
+            cf.in.write_buffer_size = 128 << 20;
+            cf.in.max_write_buffer_number = 4;
+            cf.in.compaction_style = rocksdb::kCompactionStyleUniversal;
+
+            // out: only the newest processed mark is ever read back, so FIFO may drop the
+            // oldest files outright. in stays out of FIFO: replay needs every record above
+            // the newest snapshot. FIFO cannot open a column family with files below L0,
+            // which any other compaction style may have left, so the constructor keeps it
+            // to DBs that have used it from the start (kFifoMarker).
+            cf.out.compression = rocksdb::kNoCompression;
+            cf.out.write_buffer_size = 32 << 20;
+            cf.out.max_write_buffer_number = 4;
+            cf.out.compaction_style = rocksdb::kCompactionStyleFIFO;
+            cf.out.compaction_options_fifo.max_table_files_size = 1ull << 30;
+
+            // snap/delta: few keys with large values. Values go to blob files so
+            // compaction rewrites keys only; snapshots are already dense binary.
+            cf.snap.compression = rocksdb::kNoCompression;
+            cf.snap.write_buffer_size = 64 << 20;
+            cf.snap.enable_blob_files = true;
+            cf.snap.min_blob_size = 4096;
+            cf.snap.blob_file_size = 256 << 20;
+            cf.snap.blob_compression_type = rocksdb::kNoCompression;
+            cf.snap.enable_blob_garbage_collection = true;
+            return cf;
+        }
+    } // namespace
+
     // wal_manager.cpp
-    WalManager::WalManager(const std::string& path) : dbPath_(path) {
+    WalManager::WalManager(const std::string& path, const WalOptions& walOptions)
+        : dbPath_(path), options_(walOptions) {
         rocksdb::Options options;
         options.create_if_missing = true;
         options.create_missing_column_families = true;
 
-        const std::vector<rocksdb::ColumnFamilyDescriptor> cfDescriptors = {
+        ColumnFamilyTuning cf = tune(options_.rocksProfile, options);
+        std::vector<std::string> existing;
+        const bool created = !rocksdb::DB::ListColumnFamilies(options, dbPath_, &existing).ok();
+        const bool fifoMarked = std::find(existing.begin(), existing.end(), kFifoMarker) != existing.end();
+        if (cf.out.compaction_style == rocksdb::kCompactionStyleFIFO && !created && !fifoMarked) {
+            // An existing DB whose out column families may hold files below L0 keeps the
+            // stock compaction for them; FIFO needs a new DB.
+            cf.out.compaction_style = rocksdb::ColumnFamilyOptions().compaction_style;
+        }
+        const bool fifo = cf.out.compaction_style == rocksdb::kCompactionStyleFIFO;
+        outboundOptions_ = cf.out;
+
+        std::vector<rocksdb::ColumnFamilyDescriptor> cfDescriptors = {
             {rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions()},
-            {"in", rocksdb::ColumnFamilyOptions()},
-            {"out", rocksdb::ColumnFamilyOptions()},
-            {"snap", rocksdb::ColumnFamilyOptions()}
+            {"in", cf.in},
+            {"out", cf.out},
+            {"snap", cf.snap},
+            {"delta", cf.snap}
         };
+        // Processed marks of the other shards, created as their engines first mark.
+        for (const auto& name : existing) {
+            if (name.starts_with("out.")) cfDescriptors.push_back({name, cf.out});
+        }
+        if (fifo || fifoMarked) cfDescriptors.push_back({kFifoMarker, rocksdb::ColumnFamilyOptions()});
 
         rocksdb::Status s = rocksdb::DB::Open(options, dbPath_, cfDescriptors, &handles_, &db_);
         if (!s.ok()) {
@@ -25,12 +127,76 @@ namespace wal {
         inboundCF_  = handles_[1];
         outboundCF_ = handles_[2];
         snapshotCF_ = handles_[3];
+        deltaCF_    = handles_[4];
+        if (fifoMarked && !fifo) {
+            // out is compacted another way from now on: FIFO needs a new DB again.
+            s = db_->DropColumnFamily(handles_.back());
+            if (!s.ok()) throw std::runtime_error("Failed to drop the FIFO marker: " + s.ToString());
+        }
+
+        migrateKeys();
+        if (options_.backend == Backend::Segments) {
+            inbound_ = std::make_unique<SegmentJournal>(dbPath_ + ".in", options_, SequenceOrder::Dense);
+        } else {
+            inbound_ = std::make_unique<RocksJournal>(db_, inboundCF_, options_, SequenceOrder::Dense);
+            for (std::size_t i = 5; i < handles_.size(); ++i) {
+                if (!cfDescriptors[i].name.starts_with("out.")) continue;
+                const uint16_t shard = static_cast<uint16_t>(std::stoul(cfDescriptors[i].name.substr(4)));
+                outbound_[shard] = std::make_unique<RocksJournal>(db_, handles_[i], options_);
+            }
+        }
+        outbound(0);
+        seq_ = inbound_->lastSequence();
+        if (options_.keepSnapshots > 0) {
+            // Symbols that do not snapshot again before the next trim still hold their records.
+            rocksdb::ReadOptions readOptions;
+            readOptions.total_order_seek = true;
+            const std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(readOptions, snapshotCF_));
+            for (it->SeekToFirst(); it->Valid(); it->Next()) {
+                const std::string_view key = it->key().ToStringView();
+                if (key.size() <= kSeqKeySize) continue;
+                latestSnapshot_[std::string(key.substr(0, key.size() - kSeqKeySize - 1))] = seqFromKey(key);
+            }
+            retention_ = std::thread([this] { runRetention(); });
+        }
+        if (options_.durability == Durability::Periodic && options_.syncInterval.count() > 0) {
+            syncTimer_ = std::thread([this] { runSyncTimer(); });
+        }
 
-        std::cout << "[WAL] Opened RocksDB at " << dbPath_ << "\n";
+        std::cout << "[WAL] Opened RocksDB at " << dbPath_ << " (last seq " << seq_ << ")\n";
     }
 
     WalManager::~WalManager() {
+        if (syncTimer_.joinable()) {
+            {
+                std::lock_guard lock(syncTimerMu_);
+                syncTimerStop_ = true;
+            }
+            syncTimerWake_.notify_one();
+            syncTimer_.join();
+        }
+        if (retention_.joinable()) {
+            {
+                std::lock_guard lock(retentionMu_);
+                retentionStop_ = true;
+            }
+            retentionWake_.notify_one();
+            retention_.join();
+        }
         if (db_) {
+            if (options_.rocksProfile == RocksProfile::GroupCommit) {
+                // Retention and migration writes are not flushed on their own.
+                db_->FlushWAL(options_.durability != Durability::Async);
+            }
+            if (options_.durability != Durability::Async) {
+                try {
+                    sync();
+                } catch (const std::exception& e) {
+                    std::cerr << "[WAL] Final sync failed: " << e.what() << "\n";
+                }
+            }
+            inbound_.reset();
+            outbound_.clear();
             for (auto* h : handles_) {
                 db_->DestroyColumnFamilyHandle(h);
             }
@@ -41,62 +207,444 @@ namespace wal {
     }
 
 
-uint64_t WalManager::appendInbound(const std::string& type, const nlohmann::json& payload) {
+void WalManager::sync() {
+    inbound_->sync();
+    for (Journal* out : outboundJournals()) out->sync();
+}
+
+WalStats WalManager::stats() const {
+    WalStats total = inbound_->stats();
+    for (const Journal* out : outboundJournals()) {
+        const WalStats stats = out->stats();
+        total.records += stats.records;
+        total.groups += stats.groups;
+        total.syncs += stats.syncs;
+    }
+    return total;
+}
+
+Journal& WalManager::outbound(const uint16_t shard) {
+    std::lock_guard lock(outboundMu_);
+    std::unique_ptr<Journal>& journal = outbound_[shard];
+    if (journal) return *journal;
+    if (options_.backend == Backend::Segments) {
+        journal = std::make_unique<SegmentJournal>(dbPath_ + "." + outboundName(shard), options_);
+    } else {
+        rocksdb::ColumnFamilyHandle* cf = outboundCF_;
+        if (shard) {
+            const auto s = db_->CreateColumnFamily(outboundOptions_, outboundName(shard), &cf);
+            if (!s.ok()) throw std::runtime_error("Failed to create processed marks of shard " +
+                                                 std::to_string(shard) + ": " + s.ToString());
+            handles_.push_back(cf);
+        }
+        journal = std::make_unique<RocksJournal>(db_, cf, options_);
+    }
+    return *journal;
+}
+
+std::vector<Journal*> WalManager::outboundJournals() const {
+    std::lock_guard lock(outboundMu_);
+    std::vector<Journal*> journals;
+    for (const auto& [shard, journal] : outbound_) journals.push_back(journal.get());
+    return journals;
+}
+
+uint64_t WalManager::appendInbound(const engine::Command& cmd) {
     uint64_t id = ++seq_;
-    const nlohmann::json record = {{"id", id}, {"type", type}, {"payload", payload}};
-    const std::string key = std::to_string(id);
-    auto s = db_->Put(rocksdb::WriteOptions(), inboundCF_, key, record.dump());
-    if (!s.ok()) throw std::runtime_error("appendInbound failed: " + s.ToString());
+    appendInbound(id, cmd);
     return id;
 }
 
-void WalManager::markProcessed(const uint64_t seq, const nlohmann::json& payload) const {
-    const std::string key = std::to_string(seq);
-    auto s = db_->Put(rocksdb::WriteOptions(), outboundCF_, key, payload.dump());
-    if (!s.ok()) throw std::runtime_error("markProcessed failed: " + s.ToString());
+void WalManager::appendInbound(const uint64_t seq, const engine::Command& cmd) {
+    RecordBuffer record;
+    const Journal::Entry entry{seq, std::string_view(record.data(), encodeRecord(cmd, seq, nowNs(), record))};
+    inbound_->append({&entry, 1});
+
+    uint64_t last = seq_.load();
+    while (last < seq && !seq_.compare_exchange_weak(last, seq)) {
+    }
+}
+
+void WalManager::appendInboundBatch(const std::span<const engine::Command> cmds) {
+    appendInboundCommands(cmds, false);
+}
+
+void WalManager::appendInboundAsync(const std::span<const engine::Command> cmds) {
+    appendInboundCommands(cmds, true);
+}
+
+void WalManager::appendInboundCommands(const std::span<const engine::Command> cmds, const bool async) {
+    if (cmds.empty()) return;
+    thread_local std::vector<RecordBuffer> records;
+    thread_local std::vector<Journal::Entry> entries;
+    records.resize(cmds.size());
+    entries.clear();
+    const uint64_t now = nowNs();
+    uint64_t highest = 0;
+    for (std::size_t i = 0; i < cmds.size(); ++i) {
+        const std::size_t n = encodeRecord(cmds[i], cmds[i].seq, now, records[i]);
+        entries.push_back({cmds[i].seq, std::string_view(records[i].data(), n)});
+        highest = std::max(highest, cmds[i].seq);
+    }
+    if (async) {
+        inbound_->appendAsync(entries);
+    } else {
+        inbound_->append(entries);
+    }
+
+    uint64_t last = seq_.load();
+    while (last < highest && !seq_.compare_exchange_weak(last, highest)) {
+    }
+}
+
+uint64_t WalManager::durableInbound() const {
+    return inbound_->durableSequence();
+}
+
+void WalManager::waitInboundDurable(const uint64_t seq) {
+    inbound_->waitDurable(seq);
+}
+
+void WalManager::markProcessed(const uint16_t shard, const uint64_t count, const engine::Event& event) {
+    RecordBuffer record;
+    const Journal::Entry entry{count, std::string_view(record.data(), encodeRecord(event, count, nowNs(), record))};
+    outbound(shard).append({&entry, 1});
 }
 
 void WalManager::saveSnapshot(const std::string& symbol,
-                              const nlohmann::json& snapshot,
-                              const uint64_t seq) const {
-    const std::string key = symbol + ":" + std::to_string(seq);
-    auto s = db_->Put(rocksdb::WriteOptions(), snapshotCF_, key, snapshot.dump());
-    if (!s.ok()) throw std::runtime_error("saveSnapshot failed: " + s.ToString());
+                              const std::string_view snapshot,
+                              const uint64_t seq) {
+    putSnapshot(snapshotCF_, symbol, snapshot, seq, "saveSnapshot");
+}
+
+void WalManager::saveSnapshotDelta(const std::string& symbol,
+                                   const std::string_view delta,
+                                   const uint64_t seq) {
+    putSnapshot(deltaCF_, symbol, delta, seq, "saveSnapshotDelta");
 }
 
-std::optional<nlohmann::json> WalManager::loadSnapshot(const std::string& symbol,
-                                                       uint64_t& lastSeq) const {
-    const std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(rocksdb::ReadOptions(), snapshotCF_));
-    const std::string prefix = symbol + ":";
-    it->Seek(prefix);
-    nlohmann::json result;
-    bool found = false;
-    for (; it->Valid(); it->Next()) {
-        if (it->key().starts_with(prefix)) {
-            found = true;
-            lastSeq = std::stoull(it->key().ToString().substr(prefix.size()));
-            result = nlohmann::json::parse(it->value().ToString());
+void WalManager::putSnapshot(rocksdb::ColumnFamilyHandle* cf, const std::string& symbol,
+                             const std::string_view value, const uint64_t seq, const char* what) {
+    const bool sync = options_.durability != Durability::Async;
+    const bool manualFlush = options_.rocksProfile == RocksProfile::GroupCommit;
+    rocksdb::WriteOptions writeOptions;
+    writeOptions.sync = sync && !manualFlush;
+    auto s = db_->Put(writeOptions, cf, snapshotKey(symbol, seq), rocksdb::Slice(value.data(), value.size()));
+    if (s.ok() && manualFlush) s = db_->FlushWAL(sync);
+    if (!s.ok()) throw std::runtime_error(std::string(what) + " failed: " + s.ToString());
+    snapshotSaved(symbol, seq);
+}
+
+void WalManager::snapshotSaved(const std::string& symbol, const uint64_t seq) {
+    if (!retention_.joinable()) return;
+    {
+        std::lock_guard lock(retentionMu_);
+        latestSnapshot_[symbol] = seq;
+        retentionPending_.insert(symbol);
+    }
+    retentionWake_.notify_one();
+}
+
+void WalManager::registerEngine(const std::string& symbol, const uint16_t shard) {
+    std::lock_guard lock(retentionMu_);
+    const auto [it, added] = registered_.emplace(shard, symbol);
+    if (!added && it->second != symbol) {
+        throw std::invalid_argument("WalManager: shard " + std::to_string(shard) + " already holds " + it->second);
+    }
+}
+
+std::vector<uint16_t> WalManager::registeredShards() const {
+    std::lock_guard lock(retentionMu_);
+    std::vector<uint16_t> shards;
+    for (const auto& [shard, symbol] : registered_) shards.push_back(shard);
+    return shards;
+}
+
+void WalManager::runRetention() {
+    std::unique_lock lock(retentionMu_);
+    for (;;) {
+        retentionWake_.wait(lock, [&] { return retentionStop_ || !retentionPending_.empty(); });
+        if (retentionStop_) return;
+        const std::string symbol = *retentionPending_.begin();
+        retentionPending_.erase(retentionPending_.begin());
+        lock.unlock();
+        try {
+            retain(symbol);
+        } catch (const std::exception& e) {
+            std::cerr << "[WAL] Retention failed: " << e.what() << "\n";
         }
+        lock.lock();
     }
-    return found ? std::optional<nlohmann::json>(result) : std::nullopt;
 }
 
-std::vector<WalRecord> WalManager::replayInbound(const uint64_t from) const {
-    std::vector<WalRecord> records;
+// Every syncInterval, syncs each journal that took records since the last look. Extra
+// syncs cost little: a journal whose own commits already synced the tail has nothing
+// left to write.
+void WalManager::runSyncTimer() {
+    std::map<Journal*, uint64_t> seen;
+    auto syncIfWritten = [&seen](Journal* journal) {
+        const uint64_t last = journal->lastSequence();
+        uint64_t& synced = seen[journal];
+        if (synced != last) journal->sync();
+        synced = last;
+    };
+    std::unique_lock lock(syncTimerMu_);
+    for (;;) {
+        if (syncTimerWake_.wait_for(lock, options_.syncInterval, [&] { return syncTimerStop_; })) return;
+        lock.unlock();
+        try {
+            syncIfWritten(inbound_.get());
+            for (Journal* out : outboundJournals()) syncIfWritten(out);
+        } catch (const std::exception& e) {
+            std::cerr << "[WAL] Timed sync failed: " << e.what() << "\n";
+        }
+        lock.lock();
+    }
+}
+
+// Runs on the retention thread after a snapshot of symbol.
+void WalManager::retain(const std::string& symbol) {
+    if (options_.durability == Durability::Async) {
+        // The snapshot was not synced: trimming what it replaces must not reach the disk first.
+        auto s = options_.rocksProfile == RocksProfile::GroupCommit ? db_->FlushWAL(true) : db_->SyncWAL();
+        if (!s.ok()) throw std::runtime_error("snapshot sync failed: " + s.ToString());
+    }
+    // Keep the newest keepSnapshots snapshots: find the oldest of them with a key-only
+    // walk backwards, then drop everything of the symbol before it.
+    const std::string prefix = snapshotPrefix(symbol);
+    rocksdb::ReadOptions readOptions;
+    readOptions.prefix_same_as_start = true;
+    const std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(readOptions, snapshotCF_));
+    uint32_t kept = 0;
+    for (it->SeekForPrev(snapshotKey(symbol, UINT64_MAX)); it->Valid() && it->key().starts_with(prefix);
+         it->Prev()) {
+        if (++kept > options_.keepSnapshots) {
+            // Deltas taken before the oldest kept snapshot belong to dropped ones.
+            const std::string oldestKept = snapshotKey(symbol, seqFromKey(it->key().ToStringView()) + 1);
+            for (auto* cf : {snapshotCF_, deltaCF_}) {
+                auto s = db_->DeleteRange(rocksdb::WriteOptions(), cf, prefix, oldestKept);
+                if (!s.ok()) throw std::runtime_error("snapshot retention failed: " + s.ToString());
+            }
+            break;
+        }
+    }
+
+    // Journal records are shared by every symbol of this WAL: keep what the symbol with
+    // the oldest newest snapshot still needs, plus the margin.
+    uint64_t oldest;
+    {
+        std::lock_guard lock(retentionMu_);
+        for (const auto& [shard, registered] : registered_) {
+            if (!latestSnapshot_.count(registered)) return;   // it still recovers from the first record
+        }
+        oldest = std::min_element(latestSnapshot_.begin(), latestSnapshot_.end(),
+                                  [](const auto& a, const auto& b) { return a.second < b.second; })->second;
+    }
+    if (oldest > options_.retainRecords) inbound_->truncateBefore(oldest - options_.retainRecords);
+    // Only the last processed mark of each shard is ever read back.
+    for (Journal* out : outboundJournals()) {
+        const uint64_t mark = out->lastSequence();
+        if (mark > options_.retainRecords) out->truncateBefore(mark - options_.retainRecords);
+    }
+}
+
+std::optional<std::string> WalManager::loadSnapshot(const std::string& symbol,
+                                                     uint64_t& lastSeq) const {
+    // Sequence suffixes are big-endian, so the newest snapshot is the symbol's last key:
+    // one reverse seek, however many snapshots are kept.
+    rocksdb::ReadOptions readOptions;
+    readOptions.prefix_same_as_start = true;
+    const std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(readOptions, snapshotCF_));
+    it->SeekForPrev(snapshotKey(symbol, UINT64_MAX));
+    if (!it->Valid() || !it->key().starts_with(snapshotPrefix(symbol))) {
+        if (!it->status().ok()) throw std::runtime_error("loadSnapshot failed: " + it->status().ToString());
+        return std::nullopt;
+    }
+    lastSeq = seqFromKey(it->key().ToStringView());
+    return it->value().ToString();
+}
+
+void WalManager::loadSnapshotDeltas(const std::string& symbol, const uint64_t baseSeq,
+                                    const DeltaVisitor& visit) const {
+    rocksdb::ReadOptions readOptions;
+    readOptions.prefix_same_as_start = true;
+    const std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(readOptions, deltaCF_));
+    const std::string prefix = snapshotPrefix(symbol);
+    for (it->Seek(snapshotKey(symbol, baseSeq + 1)); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+        if (!visit(seqFromKey(it->key().ToStringView()), it->value().ToStringView())) return;
+    }
+    if (!it->status().ok()) throw std::runtime_error("loadSnapshotDeltas failed: " + it->status().ToString());
+}
+
+// Versioned records carry their own seq; older ones take it from the key.
+static bool decodeInbound(const uint64_t seq, const std::string_view in, engine::Command& cmd) {
+    switch (decodeRecord(in, cmd)) {
+        case RecordStatus::Ok:
+            return true;
+        case RecordStatus::Corrupt:
+            return false;
+        case RecordStatus::Legacy:
+            break;
+    }
+    if (engine::decode(in, cmd)) {
+        // version 0: bare codec
+    } else if (!in.empty() && in.front() == '{' &&
+               engine::commandFromLegacyJson(nlohmann::json::parse(in), cmd)) {
+        // record written before the binary format
+    } else {
+        return false;
+    }
+    cmd.seq = seq;
+    return true;
+}
+
+void WalManager::replayInbound(const uint64_t from, const ReplayVisitor& apply) const {
+    // A prefetch thread reads and decodes ahead through a bounded ring while the caller
+    // applies, so memory stays at one ring however long the journal is.
+    auto ring = std::make_unique<engine::SpscRing<WalRecord, kReplayReadahead>>();
+    std::atomic<bool> stop{false};
+    std::atomic<bool> done{false};
+    std::exception_ptr failure;
+    std::thread prefetch([&] {
+        try {
+            inbound_->scan(from, [&](const uint64_t seq, const std::string_view value) {
+                WalRecord rec{seq, engine::Command()};
+                if (!decodeInbound(seq, value, rec.cmd)) {
+                    throw std::runtime_error("replayInbound: undecodable record at seq " + std::to_string(seq));
+                }
+                rec.id = rec.cmd.seq;
+                while (!ring->tryPush(rec)) {
+                    if (stop.load(std::memory_order_relaxed)) return false;
+                    std::this_thread::yield();
+                }
+                return !stop.load(std::memory_order_relaxed);
+            });
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        done.store(true, std::memory_order_release);
+    });
+    // Stops and joins the prefetcher on every way out, apply throwing included.
+    struct PrefetchGuard {
+        std::atomic<bool>& stop;
+        std::thread& thread;
+        ~PrefetchGuard() {
+            stop.store(true, std::memory_order_relaxed);
+            if (thread.joinable()) thread.join();
+        }
+    } guard{stop, prefetch};
+
+    bool more = true;
+    while (more) {
+        const bool finished = done.load(std::memory_order_acquire);
+        const std::size_t n = ring->consume([&](const WalRecord& rec) {
+            if (more && !apply(rec)) more = false;
+        });
+        if (n == 0) {
+            if (finished) break;
+            engine::cpuRelax();
+        }
+    }
+    stop.store(true, std::memory_order_relaxed);
+    prefetch.join();
+    if (failure) std::rethrow_exception(failure);
+}
+
+std::size_t WalManager::upgradeLegacyRecords() {
+    constexpr std::size_t kBatch = 4096;
+    rocksdb::WriteBatch batch;
+    RecordBuffer record;
+    std::size_t upgraded = 0;
     const std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(rocksdb::ReadOptions(), inboundCF_));
-    it->Seek(std::to_string(from));
-    for (; it->Valid(); it->Next()) {
-        auto val = nlohmann::json::parse(it->value().ToString());
-        WalRecord rec{val["id"], val["type"], val["payload"]};
-        records.push_back(std::move(rec));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        if (!it->value().empty() && static_cast<uint8_t>(it->value()[0]) == kRecordVersion) continue;
+        engine::Command cmd;
+        if (!decodeInbound(seqFromKey(it->key().ToStringView()), it->value().ToStringView(), cmd)) {
+            throw std::runtime_error("upgradeLegacyRecords: undecodable record at seq " +
+                                     std::to_string(seqFromKey(it->key().ToStringView())));
+        }
+        const std::size_t n = encodeRecord(cmd, cmd.seq, 0, record);
+        batch.Put(inboundCF_, it->key(), rocksdb::Slice(record.data(), n));
+        if (++upgraded % kBatch == 0) {
+            auto s = db_->Write(rocksdb::WriteOptions(), &batch);
+            if (!s.ok()) throw std::runtime_error("upgradeLegacyRecords failed: " + s.ToString());
+            batch.Clear();
+        }
     }
-    return records;
+    auto s = db_->Write(rocksdb::WriteOptions(), &batch);
+    if (!s.ok()) throw std::runtime_error("upgradeLegacyRecords failed: " + s.ToString());
+    return upgraded;
 }
 
-bool WalManager::isProcessed(const uint64_t seq) const {
-    std::string val;
-    auto s = db_->Get(rocksdb::ReadOptions(), outboundCF_, std::to_string(seq), &val);
-    return s.ok();
+uint64_t WalManager::processedMark(const uint16_t shard) {
+    return outbound(shard).lastSequence();
+}
+
+// Databases written before kFormatVersion keyed every record with the decimal string
+// of its seq. Rewrites them once under the fixed-width keys, then records the version.
+void WalManager::migrateKeys() {
+    std::string format;
+    if (db_->Get(rocksdb::ReadOptions(), handles_[0], kFormatKey, &format).ok()) {
+        if (std::stoull(format) != kFormatVersion) {
+            throw std::runtime_error("WAL format " + format + " is not supported");
+        }
+        return;
+    }
+
+    // Each batch rewrites whole records, and keys already in fixed-width form are
+    // skipped, so a migration cut short by a crash picks up where it stopped on the
+    // next open. Decimal keys start with an ASCII digit, fixed-width ones with a zero
+    // byte (sequences stay below 2^56).
+    constexpr std::size_t kBatch = 4096;
+    rocksdb::WriteBatch batch;
+    std::size_t migrated = 0;
+    std::size_t dropped = 0;
+    auto flush = [&] {
+        auto s = db_->Write(rocksdb::WriteOptions(), &batch);
+        if (!s.ok()) throw std::runtime_error("WAL key migration failed: " + s.ToString());
+        batch.Clear();
+    };
+    auto parseSeq = [](std::string_view digits) {
+        uint64_t seq = 0;
+        const auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), seq);
+        if (ec != std::errc() || end != digits.data() + digits.size()) {
+            throw std::runtime_error("WAL key migration: unexpected key " + std::string(digits));
+        }
+        return seq;
+    };
+
+    for (auto* cf : {inboundCF_, outboundCF_, snapshotCF_}) {
+        const std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(rocksdb::ReadOptions(), cf));
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            const std::string_view oldKey = it->key().ToStringView();
+            if (cf == snapshotCF_) {
+                if (oldKey.size() > kSeqKeySize && oldKey[oldKey.size() - kSeqKeySize - 1] == ':' &&
+                    oldKey[oldKey.size() - kSeqKeySize] == '\0') {
+                    continue;
+                }
+                if (oldKey.rfind(':') == std::string_view::npos) {
+                    throw std::runtime_error("WAL key migration: unexpected key " + std::string(oldKey));
+                }
+                // Decimal snapshot keys hold the count of outbound events, not an inbound
+                // sequence, so there is no replay position to translate them to. Dropping
+                // them makes recovery replay the whole inbound journal, which those
+                // builds never trimmed.
+                batch.Delete(cf, it->key());
+                ++dropped;
+            } else {
+                if (oldKey.size() == kSeqKeySize && oldKey[0] == '\0') continue;
+                const SeqKey key = seqKey(parseSeq(oldKey));
+                batch.Put(cf, rocksdb::Slice(key.data(), key.size()), it->value());
+                batch.Delete(cf, it->key());
+                ++migrated;
+            }
+            if ((migrated + dropped) % kBatch == 0) flush();
+        }
+    }
+    batch.Put(handles_[0], kFormatKey, std::to_string(kFormatVersion));
+    flush();
+    if (migrated) std::cout << "[WAL] Migrated " << migrated << " records to fixed-width keys\n";
+    if (dropped) std::cout << "[WAL] Dropped " << dropped << " snapshots keyed by event count\n";
 }
 
 } // namespace wal
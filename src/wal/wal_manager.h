@@ -4,47 +4,149 @@
 #include <rocksdb/db.h>
 #include <rocksdb/options.h>
 #include <rocksdb/slice.h>
+#include <rocksdb/write_batch.h>
 #include <rocksdb/utilities/checkpoint.h>
-#include <nlohmann/json.hpp>
+#include "../engine/messages.h"
+#include "journal.h"
+#include "wal_options.h"
 
 #include <string>
 #include <vector>
 #include <optional>
 #include <atomic>
+#include <memory>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <span>
+#include <thread>
 
 namespace wal {
 
     struct WalRecord {
         uint64_t id;
-        std::string type;
-        nlohmann::json payload;
+        engine::Command cmd;
     };
 
+    // Inbound commands go to one Journal of the backend chosen by WalOptions::backend,
+    // and each shard's outbound processed marks to one more; snapshots always live in RocksDB. Each write returns
+    // once its records are durable per WalOptions::durability, and concurrent writes
+    // share the backend's writes and syncs.
     class WalManager {
     public:
-        explicit WalManager(const std::string& path);
+        explicit WalManager(const std::string& path, const WalOptions& options = WalOptions());
         ~WalManager();
 
-        // Write operations
-        uint64_t appendInbound(const std::string& type, const nlohmann::json& payload);
-        void markProcessed(uint64_t seq, const nlohmann::json& payload) const;
+        // Write operations. Inbound sequences come from one counter (reserveSequences);
+        // the inbound journal takes records in sequence order whichever thread writes
+        // them, so every sequence handed out must be appended exactly once.
+        //
+        // Journals cmd under the next sequence and returns it; safe to call concurrently.
+        uint64_t appendInbound(const engine::Command& cmd);
+        // Journals a record whose sequence number was assigned upstream (Sequencer).
+        void appendInbound(uint64_t seq, const engine::Command& cmd);
+        // Journals already-sequenced commands with a single WriteBatch, keyed by cmd.seq.
+        void appendInboundBatch(std::span<const engine::Command> cmds);
+        // Like appendInboundBatch, but returns once the write is queued; durableInbound()
+        // reaches the batch's last sequence when it is durable.
+        void appendInboundAsync(std::span<const engine::Command> cmds);
+        uint64_t durableInbound() const;
+        void waitInboundDurable(uint64_t seq);
+        // Reserves n consecutive sequence numbers and returns the first one.
+        uint64_t reserveSequences(std::size_t n) { return seq_.fetch_add(n) + 1; }
+        uint64_t lastSequence() const { return seq_.load(); }
+        // Advances shard's processed watermark to `count` delivered events; one outbound
+        // record, keyed by count, holding the last event delivered. Each shard numbers
+        // its events on its own, so engines sharing the WAL need distinct shards.
+        void markProcessed(uint16_t shard, uint64_t count, const engine::Event& event);
 
-        // Snapshot
-        void saveSnapshot(const std::string& symbol, const nlohmann::json& snapshot, uint64_t seq) const;
-        std::optional<nlohmann::json> loadSnapshot(const std::string& symbol, uint64_t& lastSeq) const;
+        // Forces an fsync of everything written so far, e.g. for the Periodic tail on shutdown.
+        void sync();
+        const WalOptions& options() const { return options_; }
+        WalStats stats() const;
+
+        // Snapshot. The write is synced unless the WAL is Async; once it is durable the
+        // retention thread trims old snapshots and journal records (WalOptions::keepSnapshots).
+        // Under Async the retention thread syncs the snapshot itself before it trims.
+        // The payload is opaque here (engine::book_snapshot, or JSON from older builds).
+        void saveSnapshot(const std::string& symbol, std::string_view snapshot, uint64_t seq);
+        // Declares that the engine of symbol on shard recovers from this WAL: journal records
+        // are not trimmed until it has a snapshot. Every engine registers when constructed;
+        // two symbols on one shard throw std::invalid_argument.
+        void registerEngine(const std::string& symbol, uint16_t shard);
+        // Shards registered so far, ascending.
+        std::vector<uint16_t> registeredShards() const;
+        // Newest snapshot of symbol and the seq it was taken at, found with one reverse seek.
+        std::optional<std::string> loadSnapshot(const std::string& symbol, uint64_t& lastSeq) const;
+        // Incremental snapshot on top of the newest full one, kept in its own column family
+        // and trimmed with the snapshot it follows.
+        void saveSnapshotDelta(const std::string& symbol, std::string_view delta, uint64_t seq);
+        // Visits the deltas of symbol taken after baseSeq in sequence order. The view is only
+        // valid during the call; returning false stops the walk.
+        using DeltaVisitor = std::function<bool(uint64_t seq, std::string_view delta)>;
+        void loadSnapshotDeltas(const std::string& symbol, uint64_t baseSeq, const DeltaVisitor& visit) const;
 
         // Recovery
-        std::vector<WalRecord> replayInbound(uint64_t from = 1) const;
-        bool isProcessed(uint64_t seq) const;
+        // Records decoded ahead of the caller during replayInbound().
+        static constexpr std::size_t kReplayReadahead = 4096;
+        // Returning false stops the replay.
+        using ReplayVisitor = std::function<bool(const WalRecord& rec)>;
+        // Streams the inbound records with seq >= from to apply, in sequence order. They
+        // are read and decoded on a prefetch thread up to kReplayReadahead records ahead,
+        // so I/O overlaps with apply and memory does not grow with the journal.
+        void replayInbound(uint64_t from, const ReplayVisitor& apply) const;
+        // One-shot migration: rewrites inbound records of the JSON and unframed binary
+        // formats as versioned records (timestamp 0). Replay reads all three formats,
+        // so this only saves the per-record fallback. Returns the number rewritten.
+        // Only the RocksDB backend can hold such records.
+        std::size_t upgradeLegacyRecords();
+        // Events of shard delivered so far: its last processed mark (a key lookup, not a scan).
+        uint64_t processedMark(uint16_t shard);
 
     private:
+        void appendInboundCommands(std::span<const engine::Command> cmds, bool async);
+        // Processed marks of shard, opened (and for RocksDB created) on first use.
+        Journal& outbound(uint16_t shard);
+        std::vector<Journal*> outboundJournals() const;
+        void migrateKeys();
+        void putSnapshot(rocksdb::ColumnFamilyHandle* cf, const std::string& symbol, std::string_view value,
+                         uint64_t seq, const char* what);
+        void snapshotSaved(const std::string& symbol, uint64_t seq);
+        void runRetention();
+        void retain(const std::string& symbol);
+        void runSyncTimer();
+
         std::string dbPath_;
+        WalOptions options_;
         rocksdb::DB* db_{nullptr};
         rocksdb::ColumnFamilyHandle* inboundCF_{nullptr};
         rocksdb::ColumnFamilyHandle* outboundCF_{nullptr};
         rocksdb::ColumnFamilyHandle* snapshotCF_{nullptr};
+        rocksdb::ColumnFamilyHandle* deltaCF_{nullptr};
         std::vector<rocksdb::ColumnFamilyHandle*> handles_;
+        std::unique_ptr<Journal> inbound_;
+        rocksdb::ColumnFamilyOptions outboundOptions_;
+        mutable std::mutex outboundMu_;
+        std::map<uint16_t, std::unique_ptr<Journal>> outbound_;   // by shard
         std::atomic<uint64_t> seq_{0};
+
+        // retention thread, started when keepSnapshots > 0
+        mutable std::mutex retentionMu_;
+        std::condition_variable retentionWake_;
+        std::set<std::string> retentionPending_;        // symbols with a new snapshot
+        std::map<std::string, uint64_t> latestSnapshot_;   // newest snapshot per symbol
+        std::map<uint16_t, std::string> registered_;    // symbol by shard, recovering from this WAL
+        bool retentionStop_{false};
+        std::thread retention_;
+
+        // sync timer, started under Periodic with a syncInterval: a commit only checks the
+        // interval when it happens, so this syncs a tail that no later write would
+        std::mutex syncTimerMu_;
+        std::condition_variable syncTimerWake_;
+        bool syncTimerStop_{false};
+        std::thread syncTimer_;
     };
 
 } // namespace wal
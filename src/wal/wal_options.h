@@ -0,0 +1,171 @@
+#ifndef OME_WAL_OPTIONS_H
+#define OME_WAL_OPTIONS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace wal {
+
+    enum class Durability {
+        Async,      // never fsync; a crash may lose the tail the OS had not written back
+        Periodic,   // fsync once syncEveryRecords records or syncInterval has passed since the last one;
+                    // WalManager also syncs an idle tail after syncInterval
+        PerBatch    // fsync every group commit before any of its writers returns
+    };
+
+    enum class Backend {
+        RocksDB,    // in/out column families next to the snapshots
+        Segments    // preallocated, memory-mapped segment files (SegmentJournal)
+    };
+
+    enum class SegmentIo {
+        Mmap,       // memcpy into the mapping, msync to sync; append blocks on the sync
+        Uring       // positional writes through IoWriter (io_uring, else a thread pool)
+    };
+
+    // RocksDB tuning of the WAL database, per column family (applied in WalManager).
+    enum class RocksProfile {
+        Default,    // stock RocksDB options
+        Journal,    // append-only in/out: uncompressed, large memtables, universal (in) and
+                    // FIFO (out) compaction, pipelined writes; snapshots in blob files.
+                    // FIFO only applies to a DB created under this profile (or GroupCommit)
+                    // and kept on one of them: FIFO cannot open an out column family
+                    // compacted any other way, which keeps the stock style instead
+        GroupCommit // Journal with manual_wal_flush: each group commit flushes the WAL once
+    };
+
+    struct WalOptions {
+        Durability durability{Durability::Async};
+        uint32_t syncEveryRecords{0};            // Periodic: 0 disables the record trigger
+        std::chrono::microseconds syncInterval{0};  // Periodic: 0 disables the time trigger
+
+        Backend backend{Backend::RocksDB};
+        std::size_t segmentSize{64 << 20};       // Segments: bytes preallocated per file
+        SegmentIo segmentIo{SegmentIo::Mmap};
+        std::size_t ioSlots{8};                  // Segments + Uring: writes in flight at once
+        std::size_t ioSlotSize{256 << 10};       // Segments + Uring: bytes per write
+        RocksProfile rocksProfile{RocksProfile::Default};
+
+        // Retention, run in the background after each snapshot: keep the newest
+        // keepSnapshots full snapshots per symbol, with their deltas, and drop journal
+        // records more than retainRecords below the oldest symbol's newest snapshot.
+        // Journal records stay until every symbol registered with the WAL (see
+        // WalManager::registerEngine) has a snapshot. 0 keeps everything.
+        uint32_t keepSnapshots{3};
+        uint64_t retainRecords{100000};
+
+        // Reads OME_WAL_DURABILITY (async | periodic | batch), OME_WAL_SYNC_RECORDS,
+        // OME_WAL_SYNC_US, OME_WAL_BACKEND (rocksdb | segments), OME_WAL_SEGMENT_MB,
+        // OME_WAL_SEGMENT_IO (mmap | uring), OME_WAL_ROCKS_PROFILE (default | journal |
+        // groupcommit), OME_WAL_KEEP_SNAPSHOTS and OME_WAL_RETAIN_RECORDS; unset variables
+        // keep the defaults above.
+        static WalOptions fromEnv() {
+            WalOptions options;
+            if (const char* mode = std::getenv("OME_WAL_DURABILITY")) {
+                const std::string_view m(mode);
+                if (m == "async") {
+                    options.durability = Durability::Async;
+                } else if (m == "periodic") {
+                    options.durability = Durability::Periodic;
+                } else if (m == "batch") {
+                    options.durability = Durability::PerBatch;
+                } else {
+                    throw std::invalid_argument("OME_WAL_DURABILITY: unknown mode " + std::string(m));
+                }
+            }
+            if (const char* n = std::getenv("OME_WAL_SYNC_RECORDS")) {
+                options.syncEveryRecords = static_cast<uint32_t>(std::strtoul(n, nullptr, 10));
+            }
+            if (const char* us = std::getenv("OME_WAL_SYNC_US")) {
+                options.syncInterval = std::chrono::microseconds(std::strtoull(us, nullptr, 10));
+            }
+            if (const char* backend = std::getenv("OME_WAL_BACKEND")) {
+                const std::string_view b(backend);
+                if (b == "rocksdb") {
+                    options.backend = Backend::RocksDB;
+                } else if (b == "segments") {
+                    options.backend = Backend::Segments;
+                } else {
+                    throw std::invalid_argument("OME_WAL_BACKEND: unknown backend " + std::string(b));
+                }
+            }
+            if (const char* mb = std::getenv("OME_WAL_SEGMENT_MB")) {
+                const uint64_t n = std::strtoull(mb, nullptr, 10);
+                if (n == 0 || n > (uint64_t{1} << 20)) {
+                    throw std::invalid_argument("OME_WAL_SEGMENT_MB: expected 1..1048576, got " + std::string(mb));
+                }
+                options.segmentSize = n << 20;
+            }
+            if (const char* io = std::getenv("OME_WAL_SEGMENT_IO")) {
+                const std::string_view i(io);
+                if (i == "mmap") {
+                    options.segmentIo = SegmentIo::Mmap;
+                } else if (i == "uring") {
+                    options.segmentIo = SegmentIo::Uring;
+                } else {
+                    throw std::invalid_argument("OME_WAL_SEGMENT_IO: unknown mode " + std::string(i));
+                }
+            }
+            if (const char* profile = std::getenv("OME_WAL_ROCKS_PROFILE")) {
+                const std::string_view p(profile);
+                if (p == "default") {
+                    options.rocksProfile = RocksProfile::Default;
+                } else if (p == "journal") {
+                    options.rocksProfile = RocksProfile::Journal;
+                } else if (p == "groupcommit") {
+                    options.rocksProfile = RocksProfile::GroupCommit;
+                } else {
+                    throw std::invalid_argument("OME_WAL_ROCKS_PROFILE: unknown profile " + std::string(p));
+                }
+            }
+            if (const char* k = std::getenv("OME_WAL_KEEP_SNAPSHOTS")) {
+                options.keepSnapshots = static_cast<uint32_t>(std::strtoul(k, nullptr, 10));
+            }
+            if (const char* n = std::getenv("OME_WAL_RETAIN_RECORDS")) {
+                options.retainRecords = std::strtoull(n, nullptr, 10);
+            }
+            return options;
+        }
+    };
+
+    // Decides which commits fsync under the configured durability mode. Used by one
+    // committing thread at a time.
+    class SyncPolicy {
+    public:
+        explicit SyncPolicy(const WalOptions& options) : options_(options) {}
+
+        // Called once per commit of `records` records; true if this commit must sync.
+        bool due(uint64_t records) {
+            switch (options_.durability) {
+                case Durability::Async:
+                    return false;
+                case Durability::PerBatch:
+                    return true;
+                case Durability::Periodic:
+                    break;
+            }
+            unsynced_ += records;
+            const auto now = std::chrono::steady_clock::now();
+            const bool sync = (options_.syncEveryRecords && unsynced_ >= options_.syncEveryRecords) ||
+                              (options_.syncInterval.count() && now - lastSync_ >= options_.syncInterval);
+            if (sync) {
+                unsynced_ = 0;
+                lastSync_ = now;
+            }
+            return sync;
+        }
+
+    private:
+        WalOptions options_;
+        uint64_t unsynced_{0};
+        std::chrono::steady_clock::time_point lastSync_{std::chrono::steady_clock::now()};
+    };
+
+} // namespace wal
+
+#endif // OME_WAL_OPTIONS_H
@@ -0,0 +1,185 @@
+#ifndef OME_WAL_RECORD_H
+#define OME_WAL_RECORD_H
+
+#include "../engine/messages.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+namespace wal {
+
+    // --- CRC32C (Castagnoli), as used by RocksDB, ext4 and iSCSI ---
+
+    namespace detail {
+        // Slicing-by-8 tables: table[k][b] is the CRC of byte b followed by k zero bytes.
+        constexpr std::array<std::array<uint32_t, 256>, 8> makeCrc32cTables() {
+            std::array<std::array<uint32_t, 256>, 8> table{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+                table[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (std::size_t k = 1; k < 8; ++k) {
+                    table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+                }
+            }
+            return table;
+        }
+        inline constexpr auto kCrc32cTables = makeCrc32cTables();
+    } // namespace detail
+
+    // Extends crc (0 for a fresh checksum) over n bytes. Uses the SSE4.2 instruction
+    // when the build targets it, slicing-by-8 otherwise (little-endian hosts).
+    inline uint32_t crc32c(uint32_t crc, const void* data, std::size_t n) {
+        auto p = static_cast<const unsigned char*>(data);
+        crc = ~crc;
+#if defined(__SSE4_2__)
+        for (; n >= 8; n -= 8, p += 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            crc = static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+        }
+        for (; n > 0; --n, ++p) crc = _mm_crc32_u8(crc, *p);
+#else
+        const auto& t = detail::kCrc32cTables;
+        for (; n >= 8; n -= 8, p += 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            word ^= crc;
+            crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^
+                  t[4][(word >> 24) & 0xFF] ^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^
+                  t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+        }
+        for (; n > 0; --n, ++p) crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+#endif
+        return ~crc;
+    }
+
+    // --- Journal record: [header:24][payload] in host byte order ---
+    //
+    // The first byte tells the formats apart: versioned records set its high bit,
+    // version 0 records (bare engine codec) start with a MsgType, and records from
+    // the JSON era start with '{'.
+    struct RecordHeader {
+        uint8_t version;
+        engine::MsgType type;
+        uint16_t length;        // payload bytes after the header
+        uint32_t crc;           // CRC32C of the header (crc field excluded) and the payload
+        uint64_t seq;
+        uint64_t timestampNs;   // wall clock when the record was written
+    };
+
+    static_assert(sizeof(RecordHeader) == 24);
+
+    inline constexpr uint8_t kRecordVersion = 0x81;
+    inline constexpr std::size_t kMaxPayload = 40;   // largest Command/Event payload
+    inline constexpr std::size_t kMaxRecordSize = sizeof(RecordHeader) + kMaxPayload;
+
+    // Room for one encoded record; lives on the stack, so writing a record allocates nothing.
+    using RecordBuffer = std::array<char, kMaxRecordSize>;
+
+    static_assert(sizeof(engine::NewOrder) <= kMaxPayload && sizeof(engine::Reject) <= kMaxPayload);
+
+    enum class RecordStatus {
+        Ok,
+        Legacy,    // not a versioned record; the caller may try the older formats
+        Corrupt    // versioned, but truncated or failing the checksum
+    };
+
+    inline uint64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    inline uint32_t recordCrc(const char* record, std::size_t size) {
+        const uint32_t crc = crc32c(0, record, offsetof(RecordHeader, crc));
+        constexpr std::size_t rest = offsetof(RecordHeader, seq);
+        return crc32c(crc, record + rest, size - rest);
+    }
+
+    // Writes msg as a versioned record into out and returns the record size.
+    template <typename Msg>
+    std::size_t encodeRecord(const Msg& msg, uint64_t seq, uint64_t timestampNs, RecordBuffer& out) {
+        const std::size_t n = engine::payloadSize(msg.type);
+        RecordHeader header{kRecordVersion, msg.type, static_cast<uint16_t>(n), 0, seq, timestampNs};
+        std::memcpy(out.data(), &header, sizeof(header));
+        std::memcpy(out.data() + sizeof(header), engine::payloadOf(msg), n);
+        const uint32_t crc = recordCrc(out.data(), sizeof(header) + n);
+        std::memcpy(out.data() + offsetof(RecordHeader, crc), &crc, sizeof(crc));
+        return sizeof(header) + n;
+    }
+
+    // Decodes a versioned record; msg.seq is taken from the header.
+    template <typename Msg>
+    RecordStatus decodeRecord(std::string_view in, Msg& msg, uint64_t* timestampNs = nullptr) {
+        if (in.empty() || static_cast<uint8_t>(in[0]) != kRecordVersion) return RecordStatus::Legacy;
+        RecordHeader header;
+        if (in.size() < sizeof(header)) return RecordStatus::Corrupt;
+        std::memcpy(&header, in.data(), sizeof(header));
+        if (in.size() != sizeof(header) + header.length) return RecordStatus::Corrupt;
+        if (recordCrc(in.data(), in.size()) != header.crc) return RecordStatus::Corrupt;
+
+        // The payload follows the bare codec, so older, shorter payloads still decode.
+        char body[1 + kMaxPayload];
+        if (header.length > kMaxPayload) return RecordStatus::Corrupt;
+        body[0] = static_cast<char>(header.type);
+        std::memcpy(body + 1, in.data() + sizeof(header), header.length);
+        if (!engine::decode(std::string_view(body, 1 + header.length), msg)) return RecordStatus::Corrupt;
+        msg.seq = header.seq;
+        if (timestampNs) *timestampNs = header.timestampNs;
+        return RecordStatus::Ok;
+    }
+
+    // --- Keys ---
+    //
+    // Sequence numbers are stored big-endian in 8 bytes, so RocksDB's bytewise order is
+    // numeric order. in/out are keyed by the bare sequence; snap by "symbol:" followed by
+    // the sequence, so everything but the last 8 bytes is the symbol prefix.
+    inline constexpr std::size_t kSeqKeySize = 8;
+    inline constexpr uint64_t kFormatVersion = 2;   // 1: decimal-string keys
+
+    using SeqKey = std::array<char, kSeqKeySize>;
+
+    inline SeqKey seqKey(uint64_t seq) {
+        SeqKey key;
+        for (std::size_t i = 0; i < kSeqKeySize; ++i) {
+            key[i] = static_cast<char>(seq >> (8 * (kSeqKeySize - 1 - i)));
+        }
+        return key;
+    }
+
+    // Reads the sequence from the last 8 bytes of an in, out or snap key.
+    inline uint64_t seqFromKey(std::string_view key) {
+        uint64_t seq = 0;
+        for (std::size_t i = key.size() - kSeqKeySize; i < key.size(); ++i) {
+            seq = (seq << 8) | static_cast<uint8_t>(key[i]);
+        }
+        return seq;
+    }
+
+    inline std::string snapshotPrefix(std::string_view symbol) {
+        std::string prefix(symbol);
+        prefix += ':';
+        return prefix;
+    }
+
+    inline std::string snapshotKey(std::string_view symbol, uint64_t seq) {
+        std::string key = snapshotPrefix(symbol);
+        const SeqKey suffix = seqKey(seq);
+        key.append(suffix.data(), suffix.size());
+        return key;
+    }
+
+} // namespace wal
+
+#endif // OME_WAL_RECORD_H
@@ -0,0 +1,154 @@
+#include "wal/wal_manager.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compares the RocksDB tuning profiles (wal::RocksProfile) on the WAL's own workload:
+// concurrent inbound appends through the group commit, outbound processed marks,
+// large snapshot values, and a full inbound replay. A second table gives the latency
+// of a single inbound append per backend (wal::Backend, wal::SegmentIo).
+
+constexpr size_t NUM_RECORDS = 100000;
+constexpr size_t NUM_WRITERS = 4;
+constexpr size_t NUM_SNAPSHOTS = 16;
+constexpr size_t SNAPSHOT_BYTES = 4 << 20;
+constexpr size_t NUM_LATENCY_SAMPLES = 200000;
+
+struct LatencyCase {
+    const char* name;
+    wal::Backend backend;
+    wal::SegmentIo segmentIo;
+};
+
+struct BenchCase {
+    const char* name;
+    wal::RocksProfile profile;
+    wal::Durability durability;
+};
+
+static double since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void remove_db(const std::string& path) {
+    for (const char* suffix : {"", ".in", ".out"}) {
+        std::filesystem::remove_all(path + suffix);
+    }
+}
+
+void run_case(const BenchCase& bench, size_t index) {
+    const std::string path = "wal_bench_db" + std::to_string(index);
+    remove_db(path);
+
+    wal::WalOptions options;
+    options.rocksProfile = bench.profile;
+    options.durability = bench.durability;
+    options.keepSnapshots = 0;   // keep every record for the replay below
+
+    double inSeconds, outSeconds, snapSeconds, replaySeconds;
+    size_t replayed = 0;
+    wal::WalStats stats;
+    {
+        wal::WalManager wal(path, options);
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> writers;
+        for (size_t w = 0; w < NUM_WRITERS; ++w) {
+            writers.emplace_back([&wal, w] {
+                for (size_t i = w; i < NUM_RECORDS; i += NUM_WRITERS) {
+                    wal.appendInbound(engine::Command::makeNew(i % 2 == 0, 10000 + i % 64, 1 + i % 100));
+                }
+            });
+        }
+        for (auto& writer : writers) writer.join();
+        inSeconds = since(start);
+        stats = wal.stats();
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 1; i <= NUM_RECORDS; ++i) {
+            wal.markProcessed(0, i, engine::Event::makeFill(i, i + 1, 1, 10000));
+        }
+        outSeconds = since(start);
+
+        const std::string snapshot(SNAPSHOT_BYTES, 'x');
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 1; i <= NUM_SNAPSHOTS; ++i) {
+            wal.saveSnapshot("BENCH", snapshot, i * (NUM_RECORDS / NUM_SNAPSHOTS));
+        }
+        snapSeconds = since(start);
+
+        start = std::chrono::steady_clock::now();
+        wal.replayInbound(1, [&replayed](const wal::WalRecord&) {
+            ++replayed;
+            return true;
+        });
+        replaySeconds = since(start);
+    }
+    remove_db(path);
+
+    std::cout << "=== WAL Benchmark: " << bench.name << " ===\n";
+    std::cout << "Inbound: " << NUM_RECORDS / inSeconds << " records/sec ("
+              << static_cast<double>(stats.records) / std::max<uint64_t>(stats.groups, 1) << " per group, "
+              << stats.syncs << " syncs)\n";
+    std::cout << "Outbound marks: " << NUM_RECORDS / outSeconds << " records/sec\n";
+    std::cout << "Snapshots: " << NUM_SNAPSHOTS * SNAPSHOT_BYTES / snapSeconds / (1 << 20) << " MiB/sec\n";
+    std::cout << "Replay: " << replayed / replaySeconds << " records/sec (" << replayed << " records)\n";
+}
+
+void run_latency(const LatencyCase& bench, size_t index) {
+    const std::string path = "wal_latency_db" + std::to_string(index);
+    remove_db(path);
+
+    wal::WalOptions options;
+    options.backend = bench.backend;
+    options.segmentIo = bench.segmentIo;
+    options.keepSnapshots = 0;
+
+    std::vector<uint64_t> samples;
+    samples.reserve(NUM_LATENCY_SAMPLES);
+    {
+        wal::WalManager wal(path, options);
+        for (size_t i = 0; i < NUM_LATENCY_SAMPLES; ++i) {
+            const auto cmd = engine::Command::makeNew(i % 2 == 0, 10000 + i % 64, 1 + i % 100);
+            const auto start = std::chrono::steady_clock::now();
+            wal.appendInbound(cmd);
+            samples.push_back(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+        }
+    }
+    remove_db(path);
+
+    std::sort(samples.begin(), samples.end());
+    std::cout << "=== WAL append latency: " << bench.name << " ===\n";
+    std::cout << "p50: " << samples[samples.size() / 2] << " ns, p99: " << samples[samples.size() * 99 / 100]
+              << " ns, max: " << samples.back() << " ns (" << samples.size() << " appends, async)\n";
+}
+
+int main() {
+    const BenchCase cases[] = {
+        {"default, async", wal::RocksProfile::Default, wal::Durability::Async},
+        {"journal, async", wal::RocksProfile::Journal, wal::Durability::Async},
+        {"groupcommit, async", wal::RocksProfile::GroupCommit, wal::Durability::Async},
+        {"default, fsync per batch", wal::RocksProfile::Default, wal::Durability::PerBatch},
+        {"journal, fsync per batch", wal::RocksProfile::Journal, wal::Durability::PerBatch},
+        {"groupcommit, fsync per batch", wal::RocksProfile::GroupCommit, wal::Durability::PerBatch},
+    };
+    for (size_t i = 0; i < std::size(cases); ++i) {
+        run_case(cases[i], i);
+    }
+
+    const LatencyCase latencyCases[] = {
+        {"rocksdb", wal::Backend::RocksDB, wal::SegmentIo::Mmap},
+        {"segments, mmap", wal::Backend::Segments, wal::SegmentIo::Mmap},
+        {"segments, uring", wal::Backend::Segments, wal::SegmentIo::Uring},
+    };
+    for (size_t i = 0; i < std::size(latencyCases); ++i) {
+        run_latency(latencyCases[i], i);
+    }
+
+    return 0;
+}
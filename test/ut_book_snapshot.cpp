@@ -0,0 +1,213 @@
+#define BOOST_TEST_NO_MAIN OmeTest
+#include <boost/test/unit_test.hpp>
+
+#include "ut_utils.h"
+#include "engine/book_snapshot.h"
+#include "engine/matching_engine.h"
+#include "wal/wal_manager.h"
+
+#include <string>
+#include <vector>
+
+namespace engine {
+
+using book_snapshot::AccountPosition;
+using book_snapshot::Header;
+using book_snapshot::RestingOrder;
+using book_snapshot::View;
+
+namespace {
+std::vector<RestingOrder> sampleSide(uint64_t firstId, uint64_t price, int direction) {
+    std::vector<RestingOrder> side;
+    for (uint64_t i = 0; i < 5; ++i) {
+        side.push_back({firstId + i, price + direction * (i / 2), 100 + i, 60 + i,
+                        static_cast<uint32_t>(i % 3), static_cast<uint32_t>(7 + i), 0, 0});
+    }
+    return side;
+}
+
+bool sameEntries(std::span<const RestingOrder> a, std::span<const RestingOrder> b) {
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size_bytes()) == 0;
+}
+
+std::string latestSnapshot(wal::WalManager& wal, const std::string& symbol, uint64_t& seq) {
+    auto saved = wal.loadSnapshot(symbol, seq);
+    BOOST_REQUIRE(saved);
+    return *saved;
+}
+
+wal::WalOptions keepEverything() {
+    wal::WalOptions options;
+    options.keepSnapshots = 0;
+    return options;
+}
+
+// Round 0 builds a book of 40 orders; later rounds touch a few of them each, through
+// every kind of change a delta carries.
+void changeBook(MatchingEngine& engine, uint64_t round) {
+    if (round == 0) {
+        for (uint64_t i = 0; i < 20; ++i) {
+            engine.addOrder(true, 10000 - i % 4, 10 + i, 1 + i % 3, 5);
+            engine.addOrder(false, 10010 + i % 4, 10 + i, 4 + i % 3, 6);
+        }
+        return;
+    }
+    const uint64_t first = 1 + 2 * round;                  // a bid, then the ask after it
+    engine.addOrder(true, 9995 + round % 3, 7, 2, 5);      // joins the back of a level
+    engine.addOrder(false, 10000, 3, 9, 7);                // fills or part-fills the best bids
+    engine.modifyOrder(first + 1, 3, 0);                   // smaller: keeps its place
+    engine.modifyOrder(first + 4, 40, 0);                  // larger: requeued
+    engine.modifyOrder(first + 6, 2, 9990 - round);        // new price: requeued
+    engine.removeOrder(first + 9);
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(TestSnapshotEncodeDecodeRoundTrip) {
+    const auto bids = sampleSide(1, 10000, -1);
+    const auto asks = sampleSide(100, 10100, 1);
+    Header header{};
+    header.seq = 42;
+    header.lastOrderId = 104;
+    header.events = 17;
+    header.lastTradePrice = 10050;
+    const std::vector<AccountPosition> accounts{{1, 0, 30}, {4, 0, -30}};
+
+    std::string encoded;
+    book_snapshot::encode(header, bids, asks, accounts, encoded);
+    BOOST_CHECK_EQUAL(book_snapshot::encodedSize(bids.size(), asks.size(), accounts.size()), encoded.size());
+
+    View view;
+    BOOST_REQUIRE(book_snapshot::decode(encoded, view));
+    BOOST_CHECK_EQUAL(42U, view.header.seq);
+    BOOST_CHECK_EQUAL(104U, view.header.lastOrderId);
+    BOOST_CHECK_EQUAL(17U, view.header.events);
+    BOOST_CHECK_EQUAL(10050U, view.header.lastTradePrice);
+    BOOST_CHECK(sameEntries(bids, view.bids));
+    BOOST_CHECK(sameEntries(asks, view.asks));
+    BOOST_REQUIRE_EQUAL(2U, view.accounts.size());
+    BOOST_CHECK_EQUAL(4U, view.accounts[1].owner);
+    BOOST_CHECK_EQUAL(-30, view.accounts[1].position);
+}
+
+BOOST_AUTO_TEST_CASE(TestSnapshotDecodesFirstLayout) {
+    // Header without lastTradePrice and accountCount, orders straight after it.
+    const auto bids = sampleSide(1, 10000, -1);
+    Header header{};
+    std::memcpy(header.magic, book_snapshot::kMagic, sizeof(book_snapshot::kMagic));
+    header.version = book_snapshot::kVersion;
+    header.headerSize = book_snapshot::kMinHeaderSize;
+    header.seq = 9;
+    header.bidCount = bids.size();
+    std::string old(book_snapshot::kMinHeaderSize, '\0');
+    std::memcpy(old.data(), &header, old.size());
+    old.append(reinterpret_cast<const char*>(bids.data()), bids.size() * sizeof(RestingOrder));
+    const uint32_t crc = wal::crc32c(0, old.data(), old.size());
+    old.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    old.append(4, '\0');
+
+    View view;
+    BOOST_REQUIRE(book_snapshot::decode(old, view));
+    BOOST_CHECK_EQUAL(9U, view.header.seq);
+    BOOST_CHECK_EQUAL(0U, view.header.lastTradePrice);
+    BOOST_CHECK(sameEntries(bids, view.bids));
+    BOOST_CHECK(view.asks.empty());
+    BOOST_CHECK(view.accounts.empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestSnapshotDecodeRejectsDamage) {
+    const auto bids = sampleSide(1, 10000, -1);
+    std::string encoded;
+    book_snapshot::encode(Header{}, bids, {}, {}, encoded);
+
+    View view;
+    std::string flipped = encoded;
+    flipped[sizeof(Header) + 3] ^= 0x10;
+    BOOST_CHECK(!book_snapshot::decode(flipped, view));
+
+    std::string truncated = encoded.substr(0, encoded.size() - sizeof(RestingOrder));
+    BOOST_CHECK(!book_snapshot::decode(truncated, view));
+
+    std::string versioned = encoded;
+    versioned[4] = 2;
+    BOOST_CHECK(!book_snapshot::decode(versioned, view));
+}
+
+BOOST_AUTO_TEST_CASE(TestEngineSnapshotRestoresSameBook) {
+    ome_test::TempPath path;
+    Broadcaster broadcaster;
+    std::string saved;
+    uint64_t savedSeq = 0;
+    {
+        wal::WalManager wal(path, keepEverything());
+        MatchingEngine engine("TEST", &wal, &broadcaster);
+        engine.setSnapshotDeltas(0);
+        for (uint64_t i = 0; i < 20; ++i) {
+            engine.addOrder(true, 10000 - i % 4, 10 + i, 1 + i % 3, 5);
+            engine.addOrder(false, 10010 + i % 4, 10 + i, 4 + i % 3, 6);
+        }
+        engine.addOrder(false, 10000, 15, 9, 7);   // partially fills the best bid
+        engine.modifyOrder(3, 5, 0);
+        engine.removeOrder(8);
+        engine.takeSnapshot();
+        saved = latestSnapshot(wal, "TEST", savedSeq);
+    }
+
+    wal::WalManager wal(path, keepEverything());
+    MatchingEngine restored("TEST", &wal, &broadcaster);
+    restored.setSnapshotDeltas(0);
+    restored.recover();
+    BOOST_CHECK_EQUAL(41U, restored.orderIds().last());
+    restored.takeSnapshot();   // same seq: rewritten from the restored book
+
+    uint64_t seq = 0;
+    const std::string again = latestSnapshot(wal, "TEST", seq);
+    BOOST_CHECK_EQUAL(savedSeq, seq);
+    BOOST_CHECK(saved == again);
+
+    View view;
+    BOOST_REQUIRE(book_snapshot::decode(again, view));
+    BOOST_CHECK_EQUAL(19U, view.bids.size());
+    BOOST_CHECK_EQUAL(19U, view.asks.size());
+}
+
+BOOST_AUTO_TEST_CASE(TestDeltaChainRestoresSameBookAsFull) {
+    ome_test::TempPath deltaPath;
+    ome_test::TempPath fullPath;
+    Broadcaster broadcaster;
+    std::string full;
+    {
+        wal::WalManager deltaWal(deltaPath, keepEverything());
+        wal::WalManager fullWal(fullPath, keepEverything());
+        MatchingEngine withDeltas("TEST", &deltaWal, &broadcaster);
+        MatchingEngine fullOnly("TEST", &fullWal, &broadcaster);
+        withDeltas.setSnapshotDeltas(8);
+        fullOnly.setSnapshotDeltas(0);
+        for (uint64_t round = 0; round < 6; ++round) {
+            changeBook(withDeltas, round);
+            changeBook(fullOnly, round);
+            withDeltas.takeSnapshot();
+            fullOnly.takeSnapshot();
+        }
+        uint64_t seq = 0;
+        full = latestSnapshot(fullWal, "TEST", seq);
+        uint64_t baseSeq = 0;
+        latestSnapshot(deltaWal, "TEST", baseSeq);
+        std::size_t deltas = 0;
+        deltaWal.loadSnapshotDeltas("TEST", baseSeq, [&deltas](uint64_t, std::string_view) {
+            ++deltas;
+            return true;
+        });
+        BOOST_CHECK_EQUAL(5U, deltas);   // the chain under test: one full, then only deltas
+    }
+
+    // The book folded from the chain snapshots to the same bytes as the full one.
+    wal::WalManager wal(deltaPath, keepEverything());
+    MatchingEngine restored("TEST", &wal, &broadcaster);
+    restored.setSnapshotDeltas(0);
+    restored.recover();
+    restored.takeSnapshot();
+    uint64_t seq = 0;
+    BOOST_CHECK(full == latestSnapshot(wal, "TEST", seq));
+}
+
+} // namespace engine
@@ -0,0 +1,758 @@
+#define BOOST_TEST_NO_MAIN OmeTest
+#include <boost/test/unit_test.hpp>
+
+#include "ut_utils.h"
+#include "engine/book_snapshot.h"
+#include "engine/matching_engine.h"
+#include "engine/recovery.h"
+#include "engine/risk.h"
+#include "engine/sequencer.h"
+#include "engine/snapshot_replica.h"
+#include "wal/wal_manager.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace engine {
+
+namespace {
+// Keeps what the engine sends; refuses everything while refusing is set.
+class RecordingBroadcaster final : public Broadcaster {
+public:
+    bool publish(const Event& event) override {
+        if (refusing) return false;
+        events.push_back(event);
+        return true;
+    }
+
+    bool refusing{false};
+    std::vector<Event> events;
+};
+
+wal::WalOptions keepEverything() {
+    wal::WalOptions options;
+    options.keepSnapshots = 0;
+    return options;
+}
+
+// One resting buy filled by one sell: a single Fill event.
+void cross(MatchingEngine& engine, uint64_t price) {
+    engine.addOrder(true, price, 10, 1, 1);
+    engine.addOrder(false, price, 10, 2, 2);
+}
+
+// Resting bids and asks of engine's book, read back from a snapshot taken now.
+std::pair<std::size_t, std::size_t> restingOrders(MatchingEngine& engine, wal::WalManager& wal,
+                                                  const std::string& symbol) {
+    engine.setSnapshotDeltas(0);
+    engine.takeSnapshot();
+    uint64_t seq = 0;
+    const auto saved = wal.loadSnapshot(symbol, seq);
+    BOOST_REQUIRE(saved);
+    book_snapshot::View view;
+    BOOST_REQUIRE(book_snapshot::decode(*saved, view));
+    return {view.bids.size(), view.asks.size()};
+}
+
+// Recovers both engines one way or the other; the result must not depend on it.
+void recoverBoth(MatchingEngine& a, MatchingEngine& b, bool parallel) {
+    if (parallel) {
+        MatchingEngine* engines[] = {&a, &b};
+        recoverEngines(engines, 2);
+    } else {
+        a.recover();
+        b.recover();
+    }
+}
+
+// A mix of adds, fills, a requeueing modify and a cancel.
+void trade(MatchingEngine& engine, uint64_t price) {
+    for (uint64_t i = 0; i < 6; ++i) {
+        engine.addOrder(true, price - i % 3, 10 + i, 1 + i % 2, 1);
+        engine.addOrder(false, price + 5 + i % 3, 10 + i, 3 + i % 2, 2);
+    }
+    engine.addOrder(false, price, 15, 5, 3);
+    engine.modifyOrder(engine.orderIds().last() - 2, 30, price + 6);
+    engine.removeOrder(engine.orderIds().last() - 4);
+}
+
+// Full snapshot and deltas saved for symbol, in order.
+std::vector<std::string> savedSnapshots(wal::WalManager& wal, const std::string& symbol) {
+    uint64_t seq = 0;
+    const auto full = wal.loadSnapshot(symbol, seq);
+    BOOST_REQUIRE(full);
+    std::vector<std::string> saved{*full};
+    wal.loadSnapshotDeltas(symbol, seq, [&](uint64_t, std::string_view delta) {
+        saved.emplace_back(delta);
+        return true;
+    });
+    return saved;
+}
+
+// NewOrders written the way builds before shard stamping wrote them.
+void appendLegacyOrders(wal::WalManager& wal) {
+    wal.appendInbound(Command::makeNew(true, 10000, 10, 1));
+    wal.appendInbound(Command::makeNew(false, 10010, 10, 2));
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(TestRefusedEventsStayPending) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+
+    broadcaster.refusing = true;
+    cross(engine, 10000);
+    cross(engine, 10001);
+    BOOST_CHECK_EQUAL(0U, wal.processedMark(0));
+
+    broadcaster.refusing = false;
+    engine.releaseDurable();
+    BOOST_REQUIRE_EQUAL(2U, broadcaster.events.size());
+    BOOST_CHECK_EQUAL(10000U, broadcaster.events[0].fill.price);
+    BOOST_CHECK_EQUAL(10001U, broadcaster.events[1].fill.price);
+    BOOST_CHECK_EQUAL(2U, wal.processedMark(0));
+
+    cross(engine, 10002);
+    BOOST_CHECK_EQUAL(3U, broadcaster.events.size());
+    BOOST_CHECK_EQUAL(3U, wal.processedMark(0));
+}
+
+BOOST_AUTO_TEST_CASE(TestProcessedMarksArePerShard) {
+    ome_test::TempPath path;
+    {
+        wal::WalManager wal(path, keepEverything());
+        RecordingBroadcaster broadcaster;
+        MatchingEngine a("A", &wal, &broadcaster, nullptr, 1);
+        MatchingEngine b("B", &wal, &broadcaster, nullptr, 2);
+        cross(a, 10000);
+        cross(a, 10001);
+        cross(b, 20000);
+        BOOST_CHECK_EQUAL(2U, wal.processedMark(1));
+        BOOST_CHECK_EQUAL(1U, wal.processedMark(2));
+    }
+
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine a("A", &wal, &broadcaster, nullptr, 1);
+    MatchingEngine b("B", &wal, &broadcaster, nullptr, 2);
+    a.recover();
+    b.recover();
+    BOOST_CHECK(broadcaster.events.empty());   // all of it went out before the restart
+
+    // B's next event is its second; A's count must not make it look delivered.
+    cross(b, 20001);
+    BOOST_REQUIRE_EQUAL(1U, broadcaster.events.size());
+    BOOST_CHECK_EQUAL(20001U, broadcaster.events[0].fill.price);
+    BOOST_CHECK_EQUAL(2U, wal.processedMark(2));
+}
+
+BOOST_AUTO_TEST_CASE(TestSnapshotWaitsForItsEvents) {
+    ome_test::TempPath path;
+    {
+        wal::WalManager wal(path, keepEverything());
+        RecordingBroadcaster broadcaster;
+        MatchingEngine engine("TEST", &wal, &broadcaster);
+        engine.addOrder(true, 9990, 10, 1, 1);
+        broadcaster.refusing = true;
+        cross(engine, 10000);
+        engine.takeSnapshot();
+
+        uint64_t seq = 0;
+        BOOST_CHECK(!wal.loadSnapshot("TEST", seq));   // its fill has not gone out
+
+        broadcaster.refusing = false;
+        engine.releaseDurable();
+        BOOST_CHECK_EQUAL(1U, broadcaster.events.size());
+        BOOST_REQUIRE(wal.loadSnapshot("TEST", seq));
+        BOOST_CHECK_EQUAL(3U, seq);
+    }
+
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    engine.recover();
+    BOOST_CHECK(broadcaster.events.empty());
+    BOOST_CHECK_EQUAL(3U, engine.orderIds().last());
+}
+
+BOOST_AUTO_TEST_CASE(TestOrderIdsAreUniqueAcrossThreads) {
+    OrderIdAllocator ids(3);
+    std::vector<uint64_t> issued[2];
+    std::thread other([&] {
+        for (int i = 0; i < 10000; ++i) issued[1].push_back(ids.next());
+    });
+    for (int i = 0; i < 10000; ++i) issued[0].push_back(ids.next());
+    other.join();
+
+    std::set<uint64_t> unique(issued[0].begin(), issued[0].end());
+    unique.insert(issued[1].begin(), issued[1].end());
+    BOOST_CHECK_EQUAL(20000U, unique.size());
+    BOOST_CHECK_EQUAL(OrderIdAllocator::compose(3, 20000), ids.last());
+
+    ids.observe(OrderIdAllocator::compose(3, 5000));    // never moves back
+    ids.observe(OrderIdAllocator::compose(4, 30000));   // another shard's id
+    BOOST_CHECK_EQUAL(OrderIdAllocator::compose(3, 20000), ids.last());
+    ids.observe(OrderIdAllocator::compose(3, 30000));
+    BOOST_CHECK_EQUAL(OrderIdAllocator::compose(3, 30001), ids.next());
+}
+
+BOOST_AUTO_TEST_CASE(TestSequencerSharesEngineOrderIds) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    auto ring = std::make_unique<MatchingShard::Ring>();
+    Sequencer sequencer(&wal, ring.get(), &engine.orderIds());
+    sequencer.start();
+
+    sequencer.submit(Command::makeNew(true, 10000, 1));
+    engine.addOrder(true, 10000, 1);   // gateway path of the same shard
+    sequencer.submit(Command::makeNew(true, 10000, 1));
+    sequencer.stop();
+
+    std::vector<uint64_t> sequenced;
+    ring->consume([&](const Command& cmd) { sequenced.push_back(cmd.newOrder.orderId); });
+    BOOST_REQUIRE_EQUAL(2U, sequenced.size());
+    BOOST_CHECK_EQUAL(1U, sequenced[0]);
+    BOOST_CHECK_EQUAL(3U, sequenced[1]);
+    BOOST_CHECK_EQUAL(3U, engine.orderIds().last());
+}
+
+BOOST_AUTO_TEST_CASE(TestSubmitBatchSharesSequencerSequences) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    auto ring = std::make_unique<MatchingShard::Ring>();
+    Sequencer sequencer(&wal, ring.get(), &engine.orderIds());
+    sequencer.start();
+
+    BOOST_CHECK_EQUAL(1U, sequencer.submit(Command::makeNew(true, 9000, 1)));
+    BOOST_CHECK_EQUAL(2U, sequencer.submit(Command::makeNew(true, 9001, 1)));
+    const std::vector<Command> batch{Command::makeNew(true, 9002, 1), Command::makeNew(true, 9003, 1)};
+    engine.submitBatch(batch);
+    BOOST_CHECK_EQUAL(5U, sequencer.submit(Command::makeNew(true, 9004, 1)));
+    sequencer.stop();
+
+    std::vector<uint64_t> prices;
+    wal.replayInbound(1, [&](const wal::WalRecord& rec) {
+        BOOST_CHECK_EQUAL(prices.size() + 1, rec.id);
+        prices.push_back(rec.cmd.newOrder.price);
+        return true;
+    });
+    BOOST_CHECK(prices == std::vector<uint64_t>({9000, 9001, 9002, 9003, 9004}));
+}
+
+BOOST_AUTO_TEST_CASE(TestSubmitBatchEventsWaitBehindPending) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    std::atomic<uint64_t> durable{0};
+    engine.setDurableWatermark(&durable);
+
+    // Sequenced upstream, journaled, not yet published as durable: its fill is held back.
+    std::vector<Command> sequenced{Command::makeNew(true, 10000, 10, 0, 1), Command::makeNew(false, 10000, 10, 0, 2)};
+    sequenced[0].seq = wal.reserveSequences(2);
+    sequenced[1].seq = sequenced[0].seq + 1;
+    sequenced[0].newOrder.orderId = engine.orderIds().next();
+    sequenced[1].newOrder.orderId = engine.orderIds().next();
+    wal.appendInboundBatch(sequenced);
+    engine.apply(sequenced[0]);
+    engine.apply(sequenced[1]);
+
+    engine.submitBatch(std::vector<Command>{Command::makeNew(true, 10001, 10, 0, 1),
+                                            Command::makeNew(false, 10001, 10, 0, 2)});
+    BOOST_CHECK(broadcaster.events.empty());
+
+    durable = wal.lastSequence();
+    engine.releaseDurable();
+    BOOST_REQUIRE_EQUAL(2U, broadcaster.events.size());
+    BOOST_CHECK_EQUAL(10000U, broadcaster.events[0].fill.price);
+    BOOST_CHECK_EQUAL(10001U, broadcaster.events[1].fill.price);
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedJournalReplaysByJournalingShard) {
+    for (const bool parallel : {false, true}) {
+        ome_test::TempPath path;
+        {
+            wal::WalManager wal(path, keepEverything());
+            RecordingBroadcaster broadcaster;
+            MatchingEngine a("A", &wal, &broadcaster, nullptr, 1);
+            MatchingEngine b("B", &wal, &broadcaster, nullptr, 2);
+            // A client-supplied id whose high bits name B's shard still belongs to A.
+            a.submitBatch(std::vector<Command>{Command::makeNew(true, 10000, 10, OrderIdAllocator::compose(2, 7)),
+                                               Command::makeNew(true, 9999, 10)});
+            b.addOrder(false, 20000, 10, 3);
+            b.massCancel(3, MassCancel::AnySide, 0, UINT64_MAX);
+            b.addOrder(false, 20001, 10, 4);
+        }
+
+        wal::WalManager wal(path, keepEverything());
+        RecordingBroadcaster broadcaster;
+        MatchingEngine a("A", &wal, &broadcaster, nullptr, 1);
+        MatchingEngine b("B", &wal, &broadcaster, nullptr, 2);
+        recoverBoth(a, b, parallel);
+        BOOST_CHECK(restingOrders(a, wal, "A") == std::make_pair(std::size_t{2}, std::size_t{0}));
+        BOOST_CHECK(restingOrders(b, wal, "B") == std::make_pair(std::size_t{0}, std::size_t{1}));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestLegacyRecordsReplayOnShardZero) {
+    for (const bool parallel : {false, true}) {
+        ome_test::TempPath path;
+        wal::WalManager wal(path, keepEverything());
+        appendLegacyOrders(wal);
+        RecordingBroadcaster broadcaster;
+        MatchingEngine zero("A", &wal, &broadcaster, nullptr, 0);
+        MatchingEngine other("B", &wal, &broadcaster, nullptr, 4);
+        recoverBoth(zero, other, parallel);
+        BOOST_CHECK(restingOrders(zero, wal, "A") == std::make_pair(std::size_t{1}, std::size_t{1}));
+        BOOST_CHECK(restingOrders(other, wal, "B") == std::make_pair(std::size_t{0}, std::size_t{0}));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestLegacyRecordsReplayOnLoneEngine) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    appendLegacyOrders(wal);
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("A", &wal, &broadcaster, nullptr, 5);
+    engine.recover();
+    BOOST_CHECK(restingOrders(engine, wal, "A") == std::make_pair(std::size_t{1}, std::size_t{1}));
+}
+
+BOOST_AUTO_TEST_CASE(TestLegacyRecordsWithoutShardZeroThrow) {
+    for (const bool parallel : {false, true}) {
+        ome_test::TempPath path;
+        wal::WalManager wal(path, keepEverything());
+        appendLegacyOrders(wal);
+        RecordingBroadcaster broadcaster;
+        MatchingEngine a("A", &wal, &broadcaster, nullptr, 1);
+        MatchingEngine b("B", &wal, &broadcaster, nullptr, 2);
+        BOOST_CHECK_THROW(recoverBoth(a, b, parallel), std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestEnginesSharingAWalNeedDistinctShards) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine a("A", &wal, &broadcaster, nullptr, 1);
+    BOOST_CHECK_THROW(MatchingEngine("B", &wal, &broadcaster, nullptr, 1), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(TestSnapshotWaitsForDurableCut) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    std::atomic<uint64_t> durable{0};
+    engine.setDurableWatermark(&durable);
+
+    // A cancel of an unknown order publishes nothing: only the watermark holds the snapshot.
+    Command cancel = Command::makeCancel(12345);
+    cancel.seq = wal.reserveSequences(1);
+    engine.apply(cancel);
+    engine.takeSnapshot();
+    uint64_t seq = 0;
+    BOOST_CHECK(!wal.loadSnapshot("TEST", seq));
+
+    wal.appendInbound(cancel.seq, cancel);
+    durable = cancel.seq;
+    engine.releaseDurable();
+    BOOST_REQUIRE(wal.loadSnapshot("TEST", seq));
+    BOOST_CHECK_EQUAL(cancel.seq, seq);
+}
+
+BOOST_AUTO_TEST_CASE(TestReplicaSnapshotsMatchDirectOnes) {
+    ome_test::TempPath directPath;
+    ome_test::TempPath replicaPath;
+    wal::WalManager directWal(directPath, keepEverything());
+    wal::WalManager replicaWal(replicaPath, keepEverything());
+    RecordingBroadcaster directEvents;
+    RecordingBroadcaster replicaEvents;
+    MatchingEngine direct("TEST", &directWal, &directEvents, nullptr, 3);
+    MatchingEngine primary("TEST", &replicaWal, &replicaEvents, nullptr, 3);
+    direct.setSnapshotDeltas(4);
+    primary.setSnapshotDeltas(4);
+    SnapshotReplica replica(&primary, &replicaWal);
+    replica.start();
+
+    auto waitWritten = [&](uint64_t count) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (replica.snapshotsWritten() < count && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        BOOST_REQUIRE_EQUAL(count, replica.snapshotsWritten());
+    };
+    for (uint64_t round = 0; round < 3; ++round) {   // one full snapshot, then deltas
+        for (MatchingEngine* engine : {&direct, &primary}) {
+            if (round == 0) {
+                trade(*engine, 10000);
+            } else {
+                engine->addOrder(true, 9990 - round, 10, 1, 1);
+                engine->modifyOrder(engine->orderIds().last() - 1, 5, 0);
+            }
+        }
+        direct.takeSnapshot();
+        primary.takeSnapshot();
+        waitWritten(round + 1);
+    }
+    replica.stop();
+
+    const auto expected = savedSnapshots(directWal, "TEST");
+    BOOST_CHECK_EQUAL(3U, expected.size());
+    BOOST_CHECK(expected == savedSnapshots(replicaWal, "TEST"));
+}
+
+BOOST_AUTO_TEST_CASE(TestModifyKeepsPriorityOnlyForSmallerSize) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    for (int i = 0; i < 3; ++i) engine.addOrder(true, 10000, 10);   // ids 1, 2, 3
+    engine.addOrder(true, 9999, 10);                                // id 4
+
+    engine.modifyOrder(1, 6, 0);        // smaller: stays in front
+    engine.modifyOrder(2, 20, 0);       // larger: behind 3
+    engine.modifyOrder(4, 10, 10000);   // new price: behind 2
+    broadcaster.events.clear();
+    engine.addOrder(false, 10000, 46);  // id 5 sweeps the level
+
+    std::vector<std::pair<uint64_t, uint64_t>> fills;   // resting order, qty
+    for (const Event& event : broadcaster.events) {
+        if (event.type != MsgType::Fill) continue;
+        fills.emplace_back(event.fill.orderId == 5 ? event.fill.matchedId : event.fill.orderId, event.fill.qty);
+    }
+    const std::vector<std::pair<uint64_t, uint64_t>> expected{{1, 6}, {3, 10}, {2, 20}, {4, 10}};
+    BOOST_CHECK(expected == fills);
+}
+
+BOOST_AUTO_TEST_CASE(TestFailedModifiesAreRejected) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    engine.addOrder(true, 10000, 10);    // id 1
+    engine.addOrder(false, 10000, 4);    // id 2 fills 4 of it
+    const uint64_t journaled = wal.lastSequence();
+    broadcaster.events.clear();
+
+    engine.modifyOrder(1, 4, 0);     // nothing would stay open
+    engine.modifyOrder(1, 0, 0);
+    engine.modifyOrder(9, 5, 0);     // not live
+    engine.addOrder(true, 10000, 0); // the book refuses it
+    BOOST_CHECK_EQUAL(journaled + 1, wal.lastSequence());   // only the add
+    BOOST_REQUIRE_EQUAL(4U, broadcaster.events.size());
+    const char* reasons[] = {"qty at or below filled", "qty at or below filled", "unknown order",
+                             "size must be positive"};
+    const uint64_t ids[] = {1, 1, 9, 3};
+    for (std::size_t i = 0; i < 4; ++i) {
+        BOOST_CHECK(MsgType::Reject == broadcaster.events[i].type);
+        BOOST_CHECK_EQUAL(ids[i], broadcaster.events[i].reject.orderId);
+        BOOST_CHECK_EQUAL(std::string(reasons[i]), broadcaster.events[i].reject.reason);
+    }
+
+    engine.modifyOrder(1, 5, 0);     // one still open: accepted
+    BOOST_CHECK_EQUAL(journaled + 2, wal.lastSequence());
+    BOOST_CHECK_EQUAL(4U, broadcaster.events.size());
+}
+
+BOOST_AUTO_TEST_CASE(TestMassCancelFiltersAndAggregates) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    for (uint64_t qty = 1; qty <= 3; ++qty) engine.addOrder(true, 9990, qty, 1);   // ids 1-3
+    engine.addOrder(true, 9980, 4, 1);       // id 4
+    engine.addOrder(true, 9970, 5, 1);       // below the range
+    engine.addOrder(false, 10010, 6, 1);     // other side
+    engine.addOrder(false, 10010, 7, 1);
+    engine.addOrder(true, 9990, 8, 2);       // other owner
+    const uint64_t journaled = wal.lastSequence();
+    broadcaster.events.clear();
+
+    engine.massCancel(1, MassCancel::BuySide, 9975, 10000);
+    BOOST_CHECK_EQUAL(journaled + 1, wal.lastSequence());
+
+    std::set<uint64_t> cancelled;
+    std::vector<LevelUpdate> levels;
+    for (const Event& event : broadcaster.events) {
+        if (event.type == MsgType::Ack) {
+            BOOST_CHECK(Ack::Cancelled == event.ack.kind);
+            BOOST_CHECK(cancelled.insert(event.ack.orderId).second);
+        } else {
+            BOOST_REQUIRE(MsgType::LevelUpdate == event.type);
+            levels.push_back(event.levelUpdate);
+        }
+    }
+    BOOST_CHECK(std::set<uint64_t>({1, 2, 3, 4}) == cancelled);
+    BOOST_REQUIRE_EQUAL(2U, levels.size());
+    BOOST_CHECK_EQUAL(9980U, levels[0].price);
+    BOOST_CHECK_EQUAL(-4, levels[0].qtyDelta);
+    BOOST_CHECK_EQUAL(-1, levels[0].orderDelta);
+    BOOST_CHECK_EQUAL(9990U, levels[1].price);
+    BOOST_CHECK_EQUAL(-6, levels[1].qtyDelta);
+    BOOST_CHECK_EQUAL(-3, levels[1].orderDelta);
+    for (const auto& level : levels) BOOST_CHECK(level.isBuy);
+
+    const auto [bids, asks] = restingOrders(engine, wal, "TEST");
+    BOOST_CHECK_EQUAL(2U, bids);   // 9970 and the other owner's
+    BOOST_CHECK_EQUAL(2U, asks);
+}
+
+BOOST_AUTO_TEST_CASE(TestLiveOrderIdsCannotBeReused) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    engine.apply(Command::makeNew(true, 9990, 10, 500, 1));
+    const uint64_t journaled = wal.lastSequence();
+    broadcaster.events.clear();
+
+    engine.apply(Command::makeNew(true, 9991, 10, 500, 1));                      // direct
+    const Command batch[] = {Command::makeNew(true, 9992, 10, 500, 1),           // live
+                             Command::makeNew(true, 9993, 10, 501, 1),
+                             Command::makeNew(true, 9994, 10, 501, 1)};          // earlier in the batch
+    engine.submitBatch(batch);
+    Command sequenced = Command::makeNew(true, 9995, 10, 501, 1);                // journaled upstream
+    sequenced.seq = wal.reserveSequences(1);
+    wal.appendInbound(sequenced.seq, sequenced);
+    engine.apply(sequenced);
+    BOOST_CHECK_EQUAL(journaled + 2, wal.lastSequence());   // id 501 once, and the sequenced one
+
+    std::size_t rejects = 0;
+    for (const Event& event : broadcaster.events) {
+        if (event.type != MsgType::Reject) continue;
+        ++rejects;
+        BOOST_CHECK_EQUAL(std::string("duplicate order id"), event.reject.reason);
+    }
+    BOOST_CHECK_EQUAL(4U, rejects);
+
+    // Each id is linked once: the owner's list walks to its end.
+    broadcaster.events.clear();
+    engine.massCancel(1, MassCancel::AnySide, 0, UINT64_MAX);
+    std::set<uint64_t> cancelled;
+    for (const Event& event : broadcaster.events) {
+        if (event.type == MsgType::Ack) BOOST_CHECK(cancelled.insert(event.ack.orderId).second);
+    }
+    BOOST_CHECK(std::set<uint64_t>({500, 501}) == cancelled);
+    const auto [bids, asks] = restingOrders(engine, wal, "TEST");
+    BOOST_CHECK_EQUAL(0U, bids + asks);
+}
+
+BOOST_AUTO_TEST_CASE(TestCancelSessionLeavesOtherSessions) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    for (uint64_t i = 0; i < 6; ++i) {
+        engine.addOrder(i % 2 == 0, i % 2 == 0 ? 9990 - i : 10010 + i, 10, 1, 1 + i % 3);   // sessions 1-3
+    }
+    broadcaster.events.clear();
+
+    engine.cancelSession(2);
+    std::set<uint64_t> cancelled;
+    for (const Event& event : broadcaster.events) {
+        if (event.type == MsgType::Ack) cancelled.insert(event.ack.orderId);
+    }
+    BOOST_CHECK(std::set<uint64_t>({2, 5}) == cancelled);
+    auto [bids, asks] = restingOrders(engine, wal, "TEST");
+    BOOST_CHECK_EQUAL(4U, bids + asks);
+
+    engine.cancelSession(2);   // nothing left under it
+    std::tie(bids, asks) = restingOrders(engine, wal, "TEST");
+    BOOST_CHECK_EQUAL(4U, bids + asks);
+
+    // The owner's list lost the same orders: cancelling the owner takes exactly the rest.
+    broadcaster.events.clear();
+    engine.massCancel(1, MassCancel::AnySide, 0, UINT64_MAX);
+    cancelled.clear();
+    for (const Event& event : broadcaster.events) {
+        if (event.type == MsgType::Ack) BOOST_CHECK(cancelled.insert(event.ack.orderId).second);
+    }
+    BOOST_CHECK(std::set<uint64_t>({1, 3, 4, 6}) == cancelled);
+    std::tie(bids, asks) = restingOrders(engine, wal, "TEST");
+    BOOST_CHECK_EQUAL(0U, bids + asks);
+}
+
+BOOST_AUTO_TEST_CASE(TestRiskCollarSkipsMarketOrders) {
+    RiskLimits limits;
+    limits.priceCollarBps = 100;
+    PreTradeRisk risk(limits);
+    risk.onTrade(10000);
+    BOOST_CHECK(risk.check(Command::makeNew(true, 0, 10).newOrder) == nullptr);
+    BOOST_CHECK(risk.check(Command::makeNew(true, 10100, 10).newOrder) == nullptr);
+    BOOST_CHECK_EQUAL(std::string("price collar"), risk.check(Command::makeNew(true, 10101, 10).newOrder));
+}
+
+BOOST_AUTO_TEST_CASE(TestRiskPositionCountsOpenOrders) {
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    RiskLimits limits;
+    limits.maxPosition = 100;
+    PreTradeRisk risk(limits);
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    engine.setRiskCheck(&risk);
+
+    engine.addOrder(true, 10000, 60, 1);
+    engine.addOrder(true, 9990, 30, 1);
+    engine.modifyOrder(engine.orderIds().last(), 20, 0);   // 80 open on the buy side
+    BOOST_CHECK_EQUAL(80U, risk.account(1).openBuyQty);
+    BOOST_CHECK(risk.check(Command::makeNew(true, 10000, 20, 0, 1).newOrder) == nullptr);
+    BOOST_CHECK_EQUAL(std::string("max position"), risk.check(Command::makeNew(true, 10000, 21, 0, 1).newOrder));
+    BOOST_CHECK(risk.check(Command::makeNew(false, 10000, 100, 0, 1).newOrder) == nullptr);
+
+    engine.addOrder(false, 10000, 50, 2);   // fills 50 of the resting 60
+    BOOST_CHECK_EQUAL(50, risk.account(1).position);
+    BOOST_CHECK_EQUAL(30U, risk.account(1).openBuyQty);
+    engine.removeOrder(engine.orderIds().last() - 1);
+    BOOST_CHECK_EQUAL(10U, risk.account(1).openBuyQty);
+    BOOST_CHECK_EQUAL(1U, risk.account(1).openOrders);
+}
+
+BOOST_AUTO_TEST_CASE(TestRiskCountsOrdersNotYetOnTheBook) {
+    RiskLimits limits;
+    limits.maxOpenOrders = 3;
+    limits.maxPosition = 100;
+    PreTradeRisk risk(limits);
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    engine.setRiskCheck(&risk);
+
+    // Batch: every order sees the ones admitted before it.
+    std::vector<Command> batch;
+    for (int i = 0; i < 5; ++i) batch.push_back(Command::makeNew(true, 9990 - i, 10, 0, 1));
+    engine.submitBatch(batch);
+    std::vector<std::string> rejects;
+    for (const Event& event : broadcaster.events) {
+        if (event.type == MsgType::Reject) rejects.emplace_back(event.reject.reason);
+    }
+    BOOST_CHECK(std::vector<std::string>(2, "max open orders") == rejects);
+    BOOST_CHECK_EQUAL(3U, restingOrders(engine, wal, "TEST").first);
+    AccountRisk acct = risk.account(1);
+    BOOST_CHECK_EQUAL(3U, acct.openOrders);
+    BOOST_CHECK_EQUAL(0U, acct.pendingOrders + acct.pendingBuyQty);   // settled
+
+    // Sequencer: nothing reaches the book until the shard drains, so only the
+    // reservations stop the burst.
+    auto ring = std::make_unique<MatchingShard::Ring>();
+    Sequencer sequencer(&wal, ring.get(), &engine.orderIds());
+    sequencer.setRiskCheck(&risk);
+    sequencer.start();
+    std::size_t admitted = 0;
+    const char* reason = nullptr;
+    for (int i = 0; i < 5; ++i) admitted += sequencer.submit(Command::makeNew(false, 10010, 45, 0, 2), &reason) != 0;
+    sequencer.stop();
+    BOOST_CHECK_EQUAL(2U, admitted);   // a third sell would make 135 open
+    BOOST_CHECK_EQUAL(std::string("max position"), reason);
+    BOOST_CHECK_EQUAL(90U, risk.account(2).pendingSellQty);
+
+    ring->consume([&](const Command& cmd) { engine.apply(cmd); });
+    acct = risk.account(2);
+    BOOST_CHECK_EQUAL(2U, acct.openOrders);
+    BOOST_CHECK_EQUAL(90U, acct.openSellQty);
+    BOOST_CHECK_EQUAL(0U, acct.pendingOrders + acct.pendingSellQty);
+}
+
+BOOST_AUTO_TEST_CASE(TestRiskChecksReplaces) {
+    RiskLimits limits;
+    limits.maxOrderQty = 50;
+    limits.priceCollarBps = 100;
+    limits.maxPosition = 100;
+    PreTradeRisk risk(limits);
+    ome_test::TempPath path;
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    engine.setRiskCheck(&risk);
+    engine.addOrder(true, 10000, 10, 1);
+    engine.addOrder(false, 10000, 10, 2);   // trades at 10000: sets the collar
+    engine.addOrder(true, 9990, 40, 1);     // id 3
+    engine.addOrder(true, 9980, 40, 1);     // id 4: 80 open on the buy side
+    const uint64_t journaled = wal.lastSequence();
+    broadcaster.events.clear();
+
+    engine.modifyOrder(3, 60, 0);           // over the order size limit
+    engine.modifyOrder(3, 40, 10200);       // outside the collar
+    // Long 10: 90 open would reach 100, the second increase 110.
+    const Command batch[] = {Command::makeReplace(3, 50, 0), Command::makeReplace(4, 50, 0)};
+    engine.submitBatch(batch);
+    engine.modifyOrder(4, 20, 9900);        // smaller and inside the collar
+    engine.modifyOrder(4, 10, 0);           // shrinking always passes
+
+    std::vector<std::string> rejects;
+    for (const Event& event : broadcaster.events) {
+        if (event.type == MsgType::Reject) rejects.emplace_back(event.reject.reason);
+    }
+    const std::vector<std::string> expected{"max order qty", "price collar", "max position"};
+    BOOST_CHECK(expected == rejects);
+    BOOST_CHECK_EQUAL(journaled + 3, wal.lastSequence());
+    const AccountRisk acct = risk.account(1);
+    BOOST_CHECK_EQUAL(60U, acct.openBuyQty);
+    BOOST_CHECK_EQUAL(0U, acct.pendingBuyQty);
+}
+
+BOOST_AUTO_TEST_CASE(TestRiskStateSurvivesRecovery) {
+    RiskLimits limits;
+    limits.priceCollarBps = 100;
+    ome_test::TempPath path;
+    PreTradeRisk before(limits);
+    {
+        wal::WalManager wal(path, keepEverything());
+        RecordingBroadcaster broadcaster;
+        MatchingEngine engine("TEST", &wal, &broadcaster);
+        engine.setRiskCheck(&before);
+        engine.addOrder(true, 10000, 60, 1);
+        engine.addOrder(false, 10000, 50, 2);
+        engine.addOrder(false, 10020, 40, 2);
+        engine.takeSnapshot();
+        // After the snapshot: rebuilt by replay.
+        engine.addOrder(true, 10020, 15, 3);
+        engine.addOrder(true, 9990, 5, 3);
+    }
+
+    wal::WalManager wal(path, keepEverything());
+    RecordingBroadcaster broadcaster;
+    PreTradeRisk after(limits);
+    MatchingEngine engine("TEST", &wal, &broadcaster);
+    engine.setRiskCheck(&after);
+    engine.recover();
+    for (const uint32_t owner : {1U, 2U, 3U}) {
+        BOOST_CHECK_EQUAL(before.account(owner).position, after.account(owner).position);
+        BOOST_CHECK_EQUAL(before.account(owner).openOrders, after.account(owner).openOrders);
+        BOOST_CHECK_EQUAL(before.account(owner).openBuyQty, after.account(owner).openBuyQty);
+        BOOST_CHECK_EQUAL(before.account(owner).openSellQty, after.account(owner).openSellQty);
+    }
+    BOOST_CHECK_EQUAL(50, after.account(1).position);
+    BOOST_CHECK_EQUAL(-65, after.account(2).position);
+    // The last trade (10020) survives too: the collar is centred on it.
+    BOOST_CHECK(after.check(Command::makeNew(true, 10120, 1).newOrder) == nullptr);
+    BOOST_CHECK(after.check(Command::makeNew(true, 9900, 1).newOrder) != nullptr);
+
+    // Positions ride along in the next snapshot, full or delta, without replay.
+    engine.takeSnapshot();
+    PreTradeRisk again(limits);
+    MatchingEngine restored("TEST", &wal, &broadcaster);
+    restored.setRiskCheck(&again);
+    restored.recover();
+    BOOST_CHECK_EQUAL(50, again.account(1).position);
+    BOOST_CHECK_EQUAL(15, again.account(3).position);
+    BOOST_CHECK(again.check(Command::makeNew(true, 9900, 1).newOrder) != nullptr);
+}
+
+} // namespace engine
@@ -0,0 +1,44 @@
+#ifndef OME_UT_UTILS_H
+#define OME_UT_UTILS_H
+
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+namespace ome_test {
+
+    // A fresh WAL location under the temp directory, removed again with its segment
+    // files (path.in, path.out...) when the test ends.
+    class TempPath {
+    public:
+        TempPath() {
+            static std::atomic<int> counter{0};
+            path_ = (std::filesystem::temp_directory_path() /
+                     ("ome_ut_" + std::to_string(::getpid()) + "_" + std::to_string(counter++))).string();
+            remove();
+        }
+        TempPath(const TempPath&) = delete;
+        ~TempPath() { remove(); }
+
+        const std::string& str() const { return path_; }
+        operator const std::string&() const { return path_; }
+
+    private:
+        void remove() const {
+            const std::filesystem::path path(path_);
+            std::error_code ec;
+            for (const auto& entry : std::filesystem::directory_iterator(path.parent_path(), ec)) {
+                const std::string name = entry.path().filename().string();
+                if (name == path.filename().string() || name.starts_with(path.filename().string() + ".")) {
+                    std::filesystem::remove_all(entry.path(), ec);
+                }
+            }
+        }
+
+        std::string path_;
+    };
+
+} // namespace ome_test
+
+#endif // OME_UT_UTILS_H
@@ -0,0 +1,354 @@
+#define BOOST_TEST_NO_MAIN OmeTest
+#include <boost/test/unit_test.hpp>
+
+#include "ut_utils.h"
+#include "engine/messages_json.h"
+#include "wal/segment_journal.h"
+#include "wal/wal_manager.h"
+#include "wal/wal_record.h"
+
+#include <rocksdb/db.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wal {
+
+namespace {
+WalOptions keepEverything(Backend backend = Backend::RocksDB) {
+    WalOptions options;
+    options.backend = backend;
+    options.keepSnapshots = 0;
+    return options;
+}
+
+std::vector<uint64_t> scannedSeqs(const Journal& journal, uint64_t from = 1) {
+    std::vector<uint64_t> seqs;
+    journal.scan(from, [&seqs](uint64_t seq, std::string_view) {
+        seqs.push_back(seq);
+        return true;
+    });
+    return seqs;
+}
+
+void appendSeqs(Journal& journal, std::initializer_list<uint64_t> seqs) {
+    static const std::string record(64, 'r');
+    std::vector<Journal::Entry> entries;
+    for (const uint64_t seq : seqs) entries.push_back({seq, record});
+    journal.append(entries);
+}
+
+WalOptions smallSegments() {
+    WalOptions options = keepEverything(Backend::Segments);
+    options.segmentSize = 4096;
+    return options;
+}
+
+std::vector<uint64_t> replayedSeqs(WalManager& wal, uint64_t from = 1) {
+    std::vector<uint64_t> seqs;
+    wal.replayInbound(from, [&seqs](const WalRecord& rec) {
+        seqs.push_back(rec.id);
+        return true;
+    });
+    return seqs;
+}
+// Writes a WAL the way builds before fixed-width keys did: decimal keys, no format
+// marker. Inbound records in `migrated` already carry their new key, as if an earlier
+// migration had stopped partway.
+void writeLegacyWal(const std::string& path, uint64_t records, const std::set<uint64_t>& migrated) {
+    std::vector<rocksdb::ColumnFamilyDescriptor> descriptors{
+        {rocksdb::kDefaultColumnFamilyName, {}}, {"in", {}}, {"out", {}}, {"snap", {}}};
+    rocksdb::Options options;
+    options.create_if_missing = true;
+    options.create_missing_column_families = true;
+    std::vector<rocksdb::ColumnFamilyHandle*> handles;
+    rocksdb::DB* db = nullptr;
+    BOOST_REQUIRE(rocksdb::DB::Open(options, path, descriptors, &handles, &db).ok());
+    for (uint64_t seq = 1; seq <= records; ++seq) {
+        const std::string value = nlohmann::json{
+            {"id", seq}, {"type", "add"}, {"payload", {{"side", "BUY"}, {"price", 10000 + seq}, {"qty", 1}}}}.dump();
+        if (migrated.count(seq)) {
+            const SeqKey key = seqKey(seq);
+            db->Put(rocksdb::WriteOptions(), handles[1], rocksdb::Slice(key.data(), key.size()), value);
+        } else {
+            db->Put(rocksdb::WriteOptions(), handles[1], std::to_string(seq), value);
+        }
+    }
+    db->Put(rocksdb::WriteOptions(), handles[2], "7", R"({"type":"trade"})");
+    // keyed by the outbound event count, not an inbound sequence
+    db->Put(rocksdb::WriteOptions(), handles[3], "BTC:7", R"({"bids":[],"asks":[]})");
+    for (auto* h : handles) db->DestroyColumnFamilyHandle(h);
+    delete db;
+}
+
+bool hasFifoMarker(const std::string& path) {
+    std::vector<std::string> names;
+    BOOST_REQUIRE(rocksdb::DB::ListColumnFamilies(rocksdb::Options(), path, &names).ok());
+    return std::find(names.begin(), names.end(), "fifo") != names.end();
+}
+
+WalOptions withProfile(RocksProfile profile) {
+    WalOptions options = keepEverything();
+    options.rocksProfile = profile;
+    return options;
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(TestLegacyKeysMigrate) {
+    ome_test::TempPath path;
+    writeLegacyWal(path, 12, {});
+    {
+        WalManager wal(path, keepEverything());
+        BOOST_CHECK_EQUAL(12U, wal.lastSequence());
+        const auto seqs = replayedSeqs(wal);
+        BOOST_REQUIRE_EQUAL(12U, seqs.size());
+        for (uint64_t i = 0; i < seqs.size(); ++i) BOOST_CHECK_EQUAL(i + 1, seqs[i]);
+        uint64_t snapshotSeq = 0;
+        BOOST_CHECK(!wal.loadSnapshot("BTC", snapshotSeq));   // recovery replays from 1 instead
+        BOOST_CHECK_EQUAL(7U, wal.processedMark(0));
+    }
+    // The format marker makes the second open skip the migration.
+    WalManager wal(path, keepEverything());
+    BOOST_CHECK_EQUAL(12U, replayedSeqs(wal).size());
+}
+
+BOOST_AUTO_TEST_CASE(TestInterruptedKeyMigrationResumes) {
+    ome_test::TempPath path;
+    writeLegacyWal(path, 12, {1, 2, 3, 4, 5});
+    WalManager wal(path, keepEverything());
+    BOOST_CHECK_EQUAL(12U, wal.lastSequence());
+    const auto seqs = replayedSeqs(wal);
+    BOOST_REQUIRE_EQUAL(12U, seqs.size());
+    for (uint64_t i = 0; i < seqs.size(); ++i) BOOST_CHECK_EQUAL(i + 1, seqs[i]);
+}
+
+BOOST_AUTO_TEST_CASE(TestReplayApplyThrowStopsPrefetch) {
+    ome_test::TempPath path;
+    WalManager wal(path, keepEverything());
+    const std::size_t records = 3 * WalManager::kReplayReadahead;
+    for (std::size_t i = 0; i < records; ++i) {
+        wal.appendInbound(engine::Command::makeNew(i % 2 == 0, 10000, 1));
+    }
+
+    std::size_t applied = 0;
+    BOOST_CHECK_THROW(wal.replayInbound(1, [&applied](const WalRecord&) -> bool {
+        if (++applied == 10) throw std::runtime_error("apply failed");
+        return true;
+    }), std::runtime_error);
+    BOOST_CHECK_EQUAL(10U, applied);
+
+    // The journal is still usable afterwards.
+    BOOST_CHECK_EQUAL(records, replayedSeqs(wal).size());
+}
+
+BOOST_AUTO_TEST_CASE(TestUringWritesAreNotDurableBeforeSync) {
+    ome_test::TempPath path;
+    WalOptions options = keepEverything(Backend::Segments);
+    options.segmentIo = SegmentIo::Uring;
+    options.segmentSize = 1 << 20;
+    options.durability = Durability::Periodic;
+    options.syncEveryRecords = 1000;
+    SegmentJournal journal(path.str() + ".in", options);
+
+    const std::string record(100, 'r');
+    for (uint64_t seq = 1; seq <= 10; ++seq) {
+        const Journal::Entry entry{seq, record};
+        journal.append({&entry, 1});   // written, no sync due yet
+    }
+    BOOST_CHECK_EQUAL(10U, journal.lastSequence());
+    BOOST_CHECK_EQUAL(0U, journal.durableSequence());
+
+    journal.sync();
+    BOOST_CHECK_EQUAL(10U, journal.durableSequence());
+
+    std::vector<Journal::Entry> batch;
+    for (uint64_t seq = 11; seq <= 1000; ++seq) batch.push_back({seq, record});
+    journal.append(batch);   // reaches syncEveryRecords: its last slot syncs
+    BOOST_CHECK_EQUAL(1000U, journal.durableSequence());
+}
+
+BOOST_AUTO_TEST_CASE(TestSegmentRejectedBatchWritesNothing) {
+    ome_test::TempPath path;
+    {
+        SegmentJournal journal(path.str() + ".out", smallSegments());
+        appendSeqs(journal, {1, 2, 3});
+        BOOST_CHECK_THROW(appendSeqs(journal, {4, 5, 5, 6}), std::invalid_argument);
+        BOOST_CHECK_EQUAL(3U, journal.lastSequence());
+        appendSeqs(journal, {5, 6, 7});
+    }
+    SegmentJournal reopened(path.str() + ".out", smallSegments());
+    BOOST_CHECK(scannedSeqs(reopened) == std::vector<uint64_t>({1, 2, 3, 5, 6, 7}));
+}
+
+BOOST_AUTO_TEST_CASE(TestRocksProcessedMarksMustIncrease) {
+    ome_test::TempPath path;
+    WalManager wal(path, keepEverything());
+    const auto event = engine::Event::makeFill(1, 2, 1, 10000);
+    wal.markProcessed(0, 5, event);
+    BOOST_CHECK_THROW(wal.markProcessed(0, 5, event), std::invalid_argument);
+    BOOST_CHECK_THROW(wal.markProcessed(0, 3, event), std::invalid_argument);
+    wal.markProcessed(3, 1, event);   // shards count on their own
+    wal.markProcessed(0, 6, event);
+    BOOST_CHECK_EQUAL(6U, wal.processedMark(0));
+    BOOST_CHECK_EQUAL(1U, wal.processedMark(3));
+}
+
+BOOST_AUTO_TEST_CASE(TestDenseJournalSkipsRejectedSequences) {
+    ome_test::TempPath path;
+    {
+        SegmentJournal journal(path.str() + ".in", smallSegments(), SequenceOrder::Dense);
+        appendSeqs(journal, {1, 2, 3});
+        BOOST_CHECK_THROW(appendSeqs(journal, {4, 5, 5, 6}), std::invalid_argument);
+        // 4..6 were handed to the rejected batch: nobody waits for them, nor may reuse them
+        BOOST_CHECK_THROW(appendSeqs(journal, {5, 6, 7}), std::invalid_argument);
+        appendSeqs(journal, {8, 9});
+    }
+    SegmentJournal reopened(path.str() + ".in", smallSegments(), SequenceOrder::Dense);
+    BOOST_CHECK(scannedSeqs(reopened) == std::vector<uint64_t>({1, 2, 3, 8, 9}));
+}
+
+BOOST_AUTO_TEST_CASE(TestSegmentReopenContinuesLog) {
+    ome_test::TempPath path;
+    const std::string record(200, 'x');   // about 19 frames per 4 KiB segment
+    {
+        SegmentJournal journal(path.str() + ".in", smallSegments(), SequenceOrder::Dense);
+        for (uint64_t seq = 1; seq <= 100; ++seq) {
+            const Journal::Entry entry{seq, record};
+            journal.append({&entry, 1});
+        }
+    }
+    {
+        SegmentJournal journal(path.str() + ".in", smallSegments(), SequenceOrder::Dense);
+        BOOST_CHECK_EQUAL(100U, journal.lastSequence());
+        BOOST_CHECK_EQUAL(100U, scannedSeqs(journal).size());
+        BOOST_CHECK_EQUAL(51U, scannedSeqs(journal, 51).front());
+        for (uint64_t seq = 101; seq <= 150; ++seq) {
+            const Journal::Entry entry{seq, record};
+            journal.append({&entry, 1});
+        }
+    }
+    SegmentJournal journal(path.str() + ".in", smallSegments(), SequenceOrder::Dense);
+    const auto seqs = scannedSeqs(journal);
+    BOOST_REQUIRE_EQUAL(150U, seqs.size());
+    for (uint64_t i = 0; i < seqs.size(); ++i) BOOST_CHECK_EQUAL(i + 1, seqs[i]);
+}
+
+BOOST_AUTO_TEST_CASE(TestConcurrentInboundAppendsStayInOrder) {
+    for (const Backend backend : {Backend::Segments, Backend::RocksDB}) {
+        ome_test::TempPath path;
+        WalManager wal(path, keepEverything(backend));
+        std::vector<std::thread> writers;
+        for (int w = 0; w < 4; ++w) {
+            writers.emplace_back([&wal] {
+                for (int i = 0; i < 1000; ++i) wal.appendInbound(engine::Command::makeNew(true, 10000, 1));
+            });
+        }
+        for (auto& writer : writers) writer.join();
+
+        const auto seqs = replayedSeqs(wal);
+        BOOST_REQUIRE_EQUAL(4000U, seqs.size());
+        for (uint64_t i = 0; i < seqs.size(); ++i) BOOST_CHECK_EQUAL(i + 1, seqs[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestInboundAppendWaitsForReservedSequences) {
+    ome_test::TempPath path;
+    WalManager wal(path, keepEverything(Backend::Segments));
+    const uint64_t reserved = wal.reserveSequences(2);
+
+    std::atomic<uint64_t> inline_{0};
+    std::thread writer([&] { inline_ = wal.appendInbound(engine::Command::makeCancel(7)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    BOOST_CHECK_EQUAL(0U, inline_.load());   // 3 waits for 1 and 2
+
+    std::vector<engine::Command> batch{engine::Command::makeNew(true, 10000, 1), engine::Command::makeNew(false, 10000, 1)};
+    batch[0].seq = reserved;
+    batch[1].seq = reserved + 1;
+    wal.appendInboundBatch(batch);
+    writer.join();
+    BOOST_CHECK_EQUAL(3U, inline_.load());
+    BOOST_CHECK(replayedSeqs(wal) == std::vector<uint64_t>({1, 2, 3}));
+}
+
+BOOST_AUTO_TEST_CASE(TestSegmentSizeIsValidated) {
+    ome_test::TempPath path;
+    WalOptions options = keepEverything(Backend::Segments);
+    options.segmentSize = 0;
+    BOOST_CHECK_THROW(SegmentJournal(path.str() + ".in", options), std::invalid_argument);
+
+    ::setenv("OME_WAL_SEGMENT_MB", "0", 1);
+    BOOST_CHECK_THROW(WalOptions::fromEnv(), std::invalid_argument);
+    ::setenv("OME_WAL_SEGMENT_MB", "16", 1);
+    BOOST_CHECK_EQUAL(16U << 20, WalOptions::fromEnv().segmentSize);
+    ::unsetenv("OME_WAL_SEGMENT_MB");
+}
+
+BOOST_AUTO_TEST_CASE(TestRetentionWaitsForEveryRegisteredSymbol) {
+    ome_test::TempPath path;
+    WalOptions options;
+    options.keepSnapshots = 1;
+    options.retainRecords = 10;
+    WalManager wal(path, options);
+    wal.registerEngine("A", 1);
+    wal.registerEngine("B", 2);
+    for (int i = 0; i < 100; ++i) wal.appendInbound(engine::Command::makeNew(true, 10000, 1));
+
+    wal.saveSnapshot("A", "a", 90);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    BOOST_CHECK_EQUAL(1U, replayedSeqs(wal).front());   // B still needs everything
+
+    wal.saveSnapshot("B", "b", 50);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (replayedSeqs(wal).front() == 1 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_CHECK_EQUAL(40U, replayedSeqs(wal).front());   // B's snapshot less the margin
+}
+
+BOOST_AUTO_TEST_CASE(TestFifoOutOnlyOnDbsCreatedWithIt) {
+    ome_test::TempPath created;
+    { WalManager wal(created, withProfile(RocksProfile::Journal)); }
+    BOOST_CHECK(hasFifoMarker(created));
+    { WalManager wal(created, withProfile(RocksProfile::GroupCommit)); }
+    BOOST_CHECK(hasFifoMarker(created));
+    // Level compaction may leave files below L0: a later FIFO open has to stay off.
+    { WalManager wal(created, withProfile(RocksProfile::Default)); }
+    BOOST_CHECK(!hasFifoMarker(created));
+    { WalManager wal(created, withProfile(RocksProfile::Journal)); }
+    BOOST_CHECK(!hasFifoMarker(created));
+
+    ome_test::TempPath upgraded;
+    { WalManager wal(upgraded, withProfile(RocksProfile::Default)); }
+    { WalManager wal(upgraded, withProfile(RocksProfile::Journal)); }
+    BOOST_CHECK(!hasFifoMarker(upgraded));
+}
+
+BOOST_AUTO_TEST_CASE(TestPeriodicSyncsIdleTail) {
+    ome_test::TempPath path;
+    WalOptions options = keepEverything(Backend::Segments);
+    options.segmentIo = SegmentIo::Uring;
+    options.durability = Durability::Periodic;
+    options.syncInterval = std::chrono::milliseconds(200);
+    WalManager wal(path, options);
+
+    std::vector<engine::Command> batch{engine::Command::makeNew(true, 10000, 1)};
+    batch[0].seq = wal.reserveSequences(1);
+    wal.appendInboundAsync(batch);
+    BOOST_CHECK_EQUAL(0U, wal.durableInbound());   // written within the interval: not synced yet
+
+    // No further write comes; the timer has to sync the tail.
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (wal.durableInbound() < 1 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_CHECK_EQUAL(1U, wal.durableInbound());
+}
+
+} // namespace wal